@@ -0,0 +1,83 @@
+#include "SyntheticModel.h"
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+
+/* deterministic noise so that every run decodes the same bytes */
+unsigned int nextRandom(unsigned int &state) {
+	state = state * 1664525u + 1013904223u;
+	return state >> 8;
+}
+
+bool writeTexture(const std::string &path, unsigned int size, unsigned int seed) {
+	cv::Mat image(size, size, CV_8UC3);
+	unsigned int state = seed;
+	for (unsigned int y = 0; y < size; y++) {
+		unsigned char *row = image.data + y * size * 3;
+		for (unsigned int x = 0; x < size; x++) {
+			/* gradient with noise, compresses about as badly as a photo texture */
+			unsigned int noise = nextRandom(state) & 63;
+			row[3 * x] = (unsigned char)((x * 255 / size + noise) & 255);
+			row[3 * x + 1] = (unsigned char)((y * 255 / size + noise) & 255);
+			row[3 * x + 2] = (unsigned char)((seed * 40 + noise) & 255);
+		}
+	}
+	return cv::imwrite(path, image);
+}
+
+}
+
+std::string generateSyntheticModel(const std::string &directory, const SyntheticConfig &config) {
+	unsigned int materialNum = config.materialNum ? config.materialNum : 1;
+	unsigned int textureNum = config.textureNum < materialNum ? config.textureNum : materialNum;
+	std::string objPath = directory + "/synthetic.obj", mtlPath = directory + "/synthetic.mtl";
+
+	std::ofstream mtl(mtlPath.c_str());
+	if (!mtl)
+		return "";
+	for (unsigned int i = 0; i < materialNum; i++) {
+		mtl << "newmtl material_" << i << "\n";
+		mtl << "Kd " << (i % 3 == 0 ? 0.8f : 0.3f) << " " << (i % 3 == 1 ? 0.8f : 0.3f) << " " << (i % 3 == 2 ? 0.8f : 0.3f) << "\n";
+		if (i < textureNum) {
+			char name[64];
+			sprintf(name, "texture_%u.png", i);
+			if (!writeTexture(directory + "/" + name, config.textureSize, i + 1))
+				return "";
+			mtl << "map_Kd " << name << "\n";
+		}
+	}
+	mtl.close();
+
+	std::ofstream obj(objPath.c_str());
+	if (!obj)
+		return "";
+	obj << "mtllib synthetic.mtl\n";
+	/* each mesh is a wavy grid, meshes are stacked along z */
+	unsigned int side = (unsigned int)std::ceil(std::sqrt((double)(config.vertexNum > 4 ? config.vertexNum : 4)));
+	unsigned long long base = 1;
+	char line[256];
+	for (unsigned int m = 0; m < config.meshNum; m++) {
+		obj << "o mesh_" << m << "\n";
+		for (unsigned int y = 0; y < side; y++)
+			for (unsigned int x = 0; x < side; x++) {
+				float u = (float)x / (side - 1), v = (float)y / (side - 1);
+				float z = 0.05f * std::sin(u * 12.f + m) * std::cos(v * 12.f) + 0.1f * m;
+				sprintf(line, "v %.6f %.6f %.6f\nvt %.6f %.6f\nvn 0 0 1\n", u, v, z, u, v);
+				obj << line;
+			}
+		obj << "usemtl material_" << (m % materialNum) << "\n";
+		for (unsigned int y = 0; y + 1 < side; y++)
+			for (unsigned int x = 0; x + 1 < side; x++) {
+				unsigned long long a = base + y * side + x, b = a + 1, c = a + side, d = c + 1;
+				sprintf(line, "f %llu/%llu/%llu %llu/%llu/%llu %llu/%llu/%llu\nf %llu/%llu/%llu %llu/%llu/%llu %llu/%llu/%llu\n",
+					a, a, a, b, b, b, d, d, d, a, a, a, d, d, d, c, c, c);
+				obj << line;
+			}
+		base += (unsigned long long)side * side;
+	}
+	obj.close();
+	return obj ? objPath : "";
+}
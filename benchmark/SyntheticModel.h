@@ -0,0 +1,18 @@
+#ifndef SYNTHETIC_MODEL_H
+#define SYNTHETIC_MODEL_H
+
+#include <string>
+
+/* shape of generated model */
+struct SyntheticConfig {
+	unsigned int vertexNum;/* vertices per mesh, rounded to a square grid */
+	unsigned int meshNum;
+	unsigned int materialNum;/* meshes use materials in turn */
+	unsigned int textureNum;/* first materials get a diffuse texture, at most materialNum */
+	unsigned int textureSize;/* width and height of textures */
+};
+
+/* write "synthetic.obj", its .mtl and textures into directory, return obj path or empty string */
+std::string generateSyntheticModel(const std::string &directory, const SyntheticConfig &config);
+
+#endif
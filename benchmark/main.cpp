@@ -0,0 +1,216 @@
+#include "Model.h"
+#include "OffscreenContext.h"
+#include "SyntheticModel.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+
+/* samples of one phase over all runs */
+typedef std::map<std::string, std::vector<double> > Samples;
+
+void usage() {
+	std::cout << "Usage : command [-v vertices] [-m meshes] [-M materials] [-t textures] [-s texture_size] [-r runs] [-d directory] [-o result_json] [-b baseline_json] [-T tolerance]" << std::endl;
+	std::cout << "  -v : vertices per mesh, default 65536" << std::endl;
+	std::cout << "  -m : meshes number, default 16" << std::endl;
+	std::cout << "  -M : materials number, default 4" << std::endl;
+	std::cout << "  -t : textured materials number, default 4" << std::endl;
+	std::cout << "  -s : texture width and height, default 1024" << std::endl;
+	std::cout << "  -r : runs of each load path, median is reported, default 5" << std::endl;
+	std::cout << "  -d : directory of generated model, default benchmark_data" << std::endl;
+	std::cout << "  -o : write results as JSON" << std::endl;
+	std::cout << "  -b : compare with results of a previous run, exit with 1 on regression" << std::endl;
+	std::cout << "  -T : allowed slowdown against baseline in percent, default 10" << std::endl;
+}
+
+/* load model once and record its phases under prefix */
+bool measure(const std::string &path, bool cached, Samples &samples) {
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	Model model(path);
+	/* uploads are asynchronous, include the time driver needs to finish them */
+	glFinish();
+	double wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+	if (model.empty()) {
+		std::cout << model.getErrorInfo() << std::endl;
+		return false;
+	}
+	const LoadStats &stats = model.getLoadStats();
+	if (stats.cached != cached) {
+		std::cout << "expected " << (cached ? "mesh cache" : "assimp") << " load ." << std::endl;
+		return false;
+	}
+
+	std::string prefix = cached ? "cache." : "assimp.";
+	samples[prefix + "cache_read"].push_back(stats.cacheRead);
+	if (!cached) {
+		samples[prefix + "import"].push_back(stats.import);
+		samples[prefix + "dump"].push_back(stats.dump);
+		samples[prefix + "normalize"].push_back(stats.normalize);
+		samples[prefix + "weld"].push_back(stats.weld);
+		samples[prefix + "weld_ratio"].push_back(stats.weldRatio);
+		samples[prefix + "optimize"].push_back(stats.optimize);
+		samples[prefix + "acmr_before"].push_back(stats.acmrBefore);
+		samples[prefix + "acmr_after"].push_back(stats.acmrAfter);
+		samples[prefix + "atvr_before"].push_back(stats.atvrBefore);
+		samples[prefix + "atvr_after"].push_back(stats.atvrAfter);
+		samples[prefix + "convert"].push_back(stats.convert);
+		samples[prefix + "cache_write"].push_back(stats.cacheWrite);
+	}
+	samples[prefix + "textures"].push_back(stats.textures);
+	samples[prefix + "texture_decode"].push_back(stats.textureDecode);
+	if (!cached)
+		samples[prefix + "texture_encode"].push_back(stats.textureEncode);
+	samples[prefix + "texture_upload"].push_back(stats.textureUpload);
+	samples[prefix + "mesh_upload"].push_back(stats.meshUpload);
+	samples[prefix + "total"].push_back(stats.total);
+	samples[prefix + "total_finished"].push_back(wall);
+	samples[prefix + "peak_memory_mb"].push_back(stats.peakMemory);
+	samples[prefix + "texture_memory_mb"].push_back(stats.textureMemory);
+	samples[prefix + "peak_pending_mb"].push_back(stats.peakPending);
+	return true;
+}
+
+double median(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	size_t n = values.size();
+	return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2.0;
+}
+
+/* read "name": value pairs of "results" object written by this program */
+bool readResults(const std::string &path, std::map<std::string, double> &results) {
+	std::ifstream file(path.c_str());
+	if (!file)
+		return false;
+	std::stringstream buffer;
+	buffer << file.rdbuf();
+	std::string text = buffer.str();
+	size_t pos = text.find("\"results\"");
+	if (pos == std::string::npos || (pos = text.find('{', pos)) == std::string::npos)
+		return false;
+	size_t end = text.find('}', pos);
+	while ((pos = text.find('"', pos + 1)) < end) {
+		size_t close = text.find('"', pos + 1);
+		size_t colon = text.find(':', close);
+		if (close >= end || colon >= end)
+			break;
+		results[text.substr(pos + 1, close - pos - 1)] = atof(text.c_str() + colon + 1);
+		pos = colon;
+	}
+	return !results.empty();
+}
+
+int main(int argc, char **argv) {
+	SyntheticConfig config = { 65536, 16, 4, 4, 1024 };
+	int runs = 5;
+	double tolerance = 10.0;
+	std::string directory = "benchmark_data", outputPath, baselinePath;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.size() != 2 || arg[0] != '-' || i + 1 >= argc) {
+			usage();
+			return 0;
+		}
+		std::string value = argv[++i];
+		switch (arg[1]) {
+		case 'v': config.vertexNum = (unsigned int)atoi(value.c_str()); break;
+		case 'm': config.meshNum = (unsigned int)atoi(value.c_str()); break;
+		case 'M': config.materialNum = (unsigned int)atoi(value.c_str()); break;
+		case 't': config.textureNum = (unsigned int)atoi(value.c_str()); break;
+		case 's': config.textureSize = (unsigned int)atoi(value.c_str()); break;
+		case 'r': runs = atoi(value.c_str()); break;
+		case 'd': directory = value; break;
+		case 'o': outputPath = value; break;
+		case 'b': baselinePath = value; break;
+		case 'T': tolerance = atof(value.c_str()); break;
+		default:
+			usage();
+			return 0;
+		}
+	}
+	if (runs <= 0 || !config.meshNum || !config.materialNum || !config.textureSize) {
+		usage();
+		return 0;
+	}
+
+	mkdir(directory.c_str(), 0755);
+	std::string path = generateSyntheticModel(directory, config);
+	if (path.empty()) {
+		std::cout << "Fail to generate synthetic model in " << directory << " ." << std::endl;
+		return 1;
+	}
+
+	OffscreenContext context;
+	if (context.empty()) {
+		std::cout << context.getErrorInfo() << std::endl;
+		return 1;
+	}
+	std::string renderer = (const char *)glGetString(GL_RENDERER);
+
+	/* every run imports by assimp once, then loads the caches it wrote */
+	Samples samples;
+	for (int r = 0; r < runs; r++) {
+		std::remove(MeshCache::cachePath(path).c_str());
+		for (unsigned int i = 0; i < config.textureNum && i < config.materialNum; i++) {
+			char name[32];
+			sprintf(name, "/texture_%u.png", i);
+			std::remove(TextureCache::cachePath(directory + name).c_str());
+		}
+		if (!measure(path, false, samples) || !measure(path, true, samples))
+			return 1;
+	}
+
+	std::map<std::string, double> results;
+	for (Samples::const_iterator it = samples.begin(); it != samples.end(); ++it)
+		results[it->first] = median(it->second);
+
+	std::cout << std::endl << "renderer : " << renderer << std::endl;
+	std::cout << config.meshNum << " meshes x " << config.vertexNum << " vertices, " << config.materialNum << " materials, "
+		<< config.textureNum << " textures of " << config.textureSize << "x" << config.textureSize << ", median of " << runs << " runs (ms, MB for memory, vertices transformed per triangle or vertex for ACMR and ATVR) :" << std::endl;
+	for (std::map<std::string, double>::const_iterator it = results.begin(); it != results.end(); ++it)
+		std::cout << "  " << std::left << std::setw(28) << it->first << std::right << std::fixed << std::setprecision(3) << it->second << std::endl;
+
+	if (!outputPath.empty()) {
+		std::ofstream output(outputPath.c_str());
+		output << "{\n";
+		output << "  \"config\": { \"vertices\": " << config.vertexNum << ", \"meshes\": " << config.meshNum << ", \"materials\": " << config.materialNum
+			<< ", \"textures\": " << config.textureNum << ", \"texture_size\": " << config.textureSize << ", \"runs\": " << runs << " },\n";
+		output << "  \"renderer\": \"" << renderer << "\",\n";
+		output << "  \"results\": {\n";
+		for (std::map<std::string, double>::const_iterator it = results.begin(); it != results.end(); ++it)
+			output << "    \"" << it->first << "\": " << std::fixed << std::setprecision(3) << it->second << (std::next(it) == results.end() ? "\n" : ",\n");
+		output << "  }\n}\n";
+		if (!output) {
+			std::cout << "Fail to write " << outputPath << " ." << std::endl;
+			return 1;
+		}
+	}
+
+	if (baselinePath.empty())
+		return 0;
+	std::map<std::string, double> baseline;
+	if (!readResults(baselinePath, baseline)) {
+		std::cout << "Fail to read baseline " << baselinePath << " ." << std::endl;
+		return 1;
+	}
+	/* slowdown below noise floor of half a millisecond is not reported */
+	int regressions = 0;
+	std::cout << "compared with " << baselinePath << " :" << std::endl;
+	for (std::map<std::string, double>::const_iterator it = results.begin(); it != results.end(); ++it) {
+		std::map<std::string, double>::const_iterator old = baseline.find(it->first);
+		if (old == baseline.end())
+			continue;
+		bool regressed = it->second > old->second * (1.0 + tolerance / 100.0) && it->second - old->second > 0.5;
+		double change = old->second > 0.0 ? (it->second / old->second - 1.0) * 100.0 : 0.0;
+		std::cout << "  " << std::left << std::setw(28) << it->first << std::right << std::showpos << std::setprecision(1) << change << "%" << std::noshowpos
+			<< (regressed ? "  REGRESSION" : "") << std::endl;
+		regressions += regressed ? 1 : 0;
+	}
+	return regressions ? 1 : 0;
+}
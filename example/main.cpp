@@ -1,81 +1,108 @@
+#include "DynamicResolution.h"
+#include "FileWatcher.h"
+#include "FrameCapture.h"
+#include "FrameProfiler.h"
 #include "Model.h"
+#include "ShaderLibrary.h"
 #include <GL/freeglut.h>
-#include <glm/gtc/type_ptr.hpp>
 #include <opencv2/opencv.hpp>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 
-const char *vertexShaderSource = "\
-#version 330 core\n\
-layout(location = 0) in vec3 position;\
-layout(location = 1) in vec3 color;\
-layout(location = 2) in vec3 normal;\
-layout(location = 3) in vec2 uv;\
-out Vertex {\
-	vec3 position;\
-	vec3 color;\
-	vec3 normal;\
-	vec2 uv;\
-} vertex;\
-uniform mat4 positionMatrix;\
-uniform mat4 projection;\
-void main() {\
-	vec4 vertexPosition = positionMatrix * vec4(position, 1.0);\
-	vertex.position = vertexPosition.xyz;\
-	vertex.color = color;\
-	vertex.normal = normal;\
-	vertex.uv = uv;\
-	gl_Position = projection * vertexPosition;\
-}";
-
-const char *fragmentShaderSource = "\
-#version 330 core\n\
-in Vertex {\
-	vec3 position;\
-	vec3 color;\
-	vec3 normal;\
-	vec2 uv;\
-} vertex;\
-out vec4 Color;\
-uniform mat3 normalMatrix;\
-uniform sampler2D sampler;\
-uniform bool haveTexture;\
-uniform bool useLight;\
-void main() {\
-	vec3 color = haveTexture ? texture(sampler, vertex.uv).rgb : vertex.color;\
-	if(useLight) {\
-		vec3 lightPosition = vec3(0.0, 0.0, 2.0); \
-		vec3 ambient = color * 0.05;\
-		vec3 normal = normalize(normalMatrix * vertex.normal);\
-		vec3 lightDirection = normalize(lightPosition - vertex.position);\
-		vec3 diffuse = max(dot(lightDirection, normal), 0.0) * color;\
-		Color = vec4(ambient + diffuse, 1.0);\
-	} else\
-		Color = vec4(color,1.0);\
-}";
-
 const GLfloat step = 0.02f;
-GLuint vertexShaderId, fragmentShaderId, programId;
 bool useLight = false;
+bool frustumCulling = true, occlusionCulling = false;
 glm::vec3 translation;
+GLfloat homeDistance = 2.f;/* model distance after reset */
 GLint angleX = 0, angleY = 0, angleZ = 0;
 int windowWidth, windowHeight;
 bool leftButtonDown = false;
 int oldX = 0, oldY = 0;
+int motionX = 0, motionY = 0;/* latest pointer position, applied once per frame */
+int pressX = 0, pressY = 0;/* pointer position when left button went down, a click without drag picks */
+bool havePicked = false;/* a point was picked before, distance to it is measured */
+glm::vec3 pickedPoint;/* in model file units */
+bool dynamicResolution = true;/* reduced resolution while interacting */
+const int IDLE_DELAY = 200;/* ms without input before a full resolution frame */
+std::chrono::steady_clock::time_point lastInteraction;
+bool settlePending = false;
+const double VIDEO_FPS = 30.0;/* playback rate of recorded videos, drawn frames are repeated or skipped to keep real time */
+bool snapshotRequested = false;
+int turntableFrames = 36;/* frames of a turntable, a full turn around Y axis */
+int turntableStep = -1;/* frame being recorded, -1 when not recording */
+int turntableStartAngle = 0;
+bool capturePolling = false;/* timer hands read backs to encoders while nothing is drawn */
+const int WATCH_INTERVAL = 100;/* ms between looks at watched files */
+std::string modelPath;
+ModelOptions modelOptions;
+bool loadPolling = false;/* timer uploads what loading or reloading made ready */
+bool filesWatched = false;/* textures of current model are watched too */
+bool reloadWanted = false;/* model file changed while model could not reload */
 
 bool initialize();
-void clear();
-bool check(GLuint id, GLenum id_type, GLenum target_type);
 void reshape(int w, int h);
 void display();
 void keyboard(unsigned char key, int, int);
 void mouse(int button, int state, int x, int y);
 void motion(int x, int y);
+void pick(int x, int y);
+void loadStep(int);
+void pollLoading();
+void watchStep(int);
+void interact();
+void settle(int);
+bool captureFrame();
+void captureStep(int);
+void closeWindow();
 
 Model * model_ptr = nullptr;
+ShaderLibrary * library_ptr = nullptr;
+RenderState * state_ptr = nullptr;
+InstanceBuffer * instances_ptr = nullptr;/* copies laid out in a grid, null for a single model */
+FrameProfiler * profiler_ptr = nullptr;
+FileWatcher * watcher_ptr = nullptr;
+DynamicResolution * resolution_ptr = nullptr;
+FrameCapture * capture_ptr = nullptr;
+bool showProfile = false;/* overlay graph and averages in title */
+bool profileLog = false;/* every frame goes to log file */
 
 int main(int argc, char **argv) {
-	if (argc < 2) {
-		std::cout << "Usage : command model_filename" << std::endl;
+	ModelOptions options;
+	/* window shows boxes at once and meshes as they arrive */
+	options.progressive = true;
+	int argi = 1, copies = 1;
+	std::string profilePath;
+	double frameTime = 1000.0 / 30;
+	double budget = -1.0;/* MB, video memory driver reports if not given */
+	for (; argi < argc - 1; argi++) {
+		std::string arg = argv[argi];
+		if (arg == "-arena")
+			options.arena = true;
+		else if (arg == "-lod")
+			options.lod = true;
+		else if (arg == "-overdraw")
+			options.optimize = OPTIMIZE_OVERDRAW;
+		else if (arg == "-weld" && argi + 2 < argc)
+			options.weldEpsilon = (float)atof(argv[++argi]);
+		else if (arg == "-instances" && argi + 2 < argc)
+			copies = atoi(argv[++argi]);
+		else if (arg == "-profile" && argi + 2 < argc)
+			profilePath = argv[++argi];
+		else if (arg == "-frametime" && argi + 2 < argc)
+			frameTime = atof(argv[++argi]);
+		else if (arg == "-turntable" && argi + 2 < argc)
+			turntableFrames = atoi(argv[++argi]);
+		else if (arg == "-budget" && argi + 2 < argc)
+			budget = atof(argv[++argi]);
+		else
+			break;
+	}
+	if (argc != argi + 1 || copies < 1 || options.weldEpsilon < 0.f || frameTime <= 0.0 || turntableFrames < 1) {
+		std::cout << "Usage : command [-arena] [-lod] [-overdraw] [-weld epsilon] [-instances copies] [-profile log.json|log.csv] [-frametime ms] [-turntable frames] [-budget MB] model_filename" << std::endl;
 		return 0;
 	}
 
@@ -97,24 +124,88 @@ int main(int argc, char **argv) {
 		return 0;
 	}
 
-	translation = glm::vec3(0.f, 0.f, -2.f);
+	/* permutations of model program, binaries of earlier launches skip compiling */
+	ShaderLibrary library;
+	if (library.empty()) {
+		std::cout << library.getErrorInfo() << std::endl;
+		return 0;
+	}
+	if (!library.getErrorInfo().empty())
+		std::cout << library.getErrorInfo() << std::endl;
+	library_ptr = &library;
+
+	RenderState state(library);
+	state_ptr = &state;
+
+	FrameProfiler profiler;
+	profiler_ptr = &profiler;
+	state.setProfiler(&profiler);
+	if (!profilePath.empty()) {
+		if (!profiler.openLog(profilePath)) {
+			std::cout << "Fail to open " << profilePath << " ." << std::endl;
+			return 0;
+		}
+		profileLog = true;
+		profiler.setEnabled(true);
+	}
+
+	DynamicResolution resolution(frameTime);
+	if (!resolution.empty())
+		resolution_ptr = &resolution;
+
+	FrameCapture capture;
+	if (capture.empty()) {
+		std::cout << capture.getErrorInfo() << std::endl;
+		return 0;
+	}
+	capture_ptr = &capture;
+
+	/* normalized model fits in [-1,1], copies stand on a square grid in XY plane */
+	InstanceBuffer instances;
+	if (copies > 1) {
+		int side = (int)glm::ceil(glm::sqrt((float)copies));
+		std::vector<glm::mat4> transforms(copies);
+		for (int i = 0; i < copies; i++)
+			transforms[i] = glm::translate(glm::mat4(1.f), 2.5f * glm::vec3(i % side - (side - 1) / 2.f, i / side - (side - 1) / 2.f, 0.f));
+		instances.update(transforms);
+		instances_ptr = &instances;
+		homeDistance = 2.f + 2.5f * side;
+	}
+	translation = glm::vec3(0.f, 0.f, -homeDistance);
+
+	/* textures of models larger than video memory load at coarser levels instead of failing */
+	options.memoryBudget = budget < 0.0 ? Model::videoMemory() : (size_t)(budget * 1048576.0);
 
-	Model model(argv[1]);
-	if (model.empty()) {
-		std::cout << model.getErrorInfo() << std::endl;
+	modelPath = argv[argi];
+	modelOptions = options;
+	model_ptr = new Model(modelPath, modelOptions);
+	if (model_ptr->empty()) {
+		std::cout << model_ptr->getErrorInfo() << std::endl;
+		delete model_ptr;
 		return 0;
 	}
 
-	model_ptr = &model;
+	/* edits of model file or its images show up without restart */
+	FileWatcher watcher;
+	if (!watcher.empty() && watcher.watch(modelPath))
+		watcher_ptr = &watcher;
+	else
+		std::cout << watcher.getErrorInfo() << std::endl;
 
 	glutReshapeFunc(reshape);
 	glutDisplayFunc(display);
 	glutKeyboardFunc(keyboard);
 	glutMouseFunc(mouse);
 	glutMotionFunc(motion);
+	glutCloseFunc(closeWindow);
+	pollLoading();
+	if (watcher_ptr != nullptr)
+		glutTimerFunc(WATCH_INTERVAL, watchStep, 0);
 
 	glutMainLoop();
-	clear();
+	/* log is complete before GL objects go */
+	profiler.closeLog();
+	delete model_ptr;
 	return 0;
 }
 
@@ -123,71 +214,6 @@ bool initialize() {
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 	glCullFace(GL_BACK);
-
-	vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-	if (!vertexShaderId) {
-		std::cout << "Fail to create vertex_shader ." << std::endl;
-		return false;
-	}
-	glShaderSource(vertexShaderId, 1, &vertexShaderSource, NULL);
-	glCompileShader(vertexShaderId);
-	if (!check(vertexShaderId, GL_VERTEX_SHADER, GL_COMPILE_STATUS))
-		return false;
-
-	fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-	if (!fragmentShaderId) {
-		std::cout << "Fail to create fragment_shader ." << std::endl;
-		return false;
-	}
-	glShaderSource(fragmentShaderId, 1, &fragmentShaderSource, NULL);
-	glCompileShader(fragmentShaderId);
-	if (!check(fragmentShaderId, GL_FRAGMENT_SHADER, GL_COMPILE_STATUS))
-		return false;
-
-	programId = glCreateProgram();
-	if (!programId) {
-		std::cout << "Fail to create program ." << std::endl;
-		return false;
-	}
-	glAttachShader(programId, vertexShaderId);
-	glAttachShader(programId, fragmentShaderId);
-	glLinkProgram(programId);
-	if (!check(programId, 0, GL_LINK_STATUS))
-		return false;
-
-	glDeleteShader(vertexShaderId);
-	glDeleteShader(fragmentShaderId);
-
-	glUseProgram(programId);
-	return true;
-}
-
-bool check(GLuint id, GLenum id_type, GLenum target_type) {
-	int success;
-	char infoLog[1024];
-	if (target_type == GL_COMPILE_STATUS) {/* check shaders compile */
-		glGetShaderiv(id, target_type, &success);
-		if (!success) {
-			std::cout << "Fail to compile ";
-			if (id_type == GL_VERTEX_SHADER)
-				std::cout << "vertex_shader :" << std::endl;
-			else if (id_type == GL_FRAGMENT_SHADER)
-				std::cout << "fragment_shader :" << std::endl;
-			else if (id_type == GL_GEOMETRY_SHADER)
-				std::cout << "geometry_shader :" << std::endl;
-			glGetShaderInfoLog(id, 1024, NULL, infoLog);
-			std::cout << infoLog << std::endl;
-			return false;
-		}
-	} else if (target_type == GL_LINK_STATUS) {/* check program link */
-		glGetProgramiv(id, target_type, &success);
-		if (!success) {
-			std::cout << "Fail to link program :" << std::endl;
-			glGetProgramInfoLog(id, 1024, NULL, infoLog);
-			std::cout << infoLog << std::endl;
-			return false;
-		}
-	}
 	return true;
 }
 
@@ -195,32 +221,207 @@ void reshape(int w, int h) {
 	glViewport(0, 0, windowWidth = w, windowHeight = h);
 }
 
-void display() {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+/* time since last input decides, dragging counts as long as the button is down */
+bool interacting() {
+	return leftButtonDown || std::chrono::steady_clock::now() - lastInteraction < std::chrono::milliseconds(IDLE_DELAY);
+}
 
-	glm::mat4 view = glm::translate(glm::mat4(1.f), translation);
+/* input changed the view, a full resolution frame follows when it stops */
+void interact() {
+	lastInteraction = std::chrono::steady_clock::now();
+	glutPostRedisplay();
+	if (!settlePending) {
+		settlePending = true;
+		glutTimerFunc(IDLE_DELAY, settle, 0);
+	}
+}
+
+/* one timer at a time follows input, it waits again while input goes on */
+void settle(int) {
+	if (interacting()) {
+		glutTimerFunc(IDLE_DELAY / 2, settle, 0);
+		return;
+	}
+	settlePending = false;
+	glutPostRedisplay();
+}
+
+/* pointer moves since last frame, events arriving faster than frames add up into one rotation */
+glm::mat4 modelMatrix() {
 	glm::mat4 model = glm::mat4(1.f);
 	model = glm::rotate(model, glm::radians(1.f*angleX), glm::vec3(1.f, 0.f, 0.f));
 	model = glm::rotate(model, glm::radians(1.f*angleY), glm::vec3(0.f, 1.f, 0.f));
 	model = glm::rotate(model, glm::radians(1.f*angleZ), glm::vec3(0.f, 0.f, 1.f));
+	return model;
+}
+
+glm::mat4 projectionMatrix() {
+	return glm::perspective(glm::radians(45.f), 1.f*windowWidth / windowHeight, .1f, 1000000.f);
+}
+
+void applyMotion() {
+	int dx = motionX - oldX, dy = motionY - oldY;
+	if (!leftButtonDown || (!dx && !dy))
+		return;
+	/* half a degree per pixel along the main direction, odd pixel is kept for next frame */
+	oldX = motionX;
+	oldY = motionY;
+	if (abs(dx) > abs(dy)) {
+		angleY = (angleY + dx / 2) % 360;
+		oldX -= dx % 2;
+	} else {
+		angleX = (angleX + dy / 2) % 360;
+		oldY -= dy % 2;
+	}
+}
+
+void display() {
+	state_ptr->beginFrame();
+	profiler_ptr->beginFrame(state_ptr->getCounters());
+	applyMotion();
+	std::chrono::steady_clock::time_point frameBegin = std::chrono::steady_clock::now();
+	/* recorded turntable frames are full resolution */
+	bool reduced = dynamicResolution && turntableStep < 0 && resolution_ptr != nullptr && interacting() && resolution_ptr->begin(windowWidth, windowHeight);
+	float scale = reduced ? resolution_ptr->getScale() : 1.f;
+	profiler_ptr->beginSection("clear", true);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	profiler_ptr->endSection();
+
+	profiler_ptr->beginSection("uniforms");
+	glm::mat4 view = glm::translate(glm::mat4(1.f), translation);
+	glm::mat4 model = modelMatrix();
 
 	glm::mat4 positionMatrix = view*model;
-	glUniformMatrix4fv(glGetUniformLocation(programId, "positionMatrix"), 1, GL_FALSE, glm::value_ptr(positionMatrix));
+	state_ptr->setMat4(UNIFORM_POSITION_MATRIX, positionMatrix);
 
 	glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(model)));
-	glUniformMatrix3fv(glGetUniformLocation(programId, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMatrix));
-
-	glm::mat4 projection = glm::perspective(glm::radians(45.f), 1.f*windowWidth / windowHeight, .1f, 1000000.f);
-	glUniformMatrix4fv(glGetUniformLocation(programId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+	state_ptr->setMat3(UNIFORM_NORMAL_MATRIX, normalMatrix);
+
+	glm::mat4 projection = projectionMatrix();
+	state_ptr->setMat4(UNIFORM_PROJECTION, projection);
+
+	state_ptr->setInt(UNIFORM_USE_LIGHT, (int)useLight);
+
+	Frustum frustum(projection*positionMatrix);
+	/* coarser levels while rotating keep dragging smooth */
+	LodSelector lod(positionMatrix, projection, (int)(windowHeight * scale), leftButtonDown ? 8.f : 2.f);
+	profiler_ptr->endSection();
+
+	/* material sections inside are timed on GPU */
+	profiler_ptr->beginSection("meshes");
+	if (instances_ptr != nullptr)
+		model_ptr->drawInstanced(*state_ptr, *instances_ptr);
+	else
+		model_ptr->draw(*state_ptr, frustumCulling ? &frustum : nullptr, &lod);
+	profiler_ptr->endSection();
+
+	if (reduced) {
+		profiler_ptr->beginSection("upsample", true);
+		resolution_ptr->end();
+		profiler_ptr->endSection();
+	}
 
-	glUniform1i(glGetUniformLocation(programId, "useLight"), (int)useLight);
+	profiler_ptr->beginSection("capture");
+	bool capturing = captureFrame();
+	profiler_ptr->endSection();
 
-	model_ptr->draw(programId);
+	if (showProfile) {
+		ProfileScope scope(profiler_ptr, "overlay", true);
+		profiler_ptr->drawOverlay(windowWidth, windowHeight);
+	}
 
+	profiler_ptr->beginSection("swap");
 	glutSwapBuffers();
+	profiler_ptr->endSection();
+	profiler_ptr->endFrame();
+	/* swap waits for earlier frames once driver queue is full, so this follows GPU time too */
+	if (reduced)
+		resolution_ptr->adapt(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameBegin).count());
+
+	if (capturing)
+		glutPostRedisplay();
+
+	/* measure steady frames while profiling, averages go to title twice a second */
+	if (profiler_ptr->enabled()) {
+		static std::chrono::steady_clock::time_point titleTime;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (showProfile && now - titleTime > std::chrono::milliseconds(500)) {
+			glutSetWindowTitle(profiler_ptr->summary().c_str());
+			titleTime = now;
+		}
+		glutPostRedisplay();
+		return;
+	}
+
+	/* occlusion results arrive one frame late, draw once more so that meshes showing again appear */
+	static bool settleFrame = false;
+	settleFrame = !settleFrame && state_ptr->getCounters().meshesOccluded;
+	if (settleFrame)
+		glutPostRedisplay();
+}
+
+/* first "prefix_NNNN.extension" not taken yet, earlier captures are kept */
+std::string numberedPath(const std::string &prefix, const std::string &extension) {
+	static int number = 0;
+	char name[32];
+	for (;;) {
+		snprintf(name, sizeof(name), "_%04d", ++number);
+		std::string path = prefix + name + extension;
+		if (!std::ifstream(path.c_str()).good())
+			return path;
+	}
+}
+
+/* read back of finished frame, return true if next frame must follow at once */
+bool captureFrame() {
+	bool more = false;
+	if (snapshotRequested) {
+		snapshotRequested = false;
+		std::string path = numberedPath("preview", ".png");
+		if (capture_ptr->captureImage(windowWidth, windowHeight, path))
+			std::cout << "saving " << path << " ." << std::endl;
+	}
+	if (turntableStep >= 0) {
+		char name[32];
+		snprintf(name, sizeof(name), "turntable_%04d.png", turntableStep);
+		capture_ptr->captureImage(windowWidth, windowHeight, name);
+		if (++turntableStep < turntableFrames)
+			angleY = (turntableStartAngle + 360 * turntableStep / turntableFrames) % 360;
+		else {
+			std::cout << "turntable of " << turntableFrames << " frames recorded ." << std::endl;
+			angleY = turntableStartAngle;
+			turntableStep = -1;
+		}
+		more = true;
+	}
+	if (capture_ptr->recording()) {
+		capture_ptr->captureVideoFrame(windowWidth, windowHeight);
+		more = true;
+	}
+	if (!capturePolling && capture_ptr->update()) {
+		capturePolling = true;
+		glutTimerFunc(16, captureStep, 0);
+	}
+	return more;
+}
+
+void captureStep(int) {
+	capturePolling = capture_ptr->update();
+	if (capturePolling)
+		glutTimerFunc(16, captureStep, 0);
+}
+
+/* window is about to go with its context, captures in flight are written first */
+void closeWindow() {
+	capture_ptr->endVideo();
+	capture_ptr->finish();
+	if (capture_ptr->getFailed())
+		std::cout << capture_ptr->getFailed() << " captured frames could not be written ." << std::endl;
 }
 
 void keyboard(unsigned char key, int, int) {
+	/* held keys repeat like dragging */
+	bool move = key && std::string("fnwsadqe").find((char)tolower(key)) != std::string::npos;
 	if (key == 'f' || key == 'F')
 		translation.z -= step;
 	else if (key == 'n' || key == 'N')
@@ -239,46 +440,209 @@ void keyboard(unsigned char key, int, int) {
 		angleZ = (angleZ - 2) % 360;
 	else if (key == 'r' || key == 'R') {
 		useLight = false;
-		translation = glm::vec3(0.f, 0.f, -2.f);
+		translation = glm::vec3(0.f, 0.f, -homeDistance);
 		angleX = angleY = angleZ = 0;
-		oldX = oldY = 0;
+		oldX = motionX;
+		oldY = motionY;
 	} else if (key == 'l' || key == 'L')
 		useLight = !useLight;
-	else if(key == 'p' || key == 'P') {
-		cv::Mat image(windowHeight, windowWidth, CV_8UC4);
-		glReadPixels(0, 0, windowWidth, windowHeight, GL_BGRA, GL_UNSIGNED_BYTE, image.data);
-		cv::flip(image, image, 0);
-		cv::imwrite("preview.png", image);
+	else if (key == 'p' || key == 'P')
+		/* read back at end of next frame, before overlay */
+		snapshotRequested = true;
+	else if (key == 'k' || key == 'K') {
+		if (turntableStep >= 0)
+			return;
+		turntableStep = 0;
+		turntableStartAngle = angleY;
+	} else if (key == 'm' || key == 'M') {
+		if (capture_ptr->recording()) {
+			capture_ptr->endVideo();
+			std::cout << "video recorded ." << std::endl;
+			return;
+		}
+		std::string path = numberedPath("capture", ".avi");
+		if (!capture_ptr->beginVideo(path, windowWidth, windowHeight, VIDEO_FPS)) {
+			std::cout << capture_ptr->getErrorInfo() << std::endl;
+			return;
+		}
+		std::cout << "recording " << path << " ." << std::endl;
+	} else if (key == 'i' || key == 'I') {
+		/* GL calls of last frame */
+		const RenderCounters &counters = state_ptr->getCounters();
+		std::cout << counters.drawCalls << " draw calls, " << counters.stateCalls << " state calls, "
+			<< counters.redundantCalls << " redundant calls and " << counters.lookupCalls << " uniform lookups saved, " << counters.programSwitches << " program switches ." << std::endl;
+		const ShaderLibrary::Stats &shaders = library_ptr->getStats();
+		std::cout << shaders.compiled << " shader permutations compiled and " << shaders.loaded << " loaded from cache in " << shaders.time << " ms ." << std::endl;
+		std::cout << counters.trianglesDrawn << " triangles, " << counters.meshesDrawn << " meshes drawn, " << counters.meshesCulled << " out of view, " << counters.meshesOccluded << " occluded ." << std::endl;
+		TextureLibraryStats textures = TextureLibrary::shared().getStats();
+		std::cout << textures.textureNum << " textures of " << textures.bytes / 1024 << " KB, " << textures.hits << " shared and " << textures.misses
+			<< " uploaded since start, " << textures.bytesSaved / 1024 << " KB saved ." << std::endl;
+		if (!profiler_ptr->getHistory().empty())
+			std::cout << profiler_ptr->summary() << std::endl;
+		return;
+	} else if (key == 'v' || key == 'V') {
+		dynamicResolution = !dynamicResolution;
+		std::cout << "reduced resolution while interacting " << (dynamicResolution ? "on" : "off") << " ." << std::endl;
+		return;
+	} else if (key == 't' || key == 'T') {
+		/* logging keeps profiler running without overlay */
+		showProfile = !showProfile;
+		profiler_ptr->setEnabled(showProfile || profileLog);
+		if (!showProfile)
+			glutSetWindowTitle("OpenGL");
+	} else if (key == 'c' || key == 'C')
+		frustumCulling = !frustumCulling;
+	else if (key == 'o' || key == 'O') {
+		occlusionCulling = !occlusionCulling;
+		model_ptr->setOcclusionCulling(occlusionCulling);
 	} else
 		return;
-	glutPostRedisplay();
+	if (move)
+		interact();
+	else
+		glutPostRedisplay();
+}
+
+/* trace ray under pointer through model, print triangle hit and distance to point picked before */
+void pick(int x, int y) {
+	if (instances_ptr != nullptr) {
+		std::cout << "picking is not supported with instances ." << std::endl;
+		return;
+	}
+	if (model_ptr->loading()) {
+		std::cout << "model is still loading ." << std::endl;
+		return;
+	}
+	/* pointer on near plane and halfway into depth range, taken back into normalized model space */
+	glm::mat4 inverse = glm::inverse(projectionMatrix() * glm::translate(glm::mat4(1.f), translation) * modelMatrix());
+	float ndcX = 2.f * (x + .5f) / windowWidth - 1.f, ndcY = 1.f - 2.f * (y + .5f) / windowHeight;
+	glm::vec4 front = inverse * glm::vec4(ndcX, ndcY, -1.f, 1.f), middle = inverse * glm::vec4(ndcX, ndcY, 0.f, 1.f);
+	glm::vec3 origin = glm::vec3(front) / front.w;
+	glm::vec3 direction = glm::normalize(glm::vec3(middle) / middle.w - origin);
+
+	PickResult result;
+	bool hit = model_ptr->pick(origin, direction, result);
+	/* hierarchies are built on first pick */
+	if (result.buildTime > 0.0)
+		std::cout << "triangle hierarchies built in " << result.buildTime << " ms ." << std::endl;
+	if (!hit) {
+		std::cout << "nothing picked in " << result.queryTime << " ms ." << std::endl;
+		return;
+	}
+	glm::vec3 point = model_ptr->getCenter() + result.point * model_ptr->getMaxDistance();
+	std::cout << "picked mesh[" << result.mesh << "] triangle " << result.triangle << " at (" << point.x << ", " << point.y << ", " << point.z
+		<< ") in " << result.queryTime << " ms ." << std::endl;
+	if (havePicked)
+		std::cout << "distance to previous point : " << glm::length(point - pickedPoint) << " ." << std::endl;
+	havePicked = true;
+	pickedPoint = point;
 }
 
 void mouse(int button, int state, int x, int y) {
 	if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
 		leftButtonDown = true;
-		oldX = x;
-		oldY = y;
+		oldX = motionX = pressX = x;
+		oldY = motionY = pressY = y;
 	}
-	else if (button == GLUT_LEFT_BUTTON && state == GLUT_UP)
+	else if (button == GLUT_LEFT_BUTTON && state == GLUT_UP) {
 		leftButtonDown = false;
+		/* a click that rotated by less than a degree picks */
+		if (abs(x - pressX) < 2 && abs(y - pressY) < 2)
+			pick(x, y);
+		/* back to finer levels of detail, and to full resolution after idle delay */
+		interact();
+	}
 }
 
+/* only remember pointer, a redraw already posted takes it along */
 void motion(int x, int y) {
-	int dx = x - oldX, dy = y - oldY;
-	if(!dx && !dy) return;
-	int adx = abs(dx), ady = abs(dy);
-	if (leftButtonDown) {
-		if (adx > ady)
-			angleY = (angleY + 2 * dx / adx) % 360;
-		else
-			angleX = (angleX + 2 * dy / ady) % 360;
-		oldX = x;
-		oldY = y;
+	if (!leftButtonDown || (x == motionX && y == motionY))
+		return;
+	motionX = x;
+	motionY = y;
+	interact();
+}
+
+/* report finished reload, or load model again when its layout changed, view stays where it is */
+void finishReload() {
+	const ReloadStats &stats = model_ptr->getReloadStats();
+	if (stats.failed) {
+		std::cout << "Fail to reload : " << model_ptr->getErrorInfo() << std::endl;
+		return;
+	}
+	if (!stats.restructured) {
+		std::cout << stats.meshesUploaded << " of " << stats.meshNum << " meshes and " << stats.texturesUploaded
+			<< " textures uploaded again in " << stats.time << " ms ." << std::endl;
+		return;
+	}
+	std::cout << "meshes or materials of " << modelPath << " changed, loading it again ." << std::endl;
+	Model *model = new Model(modelPath, modelOptions);
+	if (model->empty()) {
+		std::cout << model->getErrorInfo() << std::endl;
+		delete model;
+		return;
+	}
+	model->setOcclusionCulling(occlusionCulling);
+	delete model_ptr;
+	model_ptr = model;
+	filesWatched = false;
+}
+
+/* upload loaded data about every frame, a few ms at a time so that input stays responsive */
+void loadStep(int) {
+	bool reloading = model_ptr->reloading();
+	bool changed = model_ptr->update(8.0);
+	if (model_ptr->empty()) {
+		std::cout << model_ptr->getErrorInfo() << std::endl;
+		glutLeaveMainLoop();
+		return;
+	}
+	if (changed)
 		glutPostRedisplay();
+	if (reloading && !model_ptr->reloading())
+		finishReload();
+	if (model_ptr->loading() || model_ptr->reloading()) {
+		glutTimerFunc(16, loadStep, 0);
+		return;
 	}
+	/* finer texture levels go on streaming after load */
+	if (model_ptr->streaming())
+		glutTimerFunc(16, loadStep, 0);
+	else
+		loadPolling = false;
+	/* images are known once model is loaded */
+	if (!filesWatched && watcher_ptr != nullptr) {
+		std::vector<std::string> textures = model_ptr->getTexturePaths();
+		watcher_ptr->clear();
+		watcher_ptr->watch(modelPath);
+		for (size_t i = 0; i < textures.size(); i++)
+			watcher_ptr->watch(textures[i]);
+		filesWatched = true;
+	}
+}
+
+/* one timer at a time uploads */
+void pollLoading() {
+	if (loadPolling)
+		return;
+	loadPolling = true;
+	glutTimerFunc(0, loadStep, 0);
 }
 
-void clear() {
-	glDeleteProgram(programId);
+/* reload changed files in background, a model file changed while loading waits for it */
+void watchStep(int) {
+	std::vector<std::string> changed = watcher_ptr->poll();
+	for (size_t i = 0; i < changed.size(); i++) {
+		if (changed[i] == modelPath)
+			reloadWanted = true;
+		else if (model_ptr->reloadTexture(changed[i]))
+			std::cout << "reloading " << changed[i] << " ." << std::endl;
+	}
+	if (reloadWanted && model_ptr->reload()) {
+		reloadWanted = false;
+		std::cout << "reloading " << modelPath << " ." << std::endl;
+	}
+	if (model_ptr->reloading())
+		pollLoading();
+	glutTimerFunc(WATCH_INTERVAL, watchStep, 0);
 }
\ No newline at end of file
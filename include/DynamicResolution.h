@@ -0,0 +1,51 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <GL/glew.h>
+
+/*
+ * single sample framebuffer drawn at a fraction of window size and stretched over the window
+ * by a textured triangle with linear filtering (a blit can not go to a multisampled window),
+ * for frames drawn while the user interacts. storage has window size, only its lower left
+ * part is drawn, so changing scale does not reallocate. scale follows measured frame time
+ * towards a target, pixels cost about the square of it.
+ */
+class DynamicResolution {
+private:
+	bool _exist;
+	GLuint _framebuffer, _colorTexture, _depthBuffer;
+	GLuint _programId, _VAO_ID;/* stretching */
+	int _bufferWidth, _bufferHeight;/* storage */
+	int _windowWidth, _windowHeight;/* of current frame */
+	int _width, _height;/* part drawn in current frame */
+	GLint _drawFramebuffer;/* bound before begin */
+	double _targetTime;/* ms */
+	float _minScale, _scale;
+	bool _active;/* between begin and end */
+
+	/* allocate storage of window size */
+	bool resize(int width, int height);
+
+public:
+	/* frames aim at targetTime ms, resolution does not go below minScale of window */
+	DynamicResolution(double targetTime = 1000.0 / 30, float minScale = 0.25f);
+	~DynamicResolution();
+
+	/* draw into reduced framebuffer, viewport and scissor cover part of current scale */
+	bool begin(int windowWidth, int windowHeight);
+	/* stretch drawn part over window framebuffer bound before begin,
+	   program, vertex array, texture of unit 0 and depth test are restored */
+	void end();
+
+	/* move scale towards target from time of last reduced frame in ms */
+	void adapt(double frameTime);
+
+	void setTargetTime(double targetTime);
+	double getTargetTime() const;
+	float getScale() const;
+
+	/* succeed in creating framebuffer or not */
+	bool empty() const;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * notices changes of a set of files without blocking. on Linux inotify watches the directories
+ * of files, so that a file replaced by rename, as editors and exporters save it, is still
+ * followed. elsewhere size and modification time of files are polled. a file is reported
+ * once it has been quiet for a while, not while it is being written.
+ */
+class FileWatcher {
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct File {
+		std::string directory, name;
+		bool changed;/* waits until quiet */
+		Clock::time_point lastEvent;
+		unsigned long long size;/* for polling */
+		long long time;
+	};
+
+	bool _exist;
+	std::string _errorInfo;
+	int _fd;/* inotify descriptor, -1 when polling */
+	std::map<int, std::string> _directories;/* directory of each watch */
+	std::map<std::string, File> _files;/* by path passed to watch() */
+	Clock::time_point _lastPoll;
+
+	/* read pending inotify events */
+	void readEvents();
+	/* compare sizes and modification times with last poll */
+	void pollTimes();
+
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	/* follow changes of file, return false if its directory can not be watched */
+	bool watch(const std::string &path);
+	/* stop following every file */
+	void clear();
+
+	/* files changed and quiet for settle ms since last call, as passed to watch() */
+	std::vector<std::string> poll(double settle = 200.0);
+
+	/* get error information */
+	const std::string & getErrorInfo() const;
+
+	/* succeed in creating watcher or not */
+	bool empty() const;
+
+	/* size and modification time of file in ns (whole seconds on Windows), both 0 and false if it is missing */
+	static bool identity(const std::string &path, unsigned long long &size, long long &time);
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <GL/glew.h>
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+
+/*
+ * read back of window frames without stalling drawing. a frame is read into one of a ring
+ * of pixel buffer objects and copied out a few frames later when its fence is signaled,
+ * images are flipped and encoded on the shared thread pool. frames of a video keep their
+ * order, they are written by one pool task at a time. video frames follow wall clock time, a
+ * frame drawn late is repeated and one drawn before the next is due is skipped.
+ */
+class FrameCapture {
+public:
+	static const unsigned int RING_SIZE = 3;/* read backs in flight, capture waits for oldest beyond */
+	static const unsigned int MAX_QUEUED = 8;/* frames copied out and waiting for encoding, capture waits beyond */
+
+private:
+	/* read back in flight */
+	struct Slot {
+		GLuint PBO;
+		size_t capacity;/* bytes of buffer storage */
+		GLsync fence;/* null when slot is free */
+		int width, height;
+		bool video;
+		unsigned int repeat;/* video frames the read back stands for */
+		std::string path;
+	};
+
+	bool _exist;
+	std::string _errorInfo;
+	Slot _slots[RING_SIZE];
+	unsigned int _next;/* slot of next read back, oldest one when all are in use */
+
+	/* shared with pool tasks */
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	unsigned int _queued;/* frames not encoded yet, video frames included */
+	unsigned int _written, _failed;
+	cv::VideoWriter *_video;
+	cv::Size _videoSize;
+	std::deque<cv::Mat> _videoFrames;
+	bool _videoDraining;/* a pool task writes video frames */
+	std::chrono::steady_clock::time_point _videoBegin;
+	double _videoFps;
+	unsigned long long _videoFrameNum;/* frames handed to video so far, repeats included */
+
+	/* read back window into next slot */
+	bool read(int width, int height, bool video, unsigned int repeat, const std::string &path);
+	/* copy slot out and hand it to encoders, wait for its fence if asked */
+	bool complete(Slot &slot, bool wait);
+	/* write queued video frames in order, runs on pool */
+	void drainVideo();
+
+public:
+	FrameCapture();
+	/* every frame captured is written before return */
+	~FrameCapture();
+
+	/* read lower left width x height of window framebuffer, image is written to path once it arrives */
+	bool captureImage(int width, int height, const std::string &path);
+
+	/* start a video of frames of width x height, ".avi" is Motion JPEG and other names MPEG-4 */
+	bool beginVideo(const std::string &path, int width, int height, double fps);
+	/* read window framebuffer as the video frames due since last call, none if next one is not due yet,
+	   frames of another size are scaled */
+	bool captureVideoFrame(int width, int height);
+	/* write remaining frames and close video */
+	void endVideo();
+	bool recording() const;
+
+	/* hand finished read backs to encoders, call about once a frame, return true while read backs are in flight */
+	bool update();
+	/* wait for every read back and encoding */
+	void finish();
+
+	/* frames captured and not written yet */
+	unsigned int getPending();
+	/* frames written and frames that failed to encode since construction */
+	unsigned int getWritten();
+	unsigned int getFailed();
+
+	/* get error information */
+	const std::string & getErrorInfo() const;
+
+	/* succeed in creating buffers or not */
+	bool empty() const;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef FRAME_PROFILER_H
+#define FRAME_PROFILER_H
+
+#include "RenderState.h"
+#include <GL/glew.h>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/* one named part of a frame, times in ms */
+struct ProfileSection {
+	std::string name;
+	unsigned int depth;/* sections begun inside others are deeper */
+	double cpu;
+	double gpu;/* negative without GPU timing */
+	unsigned int drawCalls, triangles;
+};
+
+/* times in ms and GL calls of one frame */
+struct FrameProfile {
+	unsigned long long frame;
+	double cpu;/* from beginFrame to endFrame */
+	double gpu;/* sum of timed sections */
+	double interval;/* from last beginFrame, includes time outside display */
+	unsigned int drawCalls, triangles;
+	std::vector<ProfileSection> sections;
+};
+
+/*
+ * CPU timers and GL_TIME_ELAPSED queries around parts of a frame. queries of a frame are
+ * read a few frames later when they are available, so profiling never waits for GPU.
+ * time elapsed queries can not overlap, a section gets GPU time only when no other timed
+ * section is open, outer sections should be CPU only.
+ * completed frames are kept in a rolling history, written to a log and drawn as a graph.
+ */
+class FrameProfiler {
+public:
+	static const unsigned int FRAMES_IN_FLIGHT = 4;/* frames whose queries may be pending */
+	static const unsigned int HISTORY_SIZE = 240;/* frames kept for averages and graph */
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	/* frame waiting for its queries */
+	struct PendingFrame {
+		FrameProfile profile;
+		std::vector<GLuint> queries;/* query of each section, 0 without GPU time */
+	};
+
+	bool _enabled;
+	bool _inFrame;
+	const RenderCounters *_counters;/* counters of renderer, read at section bounds */
+	unsigned long long _frame;
+	Clock::time_point _frameBegin, _lastBegin;
+	PendingFrame _current;
+	std::vector<size_t> _open;/* stack of open sections */
+	std::vector<Clock::time_point> _openBegin;
+	bool _gpuOpen;/* a time elapsed query is running */
+	std::deque<PendingFrame> _pending;
+	std::vector<GLuint> _freeQueries;
+	std::deque<FrameProfile> _history;
+
+	std::ofstream _log;
+	bool _csv;/* log format */
+	bool _logStarted;/* first entry is written */
+
+	/* overlay graph */
+	GLuint _programId, _VAO_ID, _VBO_ID;
+	std::vector<GLfloat> _vertices;
+
+	/* read queries of pending frames that are done, wait for oldest one if all slots are used */
+	void collect(bool wait);
+	void complete(FrameProfile &profile);
+	void writeLog(const FrameProfile &profile);
+	/* append a rectangle in pixels with color */
+	void addRect(GLfloat x0, GLfloat y0, GLfloat x1, GLfloat y1, const GLfloat *color);
+
+public:
+	FrameProfiler();
+	~FrameProfiler();
+
+	/* start a frame, counters are those of the renderer drawing it */
+	void beginFrame(const RenderCounters &counters);
+	void endFrame();
+
+	/* sections nest on CPU, gpu asks for time elapsed on GPU as well */
+	void beginSection(const std::string &name, bool gpu = false);
+	void endSection();
+
+	/* disabled profiler keeps no time, sections cost a branch */
+	void setEnabled(bool enable);
+	bool enabled() const;
+
+	/* write every completed frame to path, as CSV if it ends with ".csv" and JSON otherwise */
+	bool openLog(const std::string &path);
+	void closeLog();
+
+	/* completed frames, oldest first */
+	const std::deque<FrameProfile> & getHistory() const;
+
+	/* mean of last frames, sections are merged by name */
+	FrameProfile average(unsigned int frames = 60) const;
+
+	/* one line of averages for a title or console */
+	std::string summary(unsigned int frames = 60) const;
+
+	/* draw stacked GPU and CPU bars of history at the bottom of a viewport of width and height,
+	   program, vertex array and depth test are restored */
+	void drawOverlay(int width, int height);
+};
+
+/* section from construction to end of scope, nothing without profiler */
+class ProfileScope {
+private:
+	FrameProfiler *_profiler;
+public:
+	ProfileScope(FrameProfiler *profiler, const char *name, bool gpu = false);
+	~ProfileScope();
+};
+
+#endif
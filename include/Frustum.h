@@ -0,0 +1,19 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+/* view volume as six planes, used to skip meshes out of sight */
+class Frustum {
+private:
+	glm::vec4 _planes[6];/* normal and distance, normal points inside */
+
+public:
+	/* planes of clip = projection * positionMatrix are in model space, where mesh boxes are */
+	explicit Frustum(const glm::mat4 &clip);
+
+	/* box is at least partly inside, conservative near corners of frustum */
+	bool intersects(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const;
+};
+
+#endif
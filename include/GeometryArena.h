@@ -0,0 +1,41 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include "Mesh.h"
+
+/*
+ * one vertex buffer and one index buffer under a single VAO, shared by meshes
+ * of the same vertex layout. space is reserved up front and suballocated in order.
+ */
+class GeometryArena {
+private:
+	bool _exist;
+	GLuint _VAO_ID, _VBO_ID, _EBO_ID;
+	VertexFormat _format;
+	bool _texCoords;
+	size_t _vertexCapacity, _indexCapacity;/* in vertices and indices */
+	size_t _vertexUsed, _indexUsed;
+
+public:
+	GeometryArena(VertexFormat format, bool texCoords, size_t vertexCapacity, size_t indexCapacity);
+	~GeometryArena();
+
+	/* copy mesh data into arena, return false if it does not fit or layout differs */
+	bool allocate(const MeshInfo &info, const void *vertexData, const GLuint *indices, GLint &baseVertex, size_t &firstIndex);
+
+	/* overwrite data of a mesh allocated at baseVertex and firstIndex with data of the same size */
+	bool write(const MeshInfo &info, const void *vertexData, const GLuint *indices, GLint baseVertex, size_t firstIndex);
+
+	/* read back vertex data and first indexNum indices of a mesh allocated at baseVertex and firstIndex */
+	bool read(const MeshInfo &info, void *vertexData, GLuint *indices, size_t indexNum, GLint baseVertex, size_t firstIndex) const;
+
+	GLuint getVAO() const;
+
+	/* bytes of buffers as reserved, used or not */
+	size_t getMemory() const;
+
+	/* succeed in creating buffers or not */
+	bool empty() const;
+};
+
+#endif
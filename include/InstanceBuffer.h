@@ -0,0 +1,40 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+/*
+ * per-instance transforms of a model drawn many times, applied between mesh vertices and
+ * position matrix. storage only grows, updating the same number of instances every frame
+ * rewrites it in place.
+ */
+class InstanceBuffer {
+private:
+	bool _exist;
+	GLuint _VBO_ID;
+	unsigned int _serial;/* unique in process, buffer names may be reused after deletion */
+	size_t _capacity;/* transforms storage holds */
+	size_t _count;/* transforms of last update */
+
+public:
+	InstanceBuffer();
+	~InstanceBuffer();
+
+	/* replace transforms, storage grows by doubling if they do not fit */
+	void update(const glm::mat4 *transforms, size_t count);
+	void update(const std::vector<glm::mat4> &transforms);
+
+	GLuint getVBO() const;
+	unsigned int getSerial() const;
+	size_t getCount() const;
+
+	/* point enabled instance attributes of bound VAO at this buffer */
+	void setAttributes() const;
+
+	/* succeed in creating buffer or not */
+	bool empty() const;
+};
+
+#endif
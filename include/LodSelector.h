@@ -0,0 +1,24 @@
+#ifndef LOD_SELECTOR_H
+#define LOD_SELECTOR_H
+
+#include "Mesh.h"
+
+/* picks level of detail of a mesh from the size of its box on screen */
+class LodSelector {
+private:
+	glm::mat4 _positionMatrix;
+	GLfloat _pixelScale;/* pixels covered by unit length at unit distance */
+	GLfloat _pixelsPerTriangle;
+
+public:
+	/* coarser levels are chosen as pixelsPerTriangle grows, e.g. while model is moving */
+	LodSelector(const glm::mat4 &positionMatrix, const glm::mat4 &projection, int viewportHeight, GLfloat pixelsPerTriangle = 2.f);
+
+	/* finest level whose faces do not outnumber pixels covered by mesh over pixelsPerTriangle */
+	unsigned int select(const MeshInfo &info) const;
+
+	/* pixels spanned on screen by bounding sphere of mesh box, infinity when camera is inside it */
+	GLfloat pixelSize(const MeshInfo &info) const;
+};
+
+#endif
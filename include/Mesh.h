@@ -1,31 +1,142 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include "RenderState.h"
 #include <GL/glew.h>
 #include <assimp/scene.h>
+#include <glm/glm.hpp>
 #include <vector>
 
+/* encoding of interleaved vertex data */
+enum VertexFormat {
+	VERTEX_FORMAT_FLOAT = 0,/* float position, normal and texture coord : 32 bytes */
+	VERTEX_FORMAT_COMPACT = 1/* 16 bits position in mesh bounds, octahedral normal, half texture coord : 16 bytes */
+};
+
+/* levels of detail of a mesh, including full detail */
+const unsigned int MAX_LOD_NUM = 4;
+
+/* layout of converted mesh data */
+struct MeshInfo {
+	VertexFormat format;
+	bool texCoords;/* vertices carry texture coords */
+	unsigned int vertexNum, faceNum;
+	glm::vec3 boundsMin, boundsMax;/* quantization box, compact positions are relative to it */
+	glm::vec3 aabbMin, aabbMax;/* tight bounding box of vertices, for culling */
+	unsigned int lodNum;/* levels of detail, their indices follow each other in element buffer */
+	unsigned int lodFaceNum[MAX_LOD_NUM];/* faces of each level, first one is faceNum */
+};
+
+/* bytes held by a model or a part of it */
+struct MemoryUsage {
+	size_t host;/* CPU memory */
+	size_t buffers;/* vertex and index buffers on GPU */
+	size_t textures;/* textures with their mip chains on GPU */
+};
+
+class GeometryArena;
+
 class Mesh {
 private:
 	bool _exist;
 	bool _haveTexture;/* has texture or not */
+	bool _shared;/* array and buffers belong to a GeometryArena */
+	bool _mapped;/* own buffers are mapped for writing */
 	GLuint _VAO_ID, _VBO_ID, _EBO_ID;/* array and buffer object ids */
-	unsigned int _vertexNum, _faceNum;/* vertices number */
-	GLfloat *_vertices, *_colors, *_normals, *_texCoords;
-	GLuint *_indices;
+	GLint _baseVertex;/* position of mesh in shared buffers */
+	size_t _firstIndex;
+	MeshInfo _info;
 	GLuint _texture;/* texture id */
+	aiColor3D _color;/* material color */
 
 	/* initialize array and buffer objects */
-	void initialize();
+	void initialize(const void *vertexData, const GLuint *indices);
 public:
-	Mesh(const aiMesh * mesh, GLuint texture, const aiColor3D & color);
+	/* convert aiMesh straight into mapped buffers */
+	Mesh(const aiMesh * mesh, VertexFormat format, GLuint texture, const aiColor3D & color);
+	/* reserve own buffers of info size, their data is written through map() */
+	Mesh(const MeshInfo &info, GLuint texture, const aiColor3D &color);
+	/* upload already converted data, e.g. mapped from mesh cache, without copying it */
+	Mesh(const MeshInfo &info, const void *vertexData, const GLuint *indices, GLuint texture, const aiColor3D &color);
+	/* suballocate converted data in arena instead of own buffers */
+	Mesh(const MeshInfo &info, GeometryArena &arena, const void *vertexData, const GLuint *indices, GLuint texture, const aiColor3D &color);
 	~Mesh();
 
-	/* draw mesh */
-	void draw(GLuint programId);
+	/* map own buffers for writing, pointers may be written by any thread until unmap() */
+	bool map(void *&vertexData, GLuint *&indices);
+
+	/* hand written data to GL, return false if it was lost and has to be written again */
+	bool unmap();
+
+	/* upload changed data of the same layout into buffers of mesh, or into arena it was suballocated in,
+	   bounds of info replace old ones, return false if layout differs */
+	bool update(const MeshInfo &info, const void *vertexData, const GLuint *indices, GeometryArena *arena = nullptr);
+
+	/* read positions and full detail indices back from buffers of mesh, or from arena it was suballocated in,
+	   positions are in the model space meshes are drawn in */
+	bool readBack(std::vector<glm::vec3> &positions, std::vector<GLuint> &indices, const GeometryArena *arena = nullptr) const;
+
+	/* set material uniforms and bind texture */
+	void bindMaterial(RenderState &state) const;
+
+	/* draw mesh at level of detail */
+	void draw(RenderState &state, unsigned int level = 0);
+
+	/* draw instances of mesh at once, instance attributes must be set on its VAO */
+	void drawInstanced(RenderState &state, GLsizei instanceNum, unsigned int level = 0);
 
 	/* data load completely or not */
 	bool empty() const;
+
+	/* memory of mesh, buffers are its own ones or its share of arena, texture is counted by model */
+	MemoryUsage getMemory() const;
+	/* buffers belong to an arena */
+	bool isShared() const;
+
+	const MeshInfo & getInfo() const;
+	GLuint getVAO() const;
+	GLuint getTexture() const;
+	/* texture may arrive after mesh */
+	void setTexture(GLuint texture);
+	void setColor(const aiColor3D &color);
+	GLint getBaseVertex() const;
+	/* byte offset of first index of level in element buffer */
+	const void * getIndexOffset(unsigned int level = 0) const;
+	/* indices of level */
+	GLsizei getIndexCount(unsigned int level = 0) const;
+
+	/* point enabled attributes of bound VAO at bound vertex buffer */
+	static void setAttributes(VertexFormat format, bool texCoords);
+
+	/* forget pending GL errors before an allocation that is checked, a lost context may report them forever */
+	static void clearErrors();
+
+	/* bytes of one vertex */
+	static size_t vertexSize(VertexFormat format, bool texCoords);
+
+	/* bytes of vertex data described by info */
+	static size_t vertexDataSize(const MeshInfo &info);
+
+	/* data of both infos has same size and levels, so that one replaces the other in place */
+	static bool sameLayout(const MeshInfo &a, const MeshInfo &b);
+
+	/* indices of all levels described by info */
+	static size_t indexNum(const MeshInfo &info);
+
+	/* compute layout of aiMesh converted into given format */
+	static MeshInfo measure(const aiMesh *mesh, VertexFormat format);
+
+	/* convert aiMesh into vertex data and indices of full detail, both arrays must be large enough */
+	static void convert(const aiMesh *mesh, const MeshInfo &info, void *vertexData, GLuint *indices);
+
+	/* convert count vertices from first on into their place in vertex data, ranges may be converted by different threads */
+	static void convertVertices(const aiMesh *mesh, const MeshInfo &info, void *vertexData, unsigned int first, unsigned int count);
+
+	/* flatten count faces from first on into their place in indices */
+	static void convertFaces(const aiMesh *mesh, GLuint *indices, unsigned int first, unsigned int count);
+
+	/* simplify aiMesh into coarser levels, add them to info and return their indices */
+	static std::vector<GLuint> buildLods(const aiMesh *mesh, MeshInfo &info);
 };
 
 #endif
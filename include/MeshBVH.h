@@ -0,0 +1,72 @@
+#ifndef MESH_BVH_H
+#define MESH_BVH_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+/*
+ * bounding volume hierarchy over the triangles of one mesh, for ray queries on CPU.
+ * built by binned surface area heuristic, nodes are flattened depth first so that
+ * the left child of a node follows it and only the right one needs an offset.
+ */
+class MeshBVH {
+public:
+	/* nearest triangle along a ray */
+	struct Hit {
+		float distance;/* along ray, in lengths of its direction */
+		unsigned int triangle;/* index of triangle as built */
+	};
+
+private:
+	/* 32 bytes, two nodes per cache line */
+	struct Node {
+		float boundsMin[3];
+		GLuint offset;/* first triangle of leaf, or right child of inner node */
+		float boundsMax[3];
+		GLuint count;/* triangles of leaf, 0 for inner node */
+	};
+
+	/* box of triangle while building */
+	struct BuildTriangle {
+		glm::vec3 boxMin;
+		GLuint index;/* triangle as built */
+		glm::vec3 boxMax;
+	};
+
+	/* range of triangles built on a worker */
+	struct Subtree {
+		size_t begin, end;
+		unsigned int depth;
+		std::vector<Node> nodes;
+	};
+
+	std::vector<Node> _nodes;
+	std::vector<glm::vec3> _positions;
+	std::vector<GLuint> _indices;/* three per triangle, in leaf order */
+	std::vector<GLuint> _triangles;/* index of each triangle as built, in leaf order */
+
+	/* build node over triangles in [begin, end) into nodes, reordering triangles, return its index.
+	   ranges of at most grain triangles are left to subtrees */
+	static GLuint build(std::vector<Node> &nodes, std::vector<BuildTriangle> &triangles, size_t begin, size_t end, unsigned int depth,
+		size_t grain, std::vector<Subtree> *subtrees);
+	/* copy node of top levels into place depth first, with subtrees it stands for */
+	GLuint place(const std::vector<Node> &top, GLuint index, const std::vector<Subtree> &subtrees);
+
+public:
+	/* positions are taken over, indices hold three per triangle */
+	MeshBVH(std::vector<glm::vec3> &positions, const std::vector<GLuint> &indices);
+
+	/* nearest triangle hit by ray closer than maxDistance, both sides of triangles count */
+	bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, Hit &hit) const;
+
+	size_t getNodeNum() const;
+	size_t getTriangleNum() const;
+	/* bytes held by hierarchy and its copy of mesh */
+	size_t getMemory() const;
+
+	/* mesh has no triangle */
+	bool empty() const;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "Mesh.h"
+#include <string>
+#include <vector>
+
+/*
+ * binary cache of imported model, stored beside the model file as "<model>.mvcache" :
+ * header, source path, material table, mesh table, then per mesh interleaved vertex
+ * data in Mesh buffer layout followed by indices. blocks are 16 bytes aligned so that
+ * mapped file can be handed to Mesh directly.
+ */
+class MeshCache {
+public:
+	/* bump when layout of file or converted data changes */
+	static const unsigned int VERSION = 7;
+
+	/* processing options that change converted data, part of cache key */
+	enum Option {
+		SHARED_BOUNDS = 1,/* compact positions of all meshes relative to model box */
+		LEVELS_OF_DETAIL = 2,/* simplified index lists follow full ones */
+		VERTEX_CACHE = 4,/* triangles and vertices reordered for post-transform cache and fetch */
+		OVERDRAW = 8/* triangle clusters reordered against overdraw */
+	};
+
+	struct Material {
+		aiColor3D color;
+		std::string texturePath;/* full path, empty if no diffuse texture */
+	};
+
+	struct MeshEntry {
+		unsigned int vertexNum, faceNum, materialIndex, texCoords;
+		unsigned long long vertexOffset, indexOffset;/* offsets from file begin */
+		float boundsMin[3], boundsMax[3];
+		float aabbMin[3], aabbMax[3];
+		unsigned int lodNum, lodFaceNum[MAX_LOD_NUM];
+		unsigned long long hash;/* of vertex data and indices, tells changed meshes apart on reload */
+	};
+
+private:
+	bool _exist;
+	void *_data;/* mapped file */
+	size_t _size;
+#ifdef _WIN32
+	void *_file, *_mapping;
+#else
+	int _fd;/* file being created, -1 otherwise */
+#endif
+	std::vector<Material> _materials;
+	VertexFormat _format;
+	const MeshEntry *_meshes;
+	unsigned int _meshNum;
+	glm::vec3 _center;
+	GLfloat _maxDistance;
+	std::string _writePath;/* cache file path while it is written, empty once committed or when read */
+	std::string _tempPath;/* file written until commit, unique to process and cache, empty once committed or when read */
+
+	/* map file into memory */
+	bool map(const std::string &cachePath);
+	/* create file of given size and map it writable */
+	bool create(const std::string &tempPath, size_t size);
+	void unmap();
+	/* validate header against source file and read tables */
+	bool parse(const std::string &path, unsigned int flags, VertexFormat format, unsigned int options, float weldEpsilon);
+
+public:
+	/* map cache of model file imported with given flags, format, options and weld cell size (0 if not welded),
+	   empty() if missing or stale */
+	MeshCache(const std::string &path, unsigned int flags, VertexFormat format, unsigned int options, float weldEpsilon);
+	/* create cache of normalized scene with room for its meshes, which are converted straight into
+	   getVertexTarget() and getIndexTarget() before commit(). empty() if it can not be created */
+	MeshCache(const std::string &path, unsigned int flags, VertexFormat format, unsigned int options, float weldEpsilon, const aiScene *scene,
+		const std::vector<MeshInfo> &infos, const std::vector<Material> &materials, const glm::vec3 &center, GLfloat maxDistance);
+	/* a cache never committed is removed */
+	~MeshCache();
+
+	bool empty() const;
+
+	const std::vector<Material> & getMaterials() const;
+	unsigned int getMeshNum() const;
+	const MeshEntry & getMesh(unsigned int i) const;
+	MeshInfo getMeshInfo(unsigned int i) const;
+	const void * getVertexData(unsigned int i) const;
+	const GLuint * getIndices(unsigned int i) const;
+	const glm::vec3 & getCenter() const;
+	GLfloat getMaxDistance() const;
+
+	/* converted data of mesh goes here while cache is created */
+	void * getVertexTarget(unsigned int i);
+	GLuint * getIndexTarget(unsigned int i);
+	/* hash converted meshes into their entries and move created cache in place, it stays mapped,
+	   return false if it can not be */
+	bool commit();
+
+	/* cache file path of model file */
+	static std::string cachePath(const std::string &path);
+};
+
+#endif
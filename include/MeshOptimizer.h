@@ -0,0 +1,43 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <GL/glew.h>
+#include <assimp/scene.h>
+#include <vector>
+
+/* post-transform cache behaviour of a triangle list */
+struct VertexCacheStats {
+	float acmr;/* average cache miss ratio : vertices transformed per triangle, 3 at worst, about 0.6 at best */
+	float atvr;/* average transformed vertex ratio : vertices transformed per vertex, 1 at best */
+};
+
+/* simulate a FIFO post-transform cache of cacheSize entries on a triangle list */
+VertexCacheStats analyzeVertexCache(const std::vector<GLuint> &indices, unsigned int vertexNum, unsigned int cacheSize = 16);
+
+/* reorder triangles for post-transform cache locality, linear-speed vertex cache optimization of Forsyth */
+void optimizeVertexCache(std::vector<GLuint> &indices, unsigned int vertexNum);
+
+/*
+ * cut cache optimized triangles into clusters where the cache restarts and order clusters
+ * so that the ones facing outwards come first, they hide the others and save overdraw
+ */
+void optimizeOverdraw(std::vector<GLuint> &indices, const aiVector3D *positions);
+
+/* number vertices in order of first use and rewrite indices, return new index of each old vertex */
+std::vector<GLuint> optimizeVertexFetch(std::vector<GLuint> &indices, unsigned int vertexNum);
+
+/*
+ * all of above on aiMesh in place : triangles, vertex attributes, bone weights and morph targets
+ * follow the new order, points and lines keep their place. stats are taken before and after.
+ */
+void optimizeMesh(aiMesh *mesh, bool overdraw, VertexCacheStats &before, VertexCacheStats &after);
+
+/*
+ * merge vertices whose position, normal and first texture coords fall into the same cell of
+ * size epsilon and whose other attributes are equal, then compact vertex arrays and rewrite
+ * faces. hashing, matching and rewriting are spread over the shared thread pool.
+ * meshes with bones or morph targets are left alone, return vertices after welding.
+ */
+unsigned int weldVertices(aiMesh *mesh, float epsilon);
+
+#endif
@@ -1,38 +1,340 @@
 #ifndef MODEL_H
 #define MODEL_H
 
-#include "Mesh.h"
+#include "Frustum.h"
+#include "GeometryArena.h"
+#include "InstanceBuffer.h"
+#include "LodSelector.h"
+#include "MeshBVH.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
+#include "TextureLibrary.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace Assimp {
+class Importer;
+}
+
+/* time spent in each phase of loading in ms, and memory it took */
+struct LoadStats {
+	bool cached;/* loaded from mesh cache or by assimp */
+	double cacheRead;/* map and validate mesh cache */
+	double import;/* assimp import */
+	double dump;/* debug dump of scene */
+	double textures;/* from materials known to last texture uploaded, overlapped with geometry */
+	double textureDecode;/* decode or texture cache read summed over textures, spent on workers */
+	double textureEncode;/* compression of textures missing in texture cache, spent on workers */
+	double textureUpload;/* upload summed over textures */
+	double textureStream;/* from materials known to last finer mip level streamed in, after load when textures stream */
+	double normalize;/* centering and scaling of vertices */
+	double weld;/* merging of equal vertices */
+	double optimize;/* reordering for vertex cache and overdraw */
+	double simplify;/* building of levels of detail */
+	double convert;/* conversion into vertex format */
+	double meshUpload;/* vertex and index buffers upload, overlapped with conversion */
+	double cacheWrite;/* write mesh cache */
+	double total;
+	double textureMemory;/* GPU memory of textures with their mip chains in MB */
+	unsigned int texturesReduced;/* textures loaded without their finest levels to stay within memory budget */
+	float acmrBefore, acmrAfter;/* vertices transformed per triangle over all meshes, before and after optimize, imported loads only */
+	float atvrBefore, atvrAfter;/* vertices transformed per vertex */
+	float weldRatio;/* vertices after welding over vertices imported, imported loads only */
+	double peakMemory;/* peak resident memory of process in MB, since load began where the system allows */
+	double peakPending;/* peak of converted data in flight between loader and GPU, in MB */
+};
+
+/* outcome of hot reload, from reload() or reloadTexture() until nothing is left to upload */
+struct ReloadStats {
+	double time;/* ms until changes were uploaded */
+	unsigned int meshNum;/* meshes of changed model file */
+	unsigned int meshesUploaded;/* meshes whose data changed, uploaded again */
+	unsigned int texturesUploaded;/* changed images uploaded again into their textures */
+	bool restructured;/* meshes or materials were added, removed or moved, model has to be loaded again */
+	bool failed;/* model file could not be imported, model is unchanged */
+};
+
+/* triangle under a ray, from pick() */
+struct PickResult {
+	unsigned int mesh;/* scene index of mesh hit, as in debug output */
+	unsigned int triangle;/* triangle of full detail level in mesh data */
+	glm::vec3 point;/* hit in normalized model space */
+	float distance;/* from ray origin, in lengths of ray direction */
+	double buildTime;/* ms spent building hierarchies of meshes not picked before */
+	double queryTime;/* ms spent walking hierarchies */
+};
+
+/* reordering of imported meshes */
+enum MeshOptimization {
+	OPTIMIZE_NONE = 0,/* file order */
+	OPTIMIZE_VERTEX_CACHE = 1,/* triangles for post-transform cache, vertices for fetch */
+	OPTIMIZE_OVERDRAW = 2/* vertex cache, then outward facing triangle clusters first */
+};
+
+/* options of loading and drawing */
+struct ModelOptions {
+	VertexFormat format;/* vertex encoding of meshes */
+	bool arena;/* suballocate meshes in shared buffers and draw them by material with multi draw */
+	bool lod;/* simplify meshes into coarser levels of detail while importing */
+	bool progressive;/* return at once and load in background, call update() every frame until loaded */
+	MeshOptimization optimize;/* reorder meshes while importing */
+	float weldEpsilon;/* merge vertices closer than this in normalized model while importing, 0 keeps them as imported */
+	bool compressTextures;/* keep textures block compressed with prebuilt mips in a cache beside each image, if GL supports it */
+	bool streamTextures;/* progressive models upload coarse mip levels of textures first and stream finer ones in by update() */
+	size_t streamBytes;/* texture data streamed per update() at most, at least one strip of rows */
+	size_t memoryBudget;/* bytes of GPU memory for buffers and textures of model, 0 for no limit. textures that do not fit
+	                       drop their finest mip levels, down to the coarsest one, and keep that size when shared with other models.
+	                       videoMemory() is a budget of the whole card, the same on every run whatever else is running */
+
+	ModelOptions();
+};
+
+/* meshes of one material sharing one arena, drawn by a single multi draw */
+struct DrawBatch {
+	const Mesh *mesh;/* first mesh of batch, provides material */
+	unsigned int materialIndex;
+	GLuint VAO;
+	std::vector<const Mesh *> meshes;/* for culling of single entries */
+	std::vector<GLsizei> counts;
+	std::vector<void *> offsets;
+	std::vector<GLint> baseVertices;
+};
 
 class Model
 {
 private:
+	struct DecodedTexture;
+	struct PendingMesh;
+	struct StreamingTexture;
+
 	bool _exist;
 	std::string _errorInfo;
 	std::vector<Mesh *> _meshes;
+	std::vector<unsigned int> _meshMaterials;/* material index of each mesh */
+	std::vector<unsigned int> _meshSources;/* scene index of each mesh */
+	std::vector<MeshBVH *> _bvhs;/* triangle hierarchy of each mesh for picking, built on first pick */
+	std::vector<GeometryArena *> _arenas;/* shared buffers in arena mode, one per vertex layout */
+	std::vector<DrawBatch> _batches;/* sorted by texture and material */
+	std::vector<size_t> _drawOrder;/* mesh indices sorted by texture and material, when not batched */
+	std::vector<GLsizei> _visibleCounts;/* entries of a batch surviving culling, rebuilt every frame */
+	std::vector<void *> _visibleOffsets;
+	std::vector<GLint> _visibleBaseVertices;
+	bool _occlusion;/* hardware occlusion culling, only without draw batches */
+	std::vector<GLuint> _queries;/* occlusion query of each mesh */
+	std::vector<char> _queryPending;/* query issued and result not read yet */
+	std::vector<char> _occluded;/* no sample passed in last read query */
+	std::vector<size_t> _hidden;/* occluded meshes of current frame */
+	std::vector<StreamingTexture *> _streams;/* textures whose finer levels are still to upload */
+	std::vector<GLfloat> _textureDemand;/* pixels spanned by meshes of each material in last frame, while streaming */
+	Mesh *_proxyBox;/* unit box drawn with bounds of occluded mesh to find out when it shows again */
+	std::map<GLuint, unsigned int> _instanceSerials;/* instance buffer attached to each VAO */
 	GLsizei _textureNum;
 	GLuint *_textures;
 	aiColor3D *_colors;
 	GLsizei _vertexNum;
+	ModelOptions _options;
+	bool _compressTextures;/* option and GL support */
 	glm::vec3 _center;/* model center */
 	GLfloat _maxDistance;/* max distance from vertex to model center */
+	size_t _geometryBytes;/* GPU memory meshes take once loaded, known with preview */
+	LoadStats _stats;
+
+	/* background loading, everything below _mutex is shared with loader thread and decode workers */
+	std::thread _loader;
+	bool _loading;/* not finished on GL thread */
+	std::chrono::steady_clock::time_point _loadBegin, _texturesBegin;
+	MeshCache *_cache;/* mapped until its meshes are uploaded */
+	std::vector<MeshInfo> _preview;/* boxes of meshes drawn until meshes arrive */
+	std::vector<unsigned int> _previewMaterials;
+	std::vector<char> _uploaded;/* mesh of scene index is uploaded */
+	bool _layoutTaken;/* arenas are created */
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	unsigned long long _sequence;/* bumped whenever loader publishes something */
+	std::atomic<bool> _cancel;/* stop loader, model is being destroyed, read by loops without lock */
+	bool _loaderDone;
+	std::string _loaderError;
+	std::vector<MeshCache::Material> _materials;/* published by loader, textures decode meanwhile */
+	std::vector<std::string> _textureKeys;/* texture library key of each material, empty without texture */
+	bool _materialsReady, _previewReady, _layoutReady;
+	std::vector<MeshInfo> _layout;/* final mesh layouts, needed to reserve arenas */
+	unsigned int _decodePending;/* texture decodes queued on pool */
+	std::deque<DecodedTexture *> _decodedTextures;
+	std::deque<PendingMesh *> _pendingMeshes;
+	size_t _pendingBytes;/* converted data waiting for upload, loader stalls above limit */
+	size_t _pendingPrepared;/* leading pending meshes whose buffers are prepared */
 
-	/* load textures */
-	void loadTextures(const aiScene *scene, const std::string &path);
+	/* hot reload, everything below _reloadDone is shared with reloader thread */
+	std::string _path;
+	std::vector<unsigned long long> _meshHashes;/* hash of converted data of each scene mesh, 0 if unknown */
+	std::thread _reloader;
+	bool _reloading;/* reloader runs or its result waits for GL thread */
+	unsigned int _texturesReloading;/* changed images decoding or waiting for upload */
+	std::chrono::steady_clock::time_point _reloadBegin;
+	ReloadStats _reloadStats;
+	bool _reloadDone;
+	MeshCache *_reloaded;/* cache of changed model file, null if reload failed */
+	std::string _reloadError;
+
+	/* read colors and texture paths of materials */
+	static std::vector<MeshCache::Material> readMaterials(const aiScene *scene, const std::string &path);
+	/* read image and swizzle it into OpenGL channel order, or read and write its compressed cache, runs on worker thread.
+	   uncompressed images get their mip chain built too when they stream */
+	static void decodeTexture(const std::string &fullPath, bool compress, bool stream, DecodedTexture &texture);
+
+	/* loader thread : everything that does not need GL */
+	void load(const std::string &path);
+	/* import model by assimp, center, scale, weld and reorder its meshes, hand materials to GL thread if publish,
+	   center and maxDistance receive the normalization */
+	const aiScene * importScene(Assimp::Importer &importer, const std::string &path, unsigned int flags, bool publish, LoadStats &stats,
+		std::vector<MeshCache::Material> &materials, glm::vec3 &center, GLfloat &maxDistance, std::string &error);
+	/* layouts of imported meshes */
+	std::vector<MeshInfo> measureScene(const aiScene *scene) const;
+	/* import model by assimp and write its cache */
+	bool loadScene(const std::string &path, unsigned int flags);
+	/* hand over meshes mapped from cache */
+	void loadCache(MeshCache *cache);
+	/* hand materials to GL thread and queue their textures for decode */
+	void publishMaterials(const std::vector<MeshCache::Material> &materials);
+	/* hand boxes of meshes to GL thread for preview */
+	void publishPreview(const std::vector<MeshInfo> &infos, const std::vector<unsigned int> &materials);
+	/* hand final layouts to GL thread for arenas */
+	void publishLayout(const std::vector<MeshInfo> &infos);
+	/* queue mesh, wait while too much data is pending unless told not to, return false if not queued */
+	bool pushMesh(PendingMesh *mesh, bool wait);
+	/* convert queued mesh into the buffers GL thread prepared for it, return false if cancelled */
+	bool writeMesh(PendingMesh *mesh, const aiMesh *source, const std::vector<GLuint> &lodIndices);
+
+	/* reloader thread : import changed model file into a new mesh cache and map it */
+	void reloadScene();
+	/* import model by assimp and write its cache, nothing goes to GL thread */
+	bool writeCache(const std::string &path, unsigned int flags, std::string &error);
+
+	/* GL thread */
+	void uploadTexture(DecodedTexture *texture);
+	/* upload image without its skip finest levels into bound texture, return GPU bytes it takes */
+	size_t uploadLevels(const DecodedTexture &texture, unsigned int skip, int &width, int &height);
+	/* allocate chain of bound texture without its skip finest levels, return GPU bytes it takes */
+	size_t allocateLevels(const DecodedTexture &texture, unsigned int skip, int &width, int &height);
+	/* upload rows [first, first + count) of image level into level of bound texture */
+	void uploadRows(const DecodedTexture &texture, unsigned int level, unsigned int target, int first, int count);
+	/* upload coarse levels of allocated texture, return stream of finer ones, null if none is left */
+	StreamingTexture * beginStream(DecodedTexture *texture, GLuint textureId, unsigned int skip);
+	/* stream most demanded finer levels for about budget ms, return true if a level became visible */
+	bool streamTextures(double budget);
+	/* texture is replaced, stop streaming into it */
+	void cancelStream(GLuint textureId);
+	/* bytes of memory budget left for a texture, replaced texture is given back, SIZE_MAX without budget */
+	size_t textureBudget(GLuint replaced);
+	/* give material a texture referenced in texture library, and every material sharing its image */
+	void setMaterialTexture(size_t i, GLuint textureId);
+	/* join loader and complete model once everything is uploaded */
+	void finish();
+
+	/* processing options stored in mesh cache key */
+	unsigned int cacheOptions() const;
+	/* reserve arenas large enough for meshes in arena mode */
+	void createArenas(const std::vector<MeshInfo> &infos);
+	/* mesh is suballocated in an arena */
+	bool inArena(const MeshInfo &info) const;
+	/* create and map own buffers of queued mesh, leave it to staging if that is not possible */
+	void prepareMesh(PendingMesh *pending);
+	/* unmap or upload written mesh */
+	void completeMesh(PendingMesh *pending);
+	/* keep uploaded mesh, drop it if it failed */
+	void addMesh(Mesh *pMesh, unsigned int sourceIndex, unsigned int materialIndex);
+	/* group meshes of arenas by material */
+	void buildBatches();
+	/* order submission so that meshes sharing texture and material are drawn together */
+	void sortDrawOrder();
+	/* take result of last occlusion query of mesh if ready, keep previous state otherwise */
+	bool isOccluded(size_t i);
+	/* issue queries on bounding boxes of occluded meshes without writing color or depth */
+	void drawProxies(RenderState &state);
+	/* queries for meshes added since last call */
+	void createQueries();
+	/* unit box placed on mesh boxes by bounds uniforms */
+	void createProxyBox();
+	/* wire boxes of meshes not uploaded yet */
+	void drawPreview(RenderState &state);
+	/* build hierarchies of meshes missing one, data is read back on GL thread and built on workers */
+	void buildHierarchies(double &time);
+	/* upload meshes whose hash differs from reloaded cache into their buffers, return true if anything changed */
+	bool applyReload(const MeshCache &cache);
+	/* upload changed images and apply finished reload */
+	bool updateReload();
 
 public:
 
-	Model(const std::string &path);
+	Model(const std::string &path, const ModelOptions &options = ModelOptions());
 	~Model();
 
-	/* draw */
-	void draw(GLuint programId);
+	/* draw, redundant binds and uniform updates are skipped by state, meshes outside frustum are skipped
+	   and levels of detail are picked by lod if given */
+	void draw(RenderState &state, const Frustum *frustum = nullptr, const LodSelector *lod = nullptr);
+
+	/* draw every mesh once for all transforms of instances, full detail and without culling,
+	   transforms apply before position matrix */
+	void drawInstanced(RenderState &state, const InstanceBuffer &instances);
+
+	/* test meshes by occlusion queries of last frame, no effect on arena batches */
+	void setOcclusionCulling(bool enable);
+
+	/* upload what background loading has made ready, for about budget ms but at least one item,
+	   return true if anything changed and model should be drawn again */
+	bool update(double budget);
+
+	/* still loading in background, load stats are complete once it is done */
+	bool loading() const;
+
+	/* finer texture levels are still streaming in, keep calling update() */
+	bool streaming() const;
+
+	/* import changed model file in background, call update() every frame until reloading() is false.
+	   meshes whose converted data changed are uploaded again into their buffers, the rest is kept.
+	   return false while loading or reloading */
+	bool reload();
+	/* decode changed image in background and upload it again into texture of materials showing it,
+	   return false if no material shows it */
+	bool reloadTexture(const std::string &path);
+	bool reloading() const;
+	const ReloadStats & getReloadStats() const;
+	/* images shown by materials, known once loaded */
+	std::vector<std::string> getTexturePaths() const;
+
+	/* nearest triangle hit by ray in normalized model space, both sides of triangles count and full detail
+	   is hit whatever level is drawn. hierarchies of meshes are built on first pick and again for meshes
+	   changed by reload. return false if nothing is hit or model is still loading */
+	bool pick(const glm::vec3 &origin, const glm::vec3 &direction, PickResult &result);
+
+	/* normalization of loaded model, a position in file is center + normalized position * max distance */
+	const glm::vec3 & getCenter() const;
+	GLfloat getMaxDistance() const;
+
+	/* time spent in load phases */
+	const LoadStats & getLoadStats() const;
+
+	/* memory of model, arenas count as reserved and textures shared with other models count fully */
+	MemoryUsage getMemory() const;
+	/* memory of each loaded mesh in scene order, 0 for meshes not loaded */
+	std::vector<MemoryUsage> getMeshMemory() const;
+	/* GPU memory of texture of each material with its mips, 0 without texture */
+	std::vector<size_t> getTextureMemory() const;
+
+	/* total dedicated video memory of the card in bytes, not what is free now, 0 if the driver does not tell (NVX_gpu_memory_info only) */
+	static size_t videoMemory();
 
 	/* get error information */
 	const std::string & getErrorInfo() const;
 
-	/* succeed in loading or not */
+	/* succeed in loading or not, a progressive model fails only when update() finds out */
 	bool empty() const;
 };
 
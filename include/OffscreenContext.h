@@ -0,0 +1,39 @@
+#ifndef OFFSCREEN_CONTEXT_H
+#define OFFSCREEN_CONTEXT_H
+
+#ifndef _WIN32
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <string>
+
+/*
+ * OpenGL core context without window, made current on construction.
+ * surfaceless EGL platform is preferred so that neither X server nor GPU
+ * is needed (Mesa llvmpipe), a 1x1 pbuffer is used where it is missing.
+ * drawing has to go to a framebuffer object.
+ */
+class OffscreenContext {
+private:
+	bool _exist;
+	std::string _errorInfo;
+	EGLDisplay _display;
+	EGLContext _context;
+	EGLSurface _surface;
+
+	/* create EGL display, context and surface */
+	bool create(int major, int minor);
+public:
+	OffscreenContext(int major = 3, int minor = 3);
+	~OffscreenContext();
+
+	/* get error information */
+	const std::string & getErrorInfo() const;
+
+	/* succeed in creating or not */
+	bool empty() const;
+};
+
+#endif // _WIN32
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef RENDER_STATE_H
+#define RENDER_STATE_H
+
+#include "ShaderLibrary.h"
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+/* uniforms of model program, the integer ones select a permutation instead of being sent */
+enum Uniform {
+	UNIFORM_POSITION_MATRIX = 0,
+	UNIFORM_NORMAL_MATRIX,
+	UNIFORM_PROJECTION,
+	UNIFORM_USE_LIGHT,
+	UNIFORM_HAVE_TEXTURE,
+	UNIFORM_MATERIAL_COLOR,
+	UNIFORM_COMPACT_VERTEX,
+	UNIFORM_BOUNDS_MIN,
+	UNIFORM_BOUNDS_EXTENT,
+	UNIFORM_INSTANCED,
+	UNIFORM_NUM
+};
+
+class FrameProfiler;
+
+/* GL calls of one frame */
+struct RenderCounters {
+	unsigned int drawCalls;
+	unsigned int trianglesDrawn;
+	unsigned int stateCalls;/* binds and uniform updates issued */
+	unsigned int redundantCalls;/* binds and uniform updates skipped because value did not change */
+	unsigned int programSwitches;/* permutations used in turn */
+	unsigned int lookupCalls;/* uniform location lookups skipped because locations are resolved once */
+	unsigned int meshesDrawn;
+	unsigned int meshesCulled;/* outside view frustum */
+	unsigned int meshesOccluded;/* hidden behind other meshes in last query */
+};
+
+/*
+ * shadow of the GL state touched by model drawing. uniforms are only recorded
+ * when set, flush() picks the permutation their features ask for and sends values
+ * its program does not hold yet. uniform locations are resolved once per program
+ * and binds or uniform updates that would not change anything are skipped.
+ */
+class RenderState {
+private:
+	/* what one permutation program holds */
+	struct Program {
+		GLuint id;/* 0 if not used yet */
+		GLint locations[UNIFORM_NUM];
+		GLfloat values[UNIFORM_NUM][16];/* last value sent */
+		bool known[UNIFORM_NUM];/* last value is valid */
+	};
+
+	ShaderLibrary &_library;
+	Program _programs[SHADER_PERMUTATION_NUM];
+	unsigned int _features;/* permutation asked for by feature uniforms */
+	unsigned int _current;/* permutation in use, SHADER_PERMUTATION_NUM if unknown */
+	GLfloat _values[UNIFORM_NUM][16];/* value of each uniform as set */
+	bool _set[UNIFORM_NUM];/* uniform was set */
+	unsigned int _dirty;/* bits of uniforms set since last flush */
+	GLuint _VAO_ID, _texture;/* bound objects, ~0 if unknown */
+	RenderCounters _counters;
+	FrameProfiler *_profiler;
+
+	/* record value of uniform, mark it dirty if it changed */
+	void update(Uniform uniform, const void *value, size_t size);
+public:
+	/* permutations are taken from library, which must outlive state */
+	explicit RenderState(ShaderLibrary &library);
+
+	/* forget bindings and reset counters, objects may have been deleted since last frame */
+	void beginFrame();
+
+	/* forget everything, program is used again by next flush, GL state was changed outside */
+	void invalidate();
+
+	/* use permutation of current features and send uniforms it lacks, call before each draw,
+	   return false if that permutation failed to build and the draw must be skipped */
+	bool flush();
+
+	void bindVertexArray(GLuint VAO);
+	void bindTexture(GLuint texture);
+
+	void setInt(Uniform uniform, GLint value);
+	void setVec3(Uniform uniform, const glm::vec3 &value);
+	void setMat3(Uniform uniform, const glm::mat3 &value);
+	void setMat4(Uniform uniform, const glm::mat4 &value);
+
+	/* count a draw call issued by caller */
+	void countDraw(unsigned int triangles);
+
+	/* count meshes submitted and skipped by caller */
+	void countMeshes(unsigned int drawn, unsigned int culled, unsigned int occluded);
+
+	const RenderCounters & getCounters() const;
+
+	/* profiler timing parts of drawing, null for none */
+	void setProfiler(FrameProfiler *profiler);
+	FrameProfiler * getProfiler() const;
+
+	/* program in use since last flush, 0 if none */
+	GLuint getProgram() const;
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <GL/glew.h>
+
+/* sources of model shaders without version line, ShaderLibrary puts version and feature defines in front */
+extern const char *vertexShaderSource;
+extern const char *fragmentShaderSource;
+
+/* compile and link program, return 0 if it fails. a retrievable program can be saved by glGetProgramBinary */
+GLuint createProgram(const char *vertexSource, const char *fragmentSource, bool retrievable = false);
+
+/* check compile status of shader or link status of program, print log if it fails */
+bool check(GLuint id, GLenum id_type, GLenum target_type);
+
+#endif
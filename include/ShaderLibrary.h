@@ -0,0 +1,74 @@
+#ifndef SHADER_LIBRARY_H
+#define SHADER_LIBRARY_H
+
+#include <GL/glew.h>
+#include <string>
+
+/* features a model program is specialized for, each one a preprocessor define of its sources */
+enum ShaderFeature {
+	SHADER_TEXTURE = 1,/* HAVE_TEXTURE : color from texture instead of material color */
+	SHADER_LIGHT = 2,/* USE_LIGHT : diffuse lighting */
+	SHADER_COMPACT_VERTEX = 4,/* COMPACT_VERTEX : positions relative to bounds, octahedral normals */
+	SHADER_INSTANCED = 8/* INSTANCED : instance matrix attribute */
+};
+
+/* every combination of features */
+const unsigned int SHADER_PERMUTATION_NUM = 16;
+
+/*
+ * permutations of the model program, compiled on first use. linked programs are saved
+ * by glGetProgramBinary into "<directory>/program_<key>.bin", where the key hashes
+ * driver strings and the full sources of the permutation, so that a warm start loads
+ * them without compiling. a binary the driver refuses is compiled and saved again.
+ */
+class ShaderLibrary {
+public:
+	/* bump when layout of cache files changes */
+	static const unsigned int VERSION = 1;
+
+	struct Stats {
+		unsigned int compiled;/* permutations compiled from sources */
+		unsigned int loaded;/* permutations loaded from binaries */
+		double time;/* ms spent getting programs */
+	};
+
+private:
+	bool _exist;
+	std::string _errorInfo;
+	std::string _cacheDirectory;/* empty for no cache */
+	bool _binaries;/* driver can save and load program binaries */
+	std::string _driver;/* vendor, renderer and version, binaries of other drivers are useless */
+	GLuint _programs[SHADER_PERMUTATION_NUM];/* 0 if not built yet */
+	bool _failed[SHADER_PERMUTATION_NUM];/* do not try building again */
+	Stats _stats;
+
+	/* defines and sources of permutation, each starting with version line */
+	void sources(unsigned int features, std::string &vertexSource, std::string &fragmentSource) const;
+	/* cache file path of permutation, key hashes driver and sources */
+	std::string cachePath(unsigned long long key) const;
+	/* link program from cache file, 0 if missing, stale or refused */
+	GLuint load(const std::string &path, unsigned long long key) const;
+	/* save binary of linked program, return false if it can not be written */
+	bool save(GLuint programId, const std::string &path, unsigned long long key) const;
+	/* load or compile permutation */
+	GLuint build(unsigned int features);
+
+public:
+	/* cacheDirectory is created if missing, empty to compile every launch */
+	explicit ShaderLibrary(const std::string &cacheDirectory = defaultCacheDirectory());
+	~ShaderLibrary();
+
+	/* program of feature combination, 0 if it fails to build */
+	GLuint getProgram(unsigned int features);
+
+	const Stats & getStats() const;
+	const std::string & getErrorInfo() const;
+
+	/* base permutation failed to build */
+	bool empty() const;
+
+	/* per user cache directory of viewer, empty if there is no home */
+	static std::string defaultCacheDirectory();
+};
+
+#endif
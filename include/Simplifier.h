@@ -0,0 +1,18 @@
+#ifndef SIMPLIFIER_H
+#define SIMPLIFIER_H
+
+#include <GL/glew.h>
+#include <assimp/scene.h>
+#include <vector>
+
+/*
+ * quadric error edge collapse of a triangle list. vertices only move onto
+ * other existing vertices, so the result indexes the same vertex array and
+ * levels of detail can share one vertex buffer. vertices at the same
+ * position are collapsed together. borders of open meshes are weighted, not
+ * preserved: collapses along them cost more, but may still happen.
+ * return at most targetIndexNum indices, or more if collapses run out.
+ */
+std::vector<GLuint> simplifyMesh(const aiVector3D *positions, unsigned int vertexNum, const std::vector<GLuint> &indices, size_t targetIndexNum);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+/*
+ * GPU compressed texture with its whole mip chain, stored beside the image as "<image>.ktx"
+ * (KTX 1.1). single channel images become RGTC1, images without alpha BC1 and images with
+ * alpha BC3. size and modification time of the image are kept in a key/value pair, a cache
+ * of a changed image is stale.
+ */
+class TextureCache {
+public:
+	/* bump when encoding or how source images are identified changes */
+	static const unsigned int VERSION = 2;
+
+	struct Level {
+		unsigned int width, height;
+		std::vector<unsigned char> data;/* compressed blocks */
+	};
+
+private:
+	bool _exist;
+	GLenum _format;/* compressed internal format */
+	GLenum _baseFormat;/* GL_RED, GL_RGB or GL_RGBA */
+	unsigned int _width, _height;
+	std::vector<Level> _levels;
+
+	/* read and validate cache file */
+	bool read(const std::string &imagePath);
+
+public:
+	/* read cache of image file, empty() if missing, stale or invalid */
+	explicit TextureCache(const std::string &imagePath);
+	/* compress image with 1 (red), 3 (RGB) or 4 (RGBA) channels of 8 bits, rows are step bytes apart */
+	TextureCache(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int channels, size_t step);
+
+	/* write cache of image file, return false if it can not be written */
+	bool write(const std::string &imagePath) const;
+
+	bool empty() const;
+
+	GLenum getFormat() const;
+	unsigned int getWidth() const;
+	unsigned int getHeight() const;
+	unsigned int getLevelNum() const;
+	const Level & getLevel(unsigned int i) const;
+	/* bytes of all levels, as they take on GPU */
+	size_t getSize() const;
+
+	/* cache file path of image file */
+	static std::string cachePath(const std::string &imagePath);
+
+	/* compressed formats can be uploaded */
+	static bool supported();
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef TEXTURE_LIBRARY_H
+#define TEXTURE_LIBRARY_H
+
+#include <GL/glew.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+/* reuse of textures since process start */
+struct TextureLibraryStats {
+	unsigned int hits;/* references handed out for an image already on GPU */
+	unsigned int misses;/* images that had to be decoded and uploaded */
+	size_t bytesSaved;/* GPU memory and upload spared by hits */
+	unsigned int textureNum;/* textures alive */
+	size_t bytes;/* GPU memory of textures alive */
+};
+
+/*
+ * textures of the process keyed by image file, handed out with reference counts so that
+ * materials and models showing the same image share one GL texture. textures are only
+ * valid in the context (or share group) they were uploaded in, all models must use it.
+ */
+class TextureLibrary {
+private:
+	struct Entry {
+		GLuint texture;
+		unsigned int references;
+		size_t bytes;
+	};
+
+	std::mutex _mutex;
+	std::map<std::string, Entry> _entries;
+	std::map<GLuint, std::string> _keys;/* key of each texture */
+	TextureLibraryStats _stats;
+
+public:
+	TextureLibrary();
+
+	/* take a reference of texture of key, 0 if it is not uploaded, any thread */
+	GLuint acquire(const std::string &key);
+
+	/* hand uploaded texture over with one reference and return texture to use, which is an
+	   older one if image was uploaded meanwhile, uploaded texture is deleted then, GL thread */
+	GLuint insert(const std::string &key, GLuint texture, size_t bytes);
+
+	/* drop a reference, texture is deleted with the last one, GL thread */
+	void release(GLuint texture);
+
+	/* image of texture changed on disk and was uploaded into it again, file it under key of
+	   new image with its new size, every holder of a reference sees the new image */
+	void replace(GLuint texture, const std::string &key, size_t bytes);
+
+	TextureLibraryStats getStats();
+
+	/* GPU memory of texture with its mips as uploaded, 0 if it is not handed out by library */
+	size_t getBytes(GLuint texture);
+
+	/* resolved path, size and modification time in ns of image file, so that a changed file is a new image */
+	static std::string key(const std::string &path);
+
+	/* library shared by models of the process */
+	static TextureLibrary & shared();
+};
+
+#endif
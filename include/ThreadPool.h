@@ -0,0 +1,43 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/* fixed set of worker threads running queued tasks, tasks must not touch OpenGL */
+class ThreadPool {
+private:
+	std::vector<std::thread> _workers;
+	std::queue<std::function<void()> > _tasks;
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	bool _stop;
+
+	/* worker loop */
+	void work();
+public:
+	/* 0 threads means one per core */
+	explicit ThreadPool(unsigned int threadNum = 0);
+	~ThreadPool();
+
+	/* queue task, it runs on any worker */
+	void push(const std::function<void()> &task);
+
+	/* run task(i) for every i below count on workers and calling thread, return when all are done.
+	   calling thread takes work too, so it never waits behind unrelated queued tasks and may be a worker */
+	void parallelFor(size_t count, const std::function<void(size_t)> &task);
+
+	/* workers number */
+	unsigned int size() const;
+
+	/* pool shared by loaders of the process */
+	static ThreadPool & shared();
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "DynamicResolution.h"
+#include "Shader.h"
+#include <algorithm>
+#include <cmath>
+
+/* one triangle covering viewport, texture coords of drawn part */
+static const char *stretchVertexSource = "\
+#version 330 core\n\
+uniform vec2 scale;\
+out vec2 uv;\
+void main() {\
+	vec2 position = vec2(gl_VertexID == 1 ? 3.0 : -1.0, gl_VertexID == 2 ? 3.0 : -1.0);\
+	uv = (position + 1.0) * 0.5 * scale;\
+	gl_Position = vec4(position, 0.0, 1.0);\
+}";
+
+/* texels outside drawn part must not bleed in at its top and right edges */
+static const char *stretchFragmentSource = "\
+#version 330 core\n\
+uniform sampler2D image;\
+uniform vec2 limit;\
+in vec2 uv;\
+out vec4 Color;\
+void main() {\
+	Color = texture(image, min(uv, limit));\
+}";
+
+DynamicResolution::DynamicResolution(double targetTime, float minScale) {
+	_exist = false;
+	_framebuffer = _colorTexture = _depthBuffer = 0;
+	_programId = _VAO_ID = 0;
+	_bufferWidth = _bufferHeight = 0;
+	_windowWidth = _windowHeight = 0;
+	_width = _height = 0;
+	_drawFramebuffer = 0;
+	_targetTime = targetTime;
+	_minScale = std::min(std::max(minScale, 0.05f), 1.f);
+	_scale = 1.f;
+	_active = false;
+
+	_programId = createProgram(stretchVertexSource, stretchFragmentSource);
+	if (!_programId)
+		return;
+	glGenVertexArrays(1, &_VAO_ID);
+	glGenFramebuffers(1, &_framebuffer);
+	glGenTextures(1, &_colorTexture);
+	glGenRenderbuffers(1, &_depthBuffer);
+	_exist = _VAO_ID && _framebuffer && _colorTexture && _depthBuffer;
+}
+
+DynamicResolution::~DynamicResolution() {
+	if (_framebuffer)
+		glDeleteFramebuffers(1, &_framebuffer);
+	if (_colorTexture)
+		glDeleteTextures(1, &_colorTexture);
+	if (_depthBuffer)
+		glDeleteRenderbuffers(1, &_depthBuffer);
+	if (_VAO_ID)
+		glDeleteVertexArrays(1, &_VAO_ID);
+	if (_programId)
+		glDeleteProgram(_programId);
+}
+
+bool DynamicResolution::resize(int width, int height) {
+	GLint texture = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+	glBindTexture(GL_TEXTURE_2D, _colorTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glBindTexture(GL_TEXTURE_2D, (GLuint)texture);
+	glBindRenderbuffer(GL_RENDERBUFFER, _depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _colorTexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _depthBuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)_drawFramebuffer);
+		_bufferWidth = _bufferHeight = 0;
+		return false;
+	}
+	_bufferWidth = width;
+	_bufferHeight = height;
+	return true;
+}
+
+bool DynamicResolution::begin(int windowWidth, int windowHeight) {
+	if (!_exist || _active || windowWidth <= 0 || windowHeight <= 0)
+		return false;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &_drawFramebuffer);
+	/* grow only, shrinking window keeps storage */
+	if (windowWidth > _bufferWidth || windowHeight > _bufferHeight) {
+		if (!resize(std::max(windowWidth, _bufferWidth), std::max(windowHeight, _bufferHeight)))
+			return false;
+	} else
+		glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+
+	_windowWidth = windowWidth;
+	_windowHeight = windowHeight;
+	_width = std::max(1, (int)(windowWidth * _scale + 0.5f));
+	_height = std::max(1, (int)(windowHeight * _scale + 0.5f));
+	glViewport(0, 0, _width, _height);
+	/* clears stay inside drawn part */
+	glScissor(0, 0, _width, _height);
+	glEnable(GL_SCISSOR_TEST);
+	_active = true;
+	return true;
+}
+
+void DynamicResolution::end() {
+	if (!_active)
+		return;
+	_active = false;
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)_drawFramebuffer);
+	glViewport(0, 0, _windowWidth, _windowHeight);
+
+	GLint programId = 0, VAO = 0, texture = 0, activeTexture = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &programId);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &VAO);
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+	glActiveTexture(GL_TEXTURE0);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+
+	glUseProgram(_programId);
+	glUniform1i(glGetUniformLocation(_programId, "image"), 0);
+	glUniform2f(glGetUniformLocation(_programId, "scale"), (GLfloat)_width / _bufferWidth, (GLfloat)_height / _bufferHeight);
+	glUniform2f(glGetUniformLocation(_programId, "limit"), (_width - 0.5f) / _bufferWidth, (_height - 0.5f) / _bufferHeight);
+	glBindTexture(GL_TEXTURE_2D, _colorTexture);
+	glBindVertexArray(_VAO_ID);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	glBindVertexArray((GLuint)VAO);
+	glBindTexture(GL_TEXTURE_2D, (GLuint)texture);
+	glActiveTexture((GLenum)activeTexture);
+	glUseProgram((GLuint)programId);
+	if (depthTest)
+		glEnable(GL_DEPTH_TEST);
+}
+
+void DynamicResolution::adapt(double frameTime) {
+	if (frameTime <= 0.0)
+		return;
+	/* dead band against flicker between two sizes */
+	double ratio = _targetTime / frameTime;
+	if (ratio > 0.9 && ratio < 1.25)
+		return;
+	/* time follows pixels, a step changes them by at most half or double */
+	ratio = std::min(std::max(ratio, 0.5), 2.0);
+	_scale = std::min(std::max(_scale * (float)std::sqrt(ratio), _minScale), 1.f);
+}
+
+void DynamicResolution::setTargetTime(double targetTime) { _targetTime = targetTime; }
+
+double DynamicResolution::getTargetTime() const { return _targetTime; }
+
+float DynamicResolution::getScale() const { return _scale; }
+
+bool DynamicResolution::empty() const { return !_exist; }
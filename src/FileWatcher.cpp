@@ -0,0 +1,150 @@
+#include "FileWatcher.h"
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace {
+
+/* polling interval where inotify is missing */
+const int POLL_INTERVAL = 500;/* ms */
+
+}
+
+FileWatcher::FileWatcher() {
+	_exist = false;
+	_fd = -1;
+	_lastPoll = Clock::now();
+#ifdef __linux__
+	_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (_fd < 0) {
+		_errorInfo = "Fail to initialize inotify .";
+		return;
+	}
+#endif
+	_exist = true;
+}
+
+FileWatcher::~FileWatcher() {
+#ifdef __linux__
+	if (_fd >= 0)
+		close(_fd);
+#endif
+}
+
+bool FileWatcher::watch(const std::string &path) {
+	if (!_exist)
+		return false;
+	File file;
+	size_t pos = path.find_last_of("/\\");
+	file.directory = pos == std::string::npos ? "." : (pos ? path.substr(0, pos) : "/");
+	file.name = path.substr(pos == std::string::npos ? 0 : pos + 1);
+	file.changed = false;
+	/* a file missing for the moment is followed until it appears */
+	identity(path, file.size, file.time);
+#ifdef __linux__
+	/* a directory watched twice keeps its watch descriptor */
+	int wd = inotify_add_watch(_fd, file.directory.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE);
+	if (wd < 0) {
+		_errorInfo = "Fail to watch " + file.directory + " .";
+		return false;
+	}
+	_directories[wd] = file.directory;
+#endif
+	_files[path] = file;
+	return true;
+}
+
+void FileWatcher::clear() {
+#ifdef __linux__
+	for (std::map<int, std::string>::iterator i = _directories.begin(); i != _directories.end(); ++i)
+		inotify_rm_watch(_fd, i->first);
+#endif
+	_directories.clear();
+	_files.clear();
+}
+
+void FileWatcher::readEvents() {
+#ifdef __linux__
+	/* buffer aligned for events, names follow each of them */
+	alignas(inotify_event) char buffer[4096];
+	for (;;) {
+		ssize_t length = read(_fd, buffer, sizeof(buffer));
+		if (length <= 0)
+			break;
+		for (ssize_t offset = 0; offset < length;) {
+			const inotify_event *event = (const inotify_event *)(buffer + offset);
+			offset += sizeof(inotify_event) + event->len;
+			std::map<int, std::string>::const_iterator directory = _directories.find(event->wd);
+			if (!event->len || directory == _directories.end())
+				continue;
+			std::string name(event->name);
+			for (std::map<std::string, File>::iterator i = _files.begin(); i != _files.end(); ++i)
+				if (i->second.name == name && i->second.directory == directory->second) {
+					i->second.changed = true;
+					i->second.lastEvent = Clock::now();
+				}
+		}
+	}
+#endif
+}
+
+void FileWatcher::pollTimes() {
+	if (Clock::now() - _lastPoll < std::chrono::milliseconds(POLL_INTERVAL))
+		return;
+	_lastPoll = Clock::now();
+	for (std::map<std::string, File>::iterator i = _files.begin(); i != _files.end(); ++i) {
+		unsigned long long size;
+		long long time;
+		identity(i->first, size, time);
+		if (size == i->second.size && time == i->second.time)
+			continue;
+		i->second.size = size;
+		i->second.time = time;
+		i->second.changed = true;
+		i->second.lastEvent = _lastPoll;
+	}
+}
+
+std::vector<std::string> FileWatcher::poll(double settle) {
+	std::vector<std::string> changed;
+	if (!_exist)
+		return changed;
+	if (_fd >= 0)
+		readEvents();
+	else
+		pollTimes();
+	Clock::time_point now = Clock::now();
+	for (std::map<std::string, File>::iterator i = _files.begin(); i != _files.end(); ++i) {
+		File &file = i->second;
+		if (!file.changed || std::chrono::duration<double, std::milli>(now - file.lastEvent).count() < settle)
+			continue;
+		file.changed = false;
+		changed.push_back(i->first);
+	}
+	return changed;
+}
+
+const std::string & FileWatcher::getErrorInfo() const { return _errorInfo; }
+
+bool FileWatcher::empty() const { return !_exist; }
+
+bool FileWatcher::identity(const std::string &path, unsigned long long &size, long long &time) {
+	struct stat status;
+	if (stat(path.c_str(), &status)) {
+		size = 0;
+		time = 0;
+		return false;
+	}
+	size = (unsigned long long)status.st_size;
+#if defined(__APPLE__)
+	time = (long long)status.st_mtimespec.tv_sec * 1000000000ll + status.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+	time = (long long)status.st_mtime * 1000000000ll;
+#else
+	time = (long long)status.st_mtim.tv_sec * 1000000000ll + status.st_mtim.tv_nsec;
+#endif
+	return true;
+}
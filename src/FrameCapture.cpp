@@ -0,0 +1,261 @@
+#include "FrameCapture.h"
+#include "ThreadPool.h"
+#include <cstring>
+
+FrameCapture::FrameCapture() {
+	_exist = false;
+	_next = 0;
+	_queued = _written = _failed = 0;
+	_video = nullptr;
+	_videoDraining = false;
+	_videoFps = 0.0;
+	_videoFrameNum = 0;
+	for (unsigned int i = 0; i < RING_SIZE; i++) {
+		_slots[i].PBO = 0;
+		_slots[i].capacity = 0;
+		_slots[i].fence = 0;
+		_slots[i].width = _slots[i].height = 0;
+		_slots[i].video = false;
+		_slots[i].repeat = 0;
+		glGenBuffers(1, &_slots[i].PBO);
+		if (!_slots[i].PBO) {
+			_errorInfo = "Fail to create pixel buffers .";
+			return;
+		}
+	}
+	_exist = true;
+}
+
+FrameCapture::~FrameCapture() {
+	finish();
+	endVideo();
+	for (unsigned int i = 0; i < RING_SIZE; i++)
+		if (_slots[i].PBO)
+			glDeleteBuffers(1, &_slots[i].PBO);
+}
+
+bool FrameCapture::read(int width, int height, bool video, unsigned int repeat, const std::string &path) {
+	if (!_exist || width <= 0 || height <= 0)
+		return false;
+	Slot &slot = _slots[_next];
+	/* ring is full, oldest read back is a few frames old and about done */
+	if (slot.fence && !complete(slot, true))
+		return false;
+	_next = (_next + 1) % RING_SIZE;
+
+	size_t size = (size_t)width * height * 4;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.PBO);
+	if (size > slot.capacity) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		slot.capacity = size;
+	}
+	GLint alignment = 4;
+	glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	/* returns at once, copy into buffer happens on GPU */
+	glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, (void *)0);
+	glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.width = width;
+	slot.height = height;
+	slot.video = video;
+	slot.repeat = repeat;
+	slot.path = path;
+	return slot.fence != 0;
+}
+
+bool FrameCapture::complete(Slot &slot, bool wait) {
+	GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000ull : 0);
+	if (status == GL_TIMEOUT_EXPIRED)
+		return false;
+	glDeleteSync(slot.fence);
+	slot.fence = 0;
+
+	bool success = status != GL_WAIT_FAILED;
+	{
+		/* encoders are behind, bound memory of frames waiting for them */
+		std::unique_lock<std::mutex> lock(_mutex);
+		_condition.wait(lock, [this] { return _queued < MAX_QUEUED; });
+		if (!success) {
+			_failed += slot.video ? slot.repeat : 1;
+			return true;
+		}
+		_queued += slot.video ? slot.repeat : 1;
+	}
+
+	cv::Mat image(slot.height, slot.width, CV_8UC4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.PBO);
+	const void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t)slot.width * slot.height * 4, GL_MAP_READ_BIT);
+	if (data != NULL) {
+		memcpy(image.data, data, (size_t)slot.width * slot.height * 4);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (data == NULL) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		unsigned int frames = slot.video ? slot.repeat : 1;
+		_queued -= frames;
+		_failed += frames;
+		_condition.notify_all();
+		return true;
+	}
+
+	if (slot.video) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		/* repeats share pixels, each is encoded as a frame of its own */
+		for (unsigned int i = 0; i < slot.repeat; i++)
+			_videoFrames.push_back(image);
+		if (!_videoDraining) {
+			_videoDraining = true;
+			ThreadPool::shared().push([this] { drainVideo(); });
+		}
+		return true;
+	}
+
+	std::string path = slot.path;
+	ThreadPool::shared().push([this, image, path] {
+		/* rows of GL start at bottom */
+		cv::Mat flipped;
+		cv::flip(image, flipped, 0);
+		bool success = cv::imwrite(path, flipped);
+		std::lock_guard<std::mutex> lock(_mutex);
+		--_queued;
+		++(success ? _written : _failed);
+		_condition.notify_all();
+	});
+	return true;
+}
+
+void FrameCapture::drainVideo() {
+	for (;;) {
+		cv::Mat image;
+		cv::Size size;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_videoFrames.empty()) {
+				_videoDraining = false;
+				_condition.notify_all();
+				return;
+			}
+			image = _videoFrames.front();
+			_videoFrames.pop_front();
+			size = _videoSize;
+		}
+		cv::Mat frame;
+		cv::flip(image, frame, 0);
+		cv::cvtColor(frame, frame, cv::COLOR_BGRA2BGR);
+		if (frame.cols != size.width || frame.rows != size.height)
+			cv::resize(frame, frame, size, 0, 0, cv::INTER_LINEAR);
+		/* video is only closed once this task is done */
+		_video->write(frame);
+		std::lock_guard<std::mutex> lock(_mutex);
+		--_queued;
+		++_written;
+		_condition.notify_all();
+	}
+}
+
+bool FrameCapture::captureImage(int width, int height, const std::string &path) {
+	return read(width, height, false, 0, path);
+}
+
+bool FrameCapture::beginVideo(const std::string &path, int width, int height, double fps) {
+	if (!_exist || _video != nullptr || width <= 0 || height <= 0)
+		return false;
+	bool mjpeg = path.size() >= 4 && path.compare(path.size() - 4, 4, ".avi") == 0;
+	int fourcc = mjpeg ? cv::VideoWriter::fourcc('M', 'J', 'P', 'G') : cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+	cv::VideoWriter *video = new cv::VideoWriter();
+	if (!video->open(path, fourcc, fps, cv::Size(width, height), true) || !video->isOpened()) {
+		delete video;
+		_errorInfo = "Fail to open video " + path + " .";
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(_mutex);
+	_video = video;
+	_videoSize = cv::Size(width, height);
+	_videoBegin = std::chrono::steady_clock::now();
+	_videoFps = fps;
+	_videoFrameNum = 0;
+	return true;
+}
+
+bool FrameCapture::captureVideoFrame(int width, int height) {
+	if (_video == nullptr)
+		return false;
+	/* frames due by now, idle time between draws is filled with the last one */
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _videoBegin).count();
+	unsigned long long due = (unsigned long long)(seconds * _videoFps) + 1;
+	if (due <= _videoFrameNum)
+		return true;
+	unsigned int repeat = (unsigned int)(due - _videoFrameNum);
+	if (!read(width, height, true, repeat, std::string()))
+		return false;
+	_videoFrameNum = due;
+	return true;
+}
+
+void FrameCapture::endVideo() {
+	if (_video == nullptr)
+		return;
+	/* video frames still in ring go first */
+	for (unsigned int i = 0; i < RING_SIZE; i++) {
+		Slot &slot = _slots[(_next + i) % RING_SIZE];
+		if (slot.fence && slot.video)
+			complete(slot, true);
+	}
+	std::unique_lock<std::mutex> lock(_mutex);
+	_condition.wait(lock, [this] { return !_videoDraining; });
+	_video->release();
+	delete _video;
+	_video = nullptr;
+}
+
+bool FrameCapture::recording() const { return _video != nullptr; }
+
+bool FrameCapture::update() {
+	bool inFlight = false;
+	/* oldest first, so frames of a video stay in order */
+	for (unsigned int i = 0; i < RING_SIZE; i++) {
+		Slot &slot = _slots[(_next + i) % RING_SIZE];
+		if (slot.fence && !complete(slot, false))
+			inFlight = true;
+		if (inFlight)
+			break;
+	}
+	return inFlight;
+}
+
+void FrameCapture::finish() {
+	for (unsigned int i = 0; i < RING_SIZE; i++) {
+		Slot &slot = _slots[(_next + i) % RING_SIZE];
+		if (slot.fence)
+			complete(slot, true);
+	}
+	std::unique_lock<std::mutex> lock(_mutex);
+	_condition.wait(lock, [this] { return !_queued; });
+}
+
+unsigned int FrameCapture::getPending() {
+	unsigned int pending = 0;
+	for (unsigned int i = 0; i < RING_SIZE; i++)
+		if (_slots[i].fence)
+			++pending;
+	std::lock_guard<std::mutex> lock(_mutex);
+	return pending + _queued;
+}
+
+unsigned int FrameCapture::getWritten() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _written;
+}
+
+unsigned int FrameCapture::getFailed() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _failed;
+}
+
+const std::string & FrameCapture::getErrorInfo() const { return _errorInfo; }
+
+bool FrameCapture::empty() const { return !_exist; }
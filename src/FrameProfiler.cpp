@@ -0,0 +1,433 @@
+#include "FrameProfiler.h"
+#include "Shader.h"
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+/* graph of overlay, in pixels */
+static const GLfloat GRAPH_HEIGHT = 120.f;
+static const GLfloat BAR_WIDTH = 2.f;
+static const double GRAPH_RANGE = 1000.0 / 30;/* ms at top of graph */
+
+static const char *overlayVertexSource = "\
+#version 330 core\n\
+layout(location = 0) in vec2 position;\
+layout(location = 1) in vec4 color;\
+uniform vec2 viewport;\
+out vec4 vertexColor;\
+void main() {\
+	gl_Position = vec4(position / viewport * 2.0 - 1.0, 0.0, 1.0);\
+	vertexColor = color;\
+}";
+
+static const char *overlayFragmentSource = "\
+#version 330 core\n\
+in vec4 vertexColor;\
+out vec4 Color;\
+void main() {\
+	Color = vertexColor;\
+}";
+
+/* colors of sections, picked by name so that a section keeps its color */
+static const GLfloat palette[][4] = {
+	{ 0.90f, 0.30f, 0.25f, 0.9f },
+	{ 0.25f, 0.60f, 0.90f, 0.9f },
+	{ 0.95f, 0.75f, 0.20f, 0.9f },
+	{ 0.55f, 0.35f, 0.85f, 0.9f },
+	{ 0.30f, 0.80f, 0.40f, 0.9f },
+	{ 0.95f, 0.50f, 0.15f, 0.9f },
+	{ 0.20f, 0.80f, 0.80f, 0.9f },
+	{ 0.85f, 0.40f, 0.70f, 0.9f }
+};
+static const GLfloat backgroundColor[4] = { 0.f, 0.f, 0.f, 0.5f };
+static const GLfloat cpuColor[4] = { 0.7f, 0.7f, 0.7f, 0.9f };
+static const GLfloat targetColor[4] = { 0.3f, 0.9f, 0.3f, 0.6f };/* 60 frames per second */
+
+static double milliseconds(std::chrono::steady_clock::duration duration) {
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+/* names are ours, only quotes and backslashes need escaping */
+static std::string jsonString(const std::string &text) {
+	std::string result = "\"";
+	for (size_t i = 0; i < text.size(); i++) {
+		if (text[i] == '"' || text[i] == '\\')
+			result += '\\';
+		result += text[i];
+	}
+	return result + "\"";
+}
+
+FrameProfiler::FrameProfiler() {
+	_enabled = false;
+	_inFrame = false;
+	_counters = nullptr;
+	_frame = 0;
+	_gpuOpen = false;
+	_csv = false;
+	_logStarted = false;
+	_programId = _VAO_ID = _VBO_ID = 0;
+}
+
+FrameProfiler::~FrameProfiler() {
+	closeLog();
+	for (size_t i = 0; i < _pending.size(); i++)
+		for (size_t j = 0; j < _pending[i].queries.size(); j++)
+			if (_pending[i].queries[j])
+				_freeQueries.push_back(_pending[i].queries[j]);
+	for (size_t j = 0; j < _current.queries.size(); j++)
+		if (_current.queries[j])
+			_freeQueries.push_back(_current.queries[j]);
+	if (!_freeQueries.empty())
+		glDeleteQueries((GLsizei)_freeQueries.size(), _freeQueries.data());
+	if (_VBO_ID)
+		glDeleteBuffers(1, &_VBO_ID);
+	if (_VAO_ID)
+		glDeleteVertexArrays(1, &_VAO_ID);
+	if (_programId)
+		glDeleteProgram(_programId);
+}
+
+void FrameProfiler::beginFrame(const RenderCounters &counters) {
+	if (!_enabled)
+		return;
+	if (_inFrame)
+		endFrame();
+	collect(_pending.size() >= FRAMES_IN_FLIGHT);
+
+	Clock::time_point now = Clock::now();
+	_counters = &counters;
+	_current.profile.frame = _frame++;
+	_current.profile.cpu = _current.profile.gpu = 0.0;
+	_current.profile.interval = _frame > 1 ? milliseconds(now - _lastBegin) : 0.0;
+	_current.profile.drawCalls = _current.profile.triangles = 0;
+	_current.profile.sections.clear();
+	_current.queries.clear();
+	_frameBegin = _lastBegin = now;
+	_inFrame = true;
+}
+
+void FrameProfiler::endFrame() {
+	if (!_inFrame)
+		return;
+	while (!_open.empty())
+		endSection();
+	_inFrame = false;
+	_current.profile.cpu = milliseconds(Clock::now() - _frameBegin);
+	_current.profile.drawCalls = _counters->drawCalls;
+	_current.profile.triangles = _counters->trianglesDrawn;
+
+	bool timed = false;
+	for (size_t i = 0; i < _current.queries.size(); i++)
+		timed = timed || _current.queries[i];
+	/* a frame without queries still waits behind earlier ones, history stays in order */
+	if (timed || !_pending.empty()) {
+		_pending.push_back(_current);
+		_current.queries.clear();
+	} else
+		complete(_current.profile);
+}
+
+void FrameProfiler::beginSection(const std::string &name, bool gpu) {
+	if (!_inFrame)
+		return;
+	ProfileSection section;
+	section.name = name;
+	section.depth = (unsigned int)_open.size();
+	section.cpu = 0.0;
+	section.gpu = -1.0;
+	/* counters at begin, turned into differences at end */
+	section.drawCalls = _counters->drawCalls;
+	section.triangles = _counters->trianglesDrawn;
+
+	GLuint query = 0;
+	if (gpu && !_gpuOpen) {
+		if (!_freeQueries.empty()) {
+			query = _freeQueries.back();
+			_freeQueries.pop_back();
+		} else
+			glGenQueries(1, &query);
+		if (query) {
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			_gpuOpen = true;
+		}
+	}
+	_open.push_back(_current.profile.sections.size());
+	_openBegin.push_back(Clock::now());
+	_current.profile.sections.push_back(section);
+	_current.queries.push_back(query);
+}
+
+void FrameProfiler::endSection() {
+	if (!_inFrame || _open.empty())
+		return;
+	size_t index = _open.back();
+	ProfileSection &section = _current.profile.sections[index];
+	section.cpu = milliseconds(Clock::now() - _openBegin.back());
+	section.drawCalls = _counters->drawCalls - section.drawCalls;
+	section.triangles = _counters->trianglesDrawn - section.triangles;
+	if (_current.queries[index]) {
+		glEndQuery(GL_TIME_ELAPSED);
+		_gpuOpen = false;
+	}
+	_open.pop_back();
+	_openBegin.pop_back();
+}
+
+void FrameProfiler::collect(bool wait) {
+	while (!_pending.empty()) {
+		PendingFrame &pending = _pending.front();
+		/* queries finish in order, the last one of a frame tells about all */
+		GLuint last = 0;
+		for (size_t i = 0; i < pending.queries.size(); i++)
+			if (pending.queries[i])
+				last = pending.queries[i];
+		if (last && !wait) {
+			GLint available = 0;
+			glGetQueryObjectiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break;
+		}
+		for (size_t i = 0; i < pending.queries.size(); i++) {
+			if (!pending.queries[i])
+				continue;
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(pending.queries[i], GL_QUERY_RESULT, &elapsed);
+			pending.profile.sections[i].gpu = elapsed / 1e6;
+			pending.profile.gpu += elapsed / 1e6;
+			_freeQueries.push_back(pending.queries[i]);
+		}
+		complete(pending.profile);
+		_pending.pop_front();
+		wait = false;
+	}
+}
+
+void FrameProfiler::complete(FrameProfile &profile) {
+	_history.push_back(profile);
+	while (_history.size() > HISTORY_SIZE)
+		_history.pop_front();
+	if (_log.is_open())
+		writeLog(profile);
+}
+
+void FrameProfiler::writeLog(const FrameProfile &profile) {
+	_log << std::fixed << std::setprecision(3);
+	if (_csv) {
+		_log << profile.frame << ",frame,," << profile.cpu << "," << profile.gpu << "," << profile.drawCalls << "," << profile.triangles << "," << profile.interval << "\n";
+		for (size_t i = 0; i < profile.sections.size(); i++) {
+			const ProfileSection &section = profile.sections[i];
+			_log << profile.frame << "," << section.name << "," << section.depth << "," << section.cpu << ",";
+			if (section.gpu >= 0.0)
+				_log << section.gpu;
+			_log << "," << section.drawCalls << "," << section.triangles << ",\n";
+		}
+		return;
+	}
+
+	_log << (_logStarted ? ",\n" : "\n") << "{\"frame\": " << profile.frame << ", \"cpu_ms\": " << profile.cpu << ", \"gpu_ms\": " << profile.gpu
+		<< ", \"interval_ms\": " << profile.interval << ", \"draw_calls\": " << profile.drawCalls << ", \"triangles\": " << profile.triangles << ", \"sections\": [";
+	for (size_t i = 0; i < profile.sections.size(); i++) {
+		const ProfileSection &section = profile.sections[i];
+		_log << (i ? ", " : "") << "{\"name\": " << jsonString(section.name) << ", \"depth\": " << section.depth << ", \"cpu_ms\": " << section.cpu << ", \"gpu_ms\": ";
+		if (section.gpu >= 0.0)
+			_log << section.gpu;
+		else
+			_log << "null";
+		_log << ", \"draw_calls\": " << section.drawCalls << ", \"triangles\": " << section.triangles << "}";
+	}
+	_log << "]}";
+	_logStarted = true;
+}
+
+void FrameProfiler::setEnabled(bool enable) {
+	if (!enable && _inFrame)
+		endFrame();
+	_enabled = enable;
+}
+
+bool FrameProfiler::enabled() const { return _enabled; }
+
+bool FrameProfiler::openLog(const std::string &path) {
+	closeLog();
+	_csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+	_log.open(path.c_str(), std::ios::out | std::ios::trunc);
+	if (!_log.is_open())
+		return false;
+	if (_csv)
+		_log << "frame,section,depth,cpu_ms,gpu_ms,draw_calls,triangles,interval_ms\n";
+	else
+		_log << "[";
+	_logStarted = false;
+	return true;
+}
+
+void FrameProfiler::closeLog() {
+	if (!_log.is_open())
+		return;
+	/* frames still waiting for queries belong to this log */
+	while (!_pending.empty())
+		collect(true);
+	if (!_csv)
+		_log << "\n]\n";
+	_log.close();
+}
+
+const std::deque<FrameProfile> & FrameProfiler::getHistory() const { return _history; }
+
+FrameProfile FrameProfiler::average(unsigned int frames) const {
+	FrameProfile result;
+	result.frame = _history.empty() ? 0 : _history.back().frame;
+	result.cpu = result.gpu = result.interval = 0.0;
+	result.drawCalls = result.triangles = 0;
+	size_t num = std::min((size_t)frames, _history.size());
+	if (!num)
+		return result;
+
+	double drawCalls = 0.0, triangles = 0.0;
+	std::map<std::string, size_t> indices;
+	std::vector<unsigned int> timed;/* frames in which each section has GPU time */
+	for (size_t k = _history.size() - num; k < _history.size(); k++) {
+		const FrameProfile &profile = _history[k];
+		result.cpu += profile.cpu;
+		result.gpu += profile.gpu;
+		result.interval += profile.interval;
+		drawCalls += profile.drawCalls;
+		triangles += profile.triangles;
+		for (size_t i = 0; i < profile.sections.size(); i++) {
+			const ProfileSection &section = profile.sections[i];
+			std::map<std::string, size_t>::iterator it = indices.find(section.name);
+			if (it == indices.end()) {
+				it = indices.insert(std::make_pair(section.name, result.sections.size())).first;
+				ProfileSection sum = section;
+				sum.cpu = sum.gpu = 0.0;
+				sum.drawCalls = sum.triangles = 0;
+				result.sections.push_back(sum);
+				timed.push_back(0);
+			}
+			ProfileSection &sum = result.sections[it->second];
+			sum.cpu += section.cpu;
+			sum.drawCalls += section.drawCalls;
+			sum.triangles += section.triangles;
+			if (section.gpu >= 0.0) {
+				sum.gpu += section.gpu;
+				++timed[it->second];
+			}
+		}
+	}
+	result.cpu /= num;
+	result.gpu /= num;
+	result.interval /= num;
+	result.drawCalls = (unsigned int)(drawCalls / num + 0.5);
+	result.triangles = (unsigned int)(triangles / num + 0.5);
+	/* a section missing in some frames costs nothing there */
+	for (size_t i = 0; i < result.sections.size(); i++) {
+		ProfileSection &section = result.sections[i];
+		section.cpu /= num;
+		section.gpu = timed[i] ? section.gpu / num : -1.0;
+		section.drawCalls = (unsigned int)(section.drawCalls / num);
+		section.triangles = (unsigned int)(section.triangles / num);
+	}
+	return result;
+}
+
+std::string FrameProfiler::summary(unsigned int frames) const {
+	FrameProfile profile = average(frames);
+	std::ostringstream stream;
+	stream << std::fixed << std::setprecision(2) << "cpu " << profile.cpu << " ms, gpu " << profile.gpu << " ms";
+	if (profile.interval > 0.0)
+		stream << ", " << std::setprecision(0) << 1000.0 / profile.interval << " fps";
+	stream << ", " << profile.drawCalls << " draws, " << profile.triangles << " triangles";
+	/* top level sections only, nested ones are in log */
+	for (size_t i = 0; i < profile.sections.size(); i++)
+		if (!profile.sections[i].depth)
+			stream << " | " << profile.sections[i].name << " " << std::setprecision(2) << profile.sections[i].cpu;
+	return stream.str();
+}
+
+void FrameProfiler::addRect(GLfloat x0, GLfloat y0, GLfloat x1, GLfloat y1, const GLfloat *color) {
+	const GLfloat corners[6][2] = { { x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y0 }, { x1, y1 }, { x0, y1 } };
+	for (int i = 0; i < 6; i++) {
+		_vertices.push_back(corners[i][0]);
+		_vertices.push_back(corners[i][1]);
+		_vertices.insert(_vertices.end(), color, color + 4);
+	}
+}
+
+void FrameProfiler::drawOverlay(int width, int height) {
+	if (width <= 0 || height <= 0)
+		return;
+	if (!_programId) {
+		_programId = createProgram(overlayVertexSource, overlayFragmentSource);
+		if (!_programId)
+			return;
+		glGenVertexArrays(1, &_VAO_ID);
+		glGenBuffers(1, &_VBO_ID);
+		glBindVertexArray(_VAO_ID);
+		glBindBuffer(GL_ARRAY_BUFFER, _VBO_ID);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (void *)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (void *)(2 * sizeof(GLfloat)));
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	/* newest frame at right edge, each frame a CPU bar and a stack of GPU sections */
+	const GLfloat scale = (GLfloat)(GRAPH_HEIGHT / GRAPH_RANGE);
+	_vertices.clear();
+	addRect(0.f, 0.f, HISTORY_SIZE * 2 * BAR_WIDTH, GRAPH_HEIGHT, backgroundColor);
+	std::hash<std::string> hash;
+	GLfloat x = (HISTORY_SIZE - (GLfloat)_history.size()) * 2 * BAR_WIDTH;
+	for (size_t k = 0; k < _history.size(); k++, x += 2 * BAR_WIDTH) {
+		const FrameProfile &profile = _history[k];
+		addRect(x, 0.f, x + BAR_WIDTH, std::min((GLfloat)profile.cpu * scale, GRAPH_HEIGHT), cpuColor);
+		GLfloat y = 0.f;
+		for (size_t i = 0; i < profile.sections.size() && y < GRAPH_HEIGHT; i++) {
+			const ProfileSection &section = profile.sections[i];
+			if (section.gpu < 0.0)
+				continue;
+			GLfloat top = std::min(y + (GLfloat)section.gpu * scale, GRAPH_HEIGHT);
+			addRect(x + BAR_WIDTH, y, x + 2 * BAR_WIDTH, top, palette[hash(section.name) % (sizeof(palette) / sizeof(palette[0]))]);
+			y = top;
+		}
+	}
+	GLfloat target = (GLfloat)(1000.0 / 60) * scale;
+	addRect(0.f, target, HISTORY_SIZE * 2 * BAR_WIDTH, target + 1.f, targetColor);
+
+	GLint programId = 0, VAO = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &programId);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &VAO);
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST), blend = glIsEnabled(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glUseProgram(_programId);
+	glUniform2f(glGetUniformLocation(_programId, "viewport"), (GLfloat)width, (GLfloat)height);
+	glBindVertexArray(_VAO_ID);
+	glBindBuffer(GL_ARRAY_BUFFER, _VBO_ID);
+	glBufferData(GL_ARRAY_BUFFER, _vertices.size() * sizeof(GLfloat), _vertices.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(_vertices.size() / 6));
+
+	glBindVertexArray((GLuint)VAO);
+	glUseProgram((GLuint)programId);
+	if (depthTest)
+		glEnable(GL_DEPTH_TEST);
+	if (!blend)
+		glDisable(GL_BLEND);
+}
+
+ProfileScope::ProfileScope(FrameProfiler *profiler, const char *name, bool gpu) {
+	_profiler = profiler != nullptr && profiler->enabled() ? profiler : nullptr;
+	if (_profiler != nullptr)
+		_profiler->beginSection(name, gpu);
+}
+
+ProfileScope::~ProfileScope() {
+	if (_profiler != nullptr)
+		_profiler->endSection();
+}
@@ -0,0 +1,24 @@
+#include "Frustum.h"
+
+Frustum::Frustum(const glm::mat4 &clip) {
+	/* rows of column major matrix */
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+		rows[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+	/* -w <= x, y, z <= w */
+	for (int i = 0; i < 3; i++) {
+		_planes[2 * i] = rows[3] + rows[i];
+		_planes[2 * i + 1] = rows[3] - rows[i];
+	}
+}
+
+bool Frustum::intersects(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const {
+	for (int i = 0; i < 6; i++) {
+		const glm::vec4 &plane = _planes[i];
+		/* corner farthest along plane normal */
+		glm::vec3 corner(plane.x >= 0.f ? boxMax.x : boxMin.x, plane.y >= 0.f ? boxMax.y : boxMin.y, plane.z >= 0.f ? boxMax.z : boxMin.z);
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.f)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,112 @@
+#include "GeometryArena.h"
+
+GeometryArena::GeometryArena(VertexFormat format, bool texCoords, size_t vertexCapacity, size_t indexCapacity) {
+	_exist = false;
+	_VAO_ID = _VBO_ID = _EBO_ID = 0;
+	_format = format;
+	_texCoords = texCoords;
+	_vertexCapacity = vertexCapacity;
+	_indexCapacity = indexCapacity;
+	_vertexUsed = _indexUsed = 0;
+
+	Mesh::clearErrors();
+	glGenVertexArrays(1, &_VAO_ID);
+	glGenBuffers(1, &_VBO_ID);
+	glGenBuffers(1, &_EBO_ID);
+	if (!_VAO_ID || !_VBO_ID || !_EBO_ID)
+		return;
+
+	glBindVertexArray(_VAO_ID);
+
+	/* storage only, meshes are copied in by allocate() */
+	glBindBuffer(GL_ARRAY_BUFFER, _VBO_ID);
+	glBufferData(GL_ARRAY_BUFFER, _vertexCapacity * Mesh::vertexSize(_format, _texCoords), NULL, GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _EBO_ID);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, _indexCapacity * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+
+	Mesh::setAttributes(_format, _texCoords);
+
+	glBindVertexArray(0);
+	_exist = (glGetError() != GL_OUT_OF_MEMORY);
+}
+
+GeometryArena::~GeometryArena() {
+	if (_VAO_ID) {
+		glBindVertexArray(0);
+		glDeleteVertexArrays(1, &_VAO_ID);
+	}
+	if (_VBO_ID) {
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glDeleteBuffers(1, &_VBO_ID);
+	}
+	if (_EBO_ID) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		glDeleteBuffers(1, &_EBO_ID);
+	}
+}
+
+bool GeometryArena::allocate(const MeshInfo &info, const void *vertexData, const GLuint *indices, GLint &baseVertex, size_t &firstIndex) {
+	size_t indexNum = Mesh::indexNum(info);
+	if (!_exist || info.format != _format || info.texCoords != _texCoords)
+		return false;
+	if (_vertexUsed + info.vertexNum > _vertexCapacity || _indexUsed + indexNum > _indexCapacity)
+		return false;
+
+	size_t stride = Mesh::vertexSize(_format, _texCoords);
+	glBindBuffer(GL_ARRAY_BUFFER, _VBO_ID);
+	glBufferSubData(GL_ARRAY_BUFFER, _vertexUsed * stride, info.vertexNum * stride, vertexData);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	/* element buffer binding is VAO state, change it through the arena VAO only */
+	glBindVertexArray(_VAO_ID);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, _indexUsed * sizeof(GLuint), indexNum * sizeof(GLuint), indices);
+	glBindVertexArray(0);
+
+	/* indices stay local to mesh, draws add base vertex */
+	baseVertex = (GLint)_vertexUsed;
+	firstIndex = _indexUsed;
+	_vertexUsed += info.vertexNum;
+	_indexUsed += indexNum;
+	return true;
+}
+
+bool GeometryArena::write(const MeshInfo &info, const void *vertexData, const GLuint *indices, GLint baseVertex, size_t firstIndex) {
+	size_t indexNum = Mesh::indexNum(info);
+	if (!_exist || info.format != _format || info.texCoords != _texCoords)
+		return false;
+	if (baseVertex < 0 || (size_t)baseVertex + info.vertexNum > _vertexUsed || firstIndex + indexNum > _indexUsed)
+		return false;
+
+	size_t stride = Mesh::vertexSize(_format, _texCoords);
+	glBindBuffer(GL_ARRAY_BUFFER, _VBO_ID);
+	glBufferSubData(GL_ARRAY_BUFFER, baseVertex * stride, info.vertexNum * stride, vertexData);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(_VAO_ID);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, firstIndex * sizeof(GLuint), indexNum * sizeof(GLuint), indices);
+	glBindVertexArray(0);
+	return true;
+}
+
+bool GeometryArena::read(const MeshInfo &info, void *vertexData, GLuint *indices, size_t indexNum, GLint baseVertex, size_t firstIndex) const {
+	if (!_exist || info.format != _format || info.texCoords != _texCoords)
+		return false;
+	if (baseVertex < 0 || (size_t)baseVertex + info.vertexNum > _vertexUsed || firstIndex + indexNum > _indexUsed)
+		return false;
+
+	/* copy read target leaves bindings of VAOs alone */
+	size_t stride = Mesh::vertexSize(_format, _texCoords);
+	glBindBuffer(GL_COPY_READ_BUFFER, _VBO_ID);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, baseVertex * stride, info.vertexNum * stride, vertexData);
+	glBindBuffer(GL_COPY_READ_BUFFER, _EBO_ID);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, firstIndex * sizeof(GLuint), indexNum * sizeof(GLuint), indices);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	return true;
+}
+
+GLuint GeometryArena::getVAO() const { return _VAO_ID; }
+
+size_t GeometryArena::getMemory() const {
+	return _exist ? _vertexCapacity * Mesh::vertexSize(_format, _texCoords) + _indexCapacity * sizeof(GLuint) : 0;
+}
+
+bool GeometryArena::empty() const { return !_exist; }
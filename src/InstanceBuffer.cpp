@@ -0,0 +1,71 @@
+#include "InstanceBuffer.h"
+#include <cstring>
+
+/* first of four vec4 locations of instance matrix in model shader */
+static const GLuint INSTANCE_LOCATION = 4;
+
+InstanceBuffer::InstanceBuffer() {
+	static unsigned int serial = 0;
+	_exist = false;
+	_VBO_ID = 0;
+	_serial = ++serial;
+	_capacity = _count = 0;
+
+	glGenBuffers(1, &_VBO_ID);
+	_exist = (_VBO_ID != 0);
+}
+
+InstanceBuffer::~InstanceBuffer() {
+	/* VAOs still pointing at buffer keep it alive until they are deleted */
+	if (_VBO_ID) {
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glDeleteBuffers(1, &_VBO_ID);
+	}
+}
+
+void InstanceBuffer::update(const glm::mat4 *transforms, size_t count) {
+	if (!_exist)
+		return;
+	_count = count;
+	if (!count)
+		return;
+	glBindBuffer(GL_ARRAY_BUFFER, _VBO_ID);
+	if (count > _capacity) {
+		/* same buffer name, VAOs pointing at it stay valid */
+		_capacity = _capacity ? _capacity : 16;
+		while (_capacity < count)
+			_capacity *= 2;
+		glBufferData(GL_ARRAY_BUFFER, _capacity * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+	}
+	/* invalidating lets driver hand out fresh memory while last frame still reads old one */
+	void *data = glMapBufferRange(GL_ARRAY_BUFFER, 0, count * sizeof(glm::mat4), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (data != NULL) {
+		memcpy(data, transforms, count * sizeof(glm::mat4));
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	} else
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(glm::mat4), transforms);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InstanceBuffer::update(const std::vector<glm::mat4> &transforms) {
+	update(transforms.empty() ? nullptr : &transforms[0], transforms.size());
+}
+
+GLuint InstanceBuffer::getVBO() const { return _VBO_ID; }
+
+unsigned int InstanceBuffer::getSerial() const { return _serial; }
+
+size_t InstanceBuffer::getCount() const { return _count; }
+
+void InstanceBuffer::setAttributes() const {
+	glBindBuffer(GL_ARRAY_BUFFER, _VBO_ID);
+	/* mat4 attribute takes one location per column, advancing once per instance */
+	for (GLuint i = 0; i < 4; i++) {
+		glEnableVertexAttribArray(INSTANCE_LOCATION + i);
+		glVertexAttribPointer(INSTANCE_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *)(i * sizeof(glm::vec4)));
+		glVertexAttribDivisor(INSTANCE_LOCATION + i, 1);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+bool InstanceBuffer::empty() const { return !_exist; }
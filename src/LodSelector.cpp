@@ -0,0 +1,31 @@
+#include "LodSelector.h"
+#include <limits>
+
+LodSelector::LodSelector(const glm::mat4 &positionMatrix, const glm::mat4 &projection, int viewportHeight, GLfloat pixelsPerTriangle) {
+	_positionMatrix = positionMatrix;
+	_pixelScale = projection[1][1] * viewportHeight / 2.f;
+	_pixelsPerTriangle = pixelsPerTriangle > 0.f ? pixelsPerTriangle : 1.f;
+}
+
+unsigned int LodSelector::select(const MeshInfo &info) const {
+	if (info.lodNum <= 1)
+		return 0;
+	GLfloat pixelRadius = pixelSize(info) * .5f;
+	if (pixelRadius == std::numeric_limits<GLfloat>::infinity())
+		return 0;
+	GLfloat budget = 3.14159265f * pixelRadius * pixelRadius / _pixelsPerTriangle;
+	for (unsigned int level = 0; level + 1 < info.lodNum; level++)
+		if (info.lodFaceNum[level] <= budget)
+			return level;
+	return info.lodNum - 1;
+}
+
+GLfloat LodSelector::pixelSize(const MeshInfo &info) const {
+	/* bounding sphere of box, projected at its nearest distance */
+	glm::vec3 center = (info.aabbMin + info.aabbMax) * .5f;
+	GLfloat radius = glm::length(info.aabbMax - info.aabbMin) * .5f;
+	GLfloat distance = -glm::vec3(_positionMatrix * glm::vec4(center, 1.f)).z - radius;
+	if (distance <= 1e-4f)
+		return std::numeric_limits<GLfloat>::infinity();
+	return 2.f * radius * _pixelScale / distance;
+}
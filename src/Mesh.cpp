@@ -1,105 +1,153 @@
 #include "Mesh.h"
+#include "GeometryArena.h"
+#include "MeshOptimizer.h"
+#include "Simplifier.h"
+#include <glm/gtc/packing.hpp>
+#include <cstddef>
+#include <cstring>
 
-void Mesh::initialize() {
+namespace {
+
+/* compact vertex : 16 bytes, or 12 bytes without texture coords */
+struct CompactVertex {
+	GLushort position[4];/* normalized in mesh bounds, last one is padding */
+	GLshort normal[2];/* octahedral encoded, snorm */
+	GLushort texCoord[2];/* half float */
+};
+
+/* float vertex : 32 bytes, or 24 bytes without texture coords */
+struct FloatVertex {
+	GLfloat position[3];
+	GLfloat normal[3];
+	GLfloat texCoord[2];
+};
+
+GLshort packSnorm(float v) {
+	return (GLshort)glm::round(glm::clamp(v, -1.f, 1.f) * 32767.f);
+}
+
+GLushort packUnorm(float v) {
+	return (GLushort)glm::round(glm::clamp(v, 0.f, 1.f) * 65535.f);
+}
+
+/* project unit vector on octahedron and unfold it into [-1,1]^2 */
+void encodeOctahedral(const aiVector3D &n, GLshort *encoded) {
+	float l1 = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+	if (l1 <= 0.f) {
+		encoded[0] = encoded[1] = 0;
+		return;
+	}
+	float x = n.x / l1, y = n.y / l1;
+	if (n.z < 0.f) {
+		float ox = x;
+		x = (1.f - glm::abs(y)) * (ox >= 0.f ? 1.f : -1.f);
+		y = (1.f - glm::abs(ox)) * (y >= 0.f ? 1.f : -1.f);
+	}
+	encoded[0] = packSnorm(x);
+	encoded[1] = packSnorm(y);
+}
+
+}
+
+void Mesh::initialize(const void *vertexData, const GLuint *indices) {
 	glGenVertexArrays(1, &_VAO_ID);
 	glGenBuffers(1, &_VBO_ID);
 	glGenBuffers(1, &_EBO_ID);
-	
+
 	glBindVertexArray(_VAO_ID);
-	
+
 	glBindBuffer(GL_ARRAY_BUFFER, _VBO_ID);
-	glBufferData(GL_ARRAY_BUFFER, 11 * _vertexNum * sizeof(GLfloat), NULL, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, 3 * _vertexNum * sizeof(GLfloat), _vertices);
-	glBufferSubData(GL_ARRAY_BUFFER, 3 * _vertexNum * sizeof(GLfloat), 3 * _vertexNum * sizeof(GLfloat), _colors);
-	glBufferSubData(GL_ARRAY_BUFFER, 6 * _vertexNum * sizeof(GLfloat), 3 * _vertexNum * sizeof(GLfloat), _normals);
-	glBufferSubData(GL_ARRAY_BUFFER, 9 * _vertexNum * sizeof(GLfloat), 2 * _vertexNum * sizeof(GLfloat), _texCoords);
+	glBufferData(GL_ARRAY_BUFFER, vertexDataSize(_info), vertexData, GL_STATIC_DRAW);
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _EBO_ID);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 3 * _faceNum * sizeof(GLuint), _indices, GL_STATIC_DRAW);
-
-	/* vertex positions */
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-	/* vertex colors */
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)(3 * _vertexNum * sizeof(GLfloat)));
-	/* vertex normals */
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)(6 * _vertexNum * sizeof(GLfloat)));
-	/* vertex texture coords */
-	glEnableVertexAttribArray(3);
-	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, (void*)(9 * _vertexNum * sizeof(GLfloat)));
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexNum(_info) * sizeof(GLuint), indices, GL_STATIC_DRAW);
+
+	setAttributes(_info.format, _info.texCoords);
 
 	glBindVertexArray(0);
 }
 
-Mesh::Mesh(const aiMesh * mesh, GLuint texture, const aiColor3D & color) {
+Mesh::Mesh(const aiMesh * mesh, VertexFormat format, GLuint texture, const aiColor3D & color) {
 	/* default value is important because initializer may be interrupted */
 	_exist = false;
-	_vertices = _colors = _normals = _texCoords = nullptr;
+	_shared = false;
+	_mapped = false;
+	_baseVertex = 0;
+	_firstIndex = 0;
 	_VAO_ID = _VBO_ID = _EBO_ID = 0;
 
 	_texture = texture;
 	_haveTexture = (_texture > 0);
-	_vertexNum = mesh->mNumVertices;
-	_faceNum = mesh->mNumFaces;
-
-	try {
-		_vertices = new GLfloat[_vertexNum * 3];
-		_normals = new GLfloat[_vertexNum * 3];
-		_texCoords = new GLfloat[_vertexNum * 2];
-		_colors = new GLfloat[_vertexNum * 3];
-		_indices = new GLuint[_faceNum * 3];
-	} catch(std::bad_alloc) {
+	_color = color;
+	_info = measure(mesh, format);
+
+	/* convert straight into buffer memory, no copy is kept on CPU */
+	initialize(NULL, NULL);
+	void *vertexData;
+	GLuint *indices;
+	if (!map(vertexData, indices))
 		return;
-	}
+	convert(mesh, _info, vertexData, indices);
+	_exist = unmap();
+}
 
-	for(unsigned int i = 0; i < _vertexNum; i++) {
-		_vertices[3 * i] = mesh->mVertices[i].x;
-		_vertices[3 * i + 1] = mesh->mVertices[i].y;
-		_vertices[3 * i + 2] = mesh->mVertices[i].z;
-		_normals[3 * i] = mesh->mNormals[i].x;
-		_normals[3 * i + 1] = mesh->mNormals[i].y;
-		_normals[3 * i + 2] = mesh->mNormals[i].z;
-		if (!_haveTexture) {
-			_colors[3 * i] = color.r;
-			_colors[3 * i + 1] = color.g;
-			_colors[3 * i + 2] = color.b;
-			continue;
-		}
-		if (mesh->mTextureCoords[0]) {
-			_texCoords[2 * i] = mesh->mTextureCoords[0][i].x;
-			_texCoords[2 * i + 1] = mesh->mTextureCoords[0][i].y;
-		} else
-			_texCoords[2 * i] = _texCoords[2 * i + 1] = 0.f;
-	}
+Mesh::Mesh(const MeshInfo &info, GLuint texture, const aiColor3D &color) {
+	_exist = false;
+	_shared = false;
+	_mapped = false;
+	_baseVertex = 0;
+	_firstIndex = 0;
+	_VAO_ID = _VBO_ID = _EBO_ID = 0;
 
-	int k = 0;
-	for (unsigned int i = 0; i < _faceNum; i++) {
-		const aiFace face = mesh->mFaces[i];
-		/* each face has 3 vertices */
-		for (unsigned int j = 0; j < face.mNumIndices; j++) {
-			_indices[k] = face.mIndices[j];
-			++k;
-		}
-	}
-	initialize();
+	_texture = texture;
+	_haveTexture = (_texture > 0);
+	_color = color;
+	_info = info;
+
+	clearErrors();
+	initialize(NULL, NULL);
+	_exist = (glGetError() != GL_OUT_OF_MEMORY);
+}
+
+Mesh::Mesh(const MeshInfo &info, const void *vertexData, const GLuint *indices, GLuint texture, const aiColor3D &color) {
+	_exist = false;
+	_shared = false;
+	_baseVertex = 0;
+	_firstIndex = 0;
+	_mapped = false;
+	_VAO_ID = _VBO_ID = _EBO_ID = 0;
+
+	_texture = texture;
+	_haveTexture = (_texture > 0);
+	_color = color;
+	_info = info;
+
+	/* data is owned by caller, it only has to live until uploaded */
+	initialize(vertexData, indices);
 	_exist = true;
 }
 
+Mesh::Mesh(const MeshInfo &info, GeometryArena &arena, const void *vertexData, const GLuint *indices, GLuint texture, const aiColor3D &color) {
+	_exist = false;
+	_shared = true;
+	_baseVertex = 0;
+	_firstIndex = 0;
+	_mapped = false;
+	_VAO_ID = _VBO_ID = _EBO_ID = 0;
+
+	_texture = texture;
+	_haveTexture = (_texture > 0);
+	_color = color;
+	_info = info;
+
+	if (!arena.allocate(info, vertexData, indices, _baseVertex, _firstIndex))
+		return;
+	_VAO_ID = arena.getVAO();
+	_exist = true;
+}
 
 Mesh::~Mesh() {
-	if(_vertices != nullptr)
-		delete[] _vertices;
-	if (_colors != nullptr)
-		delete[] _colors;
-	if (_normals != nullptr)
-		delete[] _normals;
-	if (_texCoords != nullptr)
-		delete[] _texCoords;
-	if (_indices != nullptr)
-		delete[] _indices;
-	if (_VAO_ID) {
+	if (_VAO_ID && !_shared) {
 		glBindVertexArray(0);
 		glDeleteVertexArrays(1, &_VAO_ID);
 	}
@@ -113,15 +161,307 @@ Mesh::~Mesh() {
 	}
 }
 
-void Mesh::draw(GLuint programId) {
-	glUniform1i(glGetUniformLocation(programId, "haveTexture"), (int)_haveTexture);
+bool Mesh::map(void *&vertexData, GLuint *&indices) {
+	size_t vertexBytes = vertexDataSize(_info), indexBytes = indexNum(_info) * sizeof(GLuint);
+	if (_shared || _mapped || !_VAO_ID || !vertexBytes || !indexBytes)
+		return false;
+	/* old contents are discarded, driver does not have to wait for or copy them */
+	glBindBuffer(GL_ARRAY_BUFFER, _VBO_ID);
+	vertexData = glMapBufferRange(GL_ARRAY_BUFFER, 0, vertexBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindVertexArray(_VAO_ID);
-	glBindTexture(GL_TEXTURE_2D, _texture);
-	//glDrawArrays(GL_TRIANGLES, 0, _vertexNum);
-	glDrawElements(GL_TRIANGLES, 3 * _faceNum, GL_UNSIGNED_INT, 0);
+	indices = (GLuint *)glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, indexBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	glBindVertexArray(0);
+	_mapped = true;
+	if (vertexData == NULL || indices == NULL) {
+		unmap();
+		return false;
+	}
+	return true;
+}
+
+bool Mesh::unmap() {
+	if (!_mapped)
+		return false;
+	/* GL_FALSE means buffer contents were lost while mapped */
+	glBindBuffer(GL_ARRAY_BUFFER, _VBO_ID);
+	GLboolean vertexKept = glUnmapBuffer(GL_ARRAY_BUFFER);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(_VAO_ID);
+	GLboolean indexKept = glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
 	glBindVertexArray(0);
+	_mapped = false;
+	return vertexKept == GL_TRUE && indexKept == GL_TRUE;
+}
+
+bool Mesh::update(const MeshInfo &info, const void *vertexData, const GLuint *indices, GeometryArena *arena) {
+	if (!_exist || _mapped || !sameLayout(info, _info))
+		return false;
+	if (_shared) {
+		if (arena == nullptr || arena->getVAO() != _VAO_ID || !arena->write(info, vertexData, indices, _baseVertex, _firstIndex))
+			return false;
+	} else {
+		glBindBuffer(GL_ARRAY_BUFFER, _VBO_ID);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, vertexDataSize(info), vertexData);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(_VAO_ID);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indexNum(info) * sizeof(GLuint), indices);
+		glBindVertexArray(0);
+	}
+	_info = info;
+	return true;
+}
+
+bool Mesh::readBack(std::vector<glm::vec3> &positions, std::vector<GLuint> &indices, const GeometryArena *arena) const {
+	if (!_exist || _mapped || !_info.vertexNum || !_info.lodFaceNum[0])
+		return false;
+	size_t stride = vertexSize(_info.format, _info.texCoords);
+	std::vector<unsigned char> vertexData(vertexDataSize(_info));
+	indices.resize(3 * (size_t)_info.lodFaceNum[0]);
+	if (_shared) {
+		if (arena == nullptr || arena->getVAO() != _VAO_ID
+			|| !arena->read(_info, &vertexData[0], &indices[0], indices.size(), _baseVertex, _firstIndex))
+			return false;
+	} else {
+		glBindBuffer(GL_COPY_READ_BUFFER, _VBO_ID);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, vertexData.size(), &vertexData[0]);
+		glBindBuffer(GL_COPY_READ_BUFFER, _EBO_ID);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, indices.size() * sizeof(GLuint), &indices[0]);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+
+	/* compact positions are decoded as the vertex shader does */
+	positions.resize(_info.vertexNum);
+	glm::vec3 extent = _info.boundsMax - _info.boundsMin;
+	const unsigned char *vertex = &vertexData[0];
+	for (unsigned int i = 0; i < _info.vertexNum; i++, vertex += stride) {
+		if (_info.format == VERTEX_FORMAT_COMPACT) {
+			GLushort position[3];
+			memcpy(position, vertex + offsetof(CompactVertex, position), sizeof(position));
+			positions[i] = _info.boundsMin + extent * glm::vec3(position[0], position[1], position[2]) / 65535.f;
+		} else {
+			GLfloat position[3];
+			memcpy(position, vertex + offsetof(FloatVertex, position), sizeof(position));
+			positions[i] = glm::vec3(position[0], position[1], position[2]);
+		}
+	}
+	return true;
+}
+
+void Mesh::bindMaterial(RenderState &state) const {
+	state.setInt(UNIFORM_HAVE_TEXTURE, (int)_haveTexture);
+	state.setVec3(UNIFORM_MATERIAL_COLOR, glm::vec3(_color.r, _color.g, _color.b));
+	state.setInt(UNIFORM_COMPACT_VERTEX, (int)(_info.format == VERTEX_FORMAT_COMPACT));
+	if (_info.format == VERTEX_FORMAT_COMPACT) {
+		state.setVec3(UNIFORM_BOUNDS_MIN, _info.boundsMin);
+		state.setVec3(UNIFORM_BOUNDS_EXTENT, _info.boundsMax - _info.boundsMin);
+	}
+	state.bindTexture(_texture);
+}
+
+/* VAO stays bound, state knows it and skips rebinding it for next mesh of same arena */
+void Mesh::draw(RenderState &state, unsigned int level) {
+	bindMaterial(state);
+	state.bindVertexArray(_VAO_ID);
+	if (!state.flush())
+		return;
+	//glDrawArrays(GL_TRIANGLES, 0, _vertexNum);
+	glDrawElementsBaseVertex(GL_TRIANGLES, getIndexCount(level), GL_UNSIGNED_INT, getIndexOffset(level), _baseVertex);
+	state.countDraw(_info.lodFaceNum[level]);
+}
+
+void Mesh::drawInstanced(RenderState &state, GLsizei instanceNum, unsigned int level) {
+	bindMaterial(state);
+	state.bindVertexArray(_VAO_ID);
+	if (!state.flush())
+		return;
+	glDrawElementsInstancedBaseVertex(GL_TRIANGLES, getIndexCount(level), GL_UNSIGNED_INT, getIndexOffset(level), instanceNum, _baseVertex);
+	state.countDraw(_info.lodFaceNum[level] * instanceNum);
 }
 
 bool Mesh::empty() const {
 	return !_exist;
+}
+
+MemoryUsage Mesh::getMemory() const {
+	MemoryUsage usage;
+	usage.host = sizeof(Mesh);
+	usage.buffers = _exist ? vertexDataSize(_info) + indexNum(_info) * sizeof(GLuint) : 0;
+	usage.textures = 0;
+	return usage;
+}
+
+bool Mesh::isShared() const { return _shared; }
+
+const MeshInfo & Mesh::getInfo() const { return _info; }
+
+GLuint Mesh::getVAO() const { return _VAO_ID; }
+
+GLuint Mesh::getTexture() const { return _texture; }
+
+void Mesh::setTexture(GLuint texture) {
+	_texture = texture;
+	_haveTexture = (_texture > 0);
+}
+
+void Mesh::setColor(const aiColor3D &color) { _color = color; }
+
+GLint Mesh::getBaseVertex() const { return _baseVertex; }
+
+const void * Mesh::getIndexOffset(unsigned int level) const {
+	size_t first = _firstIndex;
+	for (unsigned int i = 0; i < level; i++)
+		first += 3 * (size_t)_info.lodFaceNum[i];
+	return (const void *)(first * sizeof(GLuint));
+}
+
+GLsizei Mesh::getIndexCount(unsigned int level) const { return 3 * _info.lodFaceNum[level]; }
+
+void Mesh::clearErrors() {
+	/* one per error flag a driver may keep */
+	for (int i = 0; i < 8 && glGetError() != GL_NO_ERROR; i++)
+		;
+}
+
+void Mesh::setAttributes(VertexFormat format, bool texCoords) {
+	GLsizei stride = (GLsizei)vertexSize(format, texCoords);
+	if (format == VERTEX_FORMAT_COMPACT) {
+		/* vertex positions */
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(CompactVertex, position));
+		/* vertex normals */
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(CompactVertex, normal));
+		/* vertex texture coords */
+		if (texCoords) {
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(CompactVertex, texCoord));
+		}
+	} else {
+		/* vertex positions */
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(FloatVertex, position));
+		/* vertex normals */
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(FloatVertex, normal));
+		/* vertex texture coords */
+		if (texCoords) {
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(FloatVertex, texCoord));
+		}
+	}
+}
+
+size_t Mesh::vertexSize(VertexFormat format, bool texCoords) {
+	if (format == VERTEX_FORMAT_COMPACT)
+		return texCoords ? sizeof(CompactVertex) : offsetof(CompactVertex, texCoord);
+	return texCoords ? sizeof(FloatVertex) : offsetof(FloatVertex, texCoord);
+}
+
+size_t Mesh::vertexDataSize(const MeshInfo &info) {
+	return vertexSize(info.format, info.texCoords) * info.vertexNum;
+}
+
+size_t Mesh::indexNum(const MeshInfo &info) {
+	size_t num = 0;
+	for (unsigned int i = 0; i < info.lodNum; i++)
+		num += 3 * (size_t)info.lodFaceNum[i];
+	return num;
+}
+
+bool Mesh::sameLayout(const MeshInfo &a, const MeshInfo &b) {
+	if (a.format != b.format || a.texCoords != b.texCoords || a.vertexNum != b.vertexNum || a.lodNum != b.lodNum)
+		return false;
+	/* draw batches keep counts of levels */
+	for (unsigned int i = 0; i < a.lodNum; i++)
+		if (a.lodFaceNum[i] != b.lodFaceNum[i])
+			return false;
+	return true;
+}
+
+MeshInfo Mesh::measure(const aiMesh *mesh, VertexFormat format) {
+	MeshInfo info;
+	info.format = format;
+	info.texCoords = (mesh->mTextureCoords[0] != nullptr);
+	info.vertexNum = mesh->mNumVertices;
+	info.faceNum = mesh->mNumFaces;
+	info.boundsMin = info.boundsMax = glm::vec3(0.f, 0.f, 0.f);
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
+		glm::vec3 position(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+		info.boundsMin = i ? glm::min(info.boundsMin, position) : position;
+		info.boundsMax = i ? glm::max(info.boundsMax, position) : position;
+	}
+	info.aabbMin = info.boundsMin;
+	info.aabbMax = info.boundsMax;
+	info.lodNum = 1;
+	memset(info.lodFaceNum, 0, sizeof(info.lodFaceNum));
+	info.lodFaceNum[0] = info.faceNum;
+	return info;
+}
+
+void Mesh::convert(const aiMesh *mesh, const MeshInfo &info, void *vertexData, GLuint *indices) {
+	convertVertices(mesh, info, vertexData, 0, info.vertexNum);
+	convertFaces(mesh, indices, 0, mesh->mNumFaces);
+}
+
+void Mesh::convertVertices(const aiMesh *mesh, const MeshInfo &info, void *vertexData, unsigned int first, unsigned int count) {
+	size_t stride = vertexSize(info.format, info.texCoords);
+	unsigned char *vertex = (unsigned char *)vertexData + first * stride;
+	/* flat extent keeps its positions at bounds minimum */
+	glm::vec3 extent = info.boundsMax - info.boundsMin;
+	glm::vec3 scale(extent.x > 0.f ? 1.f / extent.x : 0.f, extent.y > 0.f ? 1.f / extent.y : 0.f, extent.z > 0.f ? 1.f / extent.z : 0.f);
+	for (unsigned int i = first; i < first + count; i++, vertex += stride) {
+		const aiVector3D &position = mesh->mVertices[i];
+		aiVector3D normal = mesh->mNormals ? mesh->mNormals[i] : aiVector3D(0.f, 0.f, 1.f);
+		aiVector3D texCoord = info.texCoords ? mesh->mTextureCoords[0][i] : aiVector3D();
+		if (info.format == VERTEX_FORMAT_COMPACT) {
+			CompactVertex compact;
+			compact.position[0] = packUnorm((position.x - info.boundsMin.x) * scale.x);
+			compact.position[1] = packUnorm((position.y - info.boundsMin.y) * scale.y);
+			compact.position[2] = packUnorm((position.z - info.boundsMin.z) * scale.z);
+			compact.position[3] = 0;
+			encodeOctahedral(normal, compact.normal);
+			compact.texCoord[0] = glm::packHalf1x16(texCoord.x);
+			compact.texCoord[1] = glm::packHalf1x16(texCoord.y);
+			memcpy(vertex, &compact, stride);
+		} else {
+			FloatVertex full = { { position.x, position.y, position.z }, { normal.x, normal.y, normal.z }, { texCoord.x, texCoord.y } };
+			memcpy(vertex, &full, stride);
+		}
+	}
+}
+
+void Mesh::convertFaces(const aiMesh *mesh, GLuint *indices, unsigned int first, unsigned int count) {
+	for (unsigned int i = first; i < first + count; i++) {
+		const aiFace &face = mesh->mFaces[i];
+		/* each face has 3 vertices, points and lines left by triangulation become degenerate triangles */
+		for (unsigned int j = 0; j < 3; j++)
+			indices[3 * (size_t)i + j] = face.mNumIndices ? face.mIndices[j < face.mNumIndices ? j : face.mNumIndices - 1] : 0;
+	}
+}
+
+std::vector<GLuint> Mesh::buildLods(const aiMesh *mesh, MeshInfo &info) {
+	/* each level has a quarter of the faces of the previous one */
+	const unsigned int MIN_LOD_FACE_NUM = 64;
+	std::vector<GLuint> lodIndices, level;
+	level.reserve(3 * (size_t)mesh->mNumFaces);
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+		if (mesh->mFaces[i].mNumIndices == 3)
+			level.insert(level.end(), mesh->mFaces[i].mIndices, mesh->mFaces[i].mIndices + 3);
+
+	for (info.lodNum = 1; info.lodNum < MAX_LOD_NUM; info.lodNum++) {
+		size_t target = level.size() / 12 * 3;
+		if (target < 3 * MIN_LOD_FACE_NUM)
+			break;
+		std::vector<GLuint> simplified = simplifyMesh(mesh->mVertices, mesh->mNumVertices, level, target);
+		/* collapses got blocked, level would not pay for its memory */
+		if (simplified.empty() || 3 * simplified.size() > 2 * level.size())
+			break;
+		/* collapses leave triangles scattered, vertices keep their full detail order */
+		optimizeVertexCache(simplified, mesh->mNumVertices);
+		info.lodFaceNum[info.lodNum] = (unsigned int)(simplified.size() / 3);
+		lodIndices.insert(lodIndices.end(), simplified.begin(), simplified.end());
+		level.swap(simplified);
+	}
+	return lodIndices;
 }
\ No newline at end of file
@@ -0,0 +1,331 @@
+#include "MeshBVH.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+const unsigned int BIN_NUM = 16;
+const size_t LEAF_SIZE = 4;/* ranges this small are not split */
+const size_t MAX_LEAF_SIZE = 16;/* larger ranges are split even if heuristic prefers a leaf */
+const unsigned int MAX_DEPTH = 60;/* below size of traversal stack */
+const unsigned int STACK_SIZE = 64;
+const size_t PARALLEL_GRAIN = 1 << 16;/* triangles of smallest range built on its own */
+const GLuint SUBTREE = ~(GLuint)0;/* count of node standing for a range built separately */
+
+/* half surface area of box, factor does not matter for comparisons */
+float halfArea(const glm::vec3 &boxMin, const glm::vec3 &boxMax) {
+	glm::vec3 extent = boxMax - boxMin;
+	return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+struct Bin {
+	glm::vec3 boxMin, boxMax;
+	size_t count;
+};
+
+/* entry distance of ray into box, or infinity if it misses it before maxDistance */
+float enterBox(const float *boxMin, const float *boxMax, const glm::vec3 &origin, const glm::vec3 &inverse, float maxDistance) {
+	float enter = 0.f, leave = maxDistance;
+	for (int i = 0; i < 3; i++) {
+		float t0 = (boxMin[i] - origin[i]) * inverse[i], t1 = (boxMax[i] - origin[i]) * inverse[i];
+		if (t0 > t1)
+			std::swap(t0, t1);
+		/* written so that NaN of a ray in a slab plane keeps the other bounds */
+		enter = t0 > enter ? t0 : enter;
+		leave = t1 < leave ? t1 : leave;
+	}
+	return enter <= leave ? enter : std::numeric_limits<float>::infinity();
+}
+
+/* Moller-Trumbore, distance of hit or infinity */
+float intersectTriangle(const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c) {
+	const float INF = std::numeric_limits<float>::infinity();
+	glm::vec3 edge1 = b - a, edge2 = c - a;
+	glm::vec3 p = glm::cross(direction, edge2);
+	float determinant = glm::dot(edge1, p);
+	if (determinant > -1e-12f && determinant < 1e-12f)
+		return INF;
+	float inverse = 1.f / determinant;
+	glm::vec3 s = origin - a;
+	float u = glm::dot(s, p) * inverse;
+	if (u < 0.f || u > 1.f)
+		return INF;
+	glm::vec3 q = glm::cross(s, edge1);
+	float v = glm::dot(direction, q) * inverse;
+	if (v < 0.f || u + v > 1.f)
+		return INF;
+	float t = glm::dot(edge2, q) * inverse;
+	return t >= 0.f ? t : INF;
+}
+
+}
+
+MeshBVH::MeshBVH(std::vector<glm::vec3> &positions, const std::vector<GLuint> &indices) {
+	_positions.swap(positions);
+	size_t triangleNum = indices.size() / 3;
+	if (!triangleNum || triangleNum > 0xffffffffu)
+		return;
+	for (size_t i = 0; i < 3 * triangleNum; i++)
+		if (indices[i] >= _positions.size())
+			return;
+
+	/* boxes of triangles are only needed while building, they move with partitions to be read in order */
+	std::vector<BuildTriangle> triangles(triangleNum);
+	for (size_t i = 0; i < triangleNum; i++) {
+		const glm::vec3 &a = _positions[indices[3 * i]], &b = _positions[indices[3 * i + 1]], &c = _positions[indices[3 * i + 2]];
+		triangles[i].boxMin = glm::min(a, glm::min(b, c));
+		triangles[i].boxMax = glm::max(a, glm::max(b, c));
+		triangles[i].index = (GLuint)i;
+	}
+	/* upper levels split large meshes into ranges built on workers, whose nodes are put in place after */
+	ThreadPool &pool = ThreadPool::shared();
+	size_t grain = std::max(PARALLEL_GRAIN, triangleNum / (4 * ((size_t)pool.size() + 1)));
+	if (triangleNum <= grain) {
+		/* leaves hold up to LEAF_SIZE triangles, a binary tree has fewer than twice as many nodes as leaves */
+		_nodes.reserve(2 * (triangleNum + LEAF_SIZE - 1) / LEAF_SIZE);
+		build(_nodes, triangles, 0, triangleNum, 0, 0, nullptr);
+	} else {
+		std::vector<Node> top;
+		std::vector<Subtree> subtrees;
+		build(top, triangles, 0, triangleNum, 0, grain, &subtrees);
+		pool.parallelFor(subtrees.size(), [&](size_t i) {
+			Subtree &subtree = subtrees[i];
+			subtree.nodes.reserve(2 * (subtree.end - subtree.begin + LEAF_SIZE - 1) / LEAF_SIZE);
+			build(subtree.nodes, triangles, subtree.begin, subtree.end, subtree.depth, 0, nullptr);
+		});
+		size_t nodeNum = top.size();
+		for (size_t i = 0; i < subtrees.size(); i++)
+			nodeNum += subtrees[i].nodes.size();
+		_nodes.reserve(nodeNum);
+		place(top, 0, subtrees);
+	}
+
+	/* triangles of a leaf lie next to each other */
+	_indices.resize(3 * triangleNum);
+	_triangles.resize(triangleNum);
+	for (size_t i = 0; i < triangleNum; i++) {
+		_triangles[i] = triangles[i].index;
+		for (int j = 0; j < 3; j++)
+			_indices[3 * i + j] = indices[3 * (size_t)triangles[i].index + j];
+	}
+}
+
+GLuint MeshBVH::build(std::vector<Node> &nodes, std::vector<BuildTriangle> &triangles, size_t begin, size_t end, unsigned int depth,
+	size_t grain, std::vector<Subtree> *subtrees) {
+	GLuint index = (GLuint)nodes.size();
+	nodes.push_back(Node());
+	if (end - begin <= grain) {
+		Subtree subtree;
+		subtree.begin = begin;
+		subtree.end = end;
+		subtree.depth = depth;
+		nodes[index].offset = (GLuint)subtrees->size();
+		nodes[index].count = SUBTREE;
+		subtrees->push_back(subtree);
+		return index;
+	}
+
+	glm::vec3 nodeMin = triangles[begin].boxMin, nodeMax = triangles[begin].boxMax;
+	glm::vec3 centroidMin = nodeMin + nodeMax, centroidMax = centroidMin;
+	for (size_t i = begin; i < end; i++) {
+		const BuildTriangle &t = triangles[i];
+		nodeMin = glm::min(nodeMin, t.boxMin);
+		nodeMax = glm::max(nodeMax, t.boxMax);
+		/* doubled centroid, saves a multiply per triangle */
+		glm::vec3 centroid = t.boxMin + t.boxMax;
+		centroidMin = glm::min(centroidMin, centroid);
+		centroidMax = glm::max(centroidMax, centroid);
+	}
+	for (int i = 0; i < 3; i++) {
+		nodes[index].boundsMin[i] = nodeMin[i];
+		nodes[index].boundsMax[i] = nodeMax[i];
+	}
+
+	size_t count = end - begin;
+	glm::vec3 extent = centroidMax - centroidMin;
+	int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	/* triangles sharing one centroid can not be told apart by any split */
+	if (count <= LEAF_SIZE || depth >= MAX_DEPTH || extent[axis] <= 0.f) {
+		nodes[index].offset = (GLuint)begin;
+		nodes[index].count = (GLuint)count;
+		return index;
+	}
+
+	/* bins of all three axes filled in one pass over triangles */
+	const float INF = std::numeric_limits<float>::infinity();
+	Bin bins[3][BIN_NUM];
+	glm::vec3 scale;
+	for (int a = 0; a < 3; a++) {
+		scale[a] = extent[a] > 0.f ? BIN_NUM / extent[a] : 0.f;
+		for (unsigned int b = 0; b < BIN_NUM; b++) {
+			bins[a][b].boxMin = glm::vec3(INF, INF, INF);
+			bins[a][b].boxMax = glm::vec3(-INF, -INF, -INF);
+			bins[a][b].count = 0;
+		}
+	}
+	for (size_t i = begin; i < end; i++) {
+		const BuildTriangle &t = triangles[i];
+		glm::vec3 centroid = t.boxMin + t.boxMax;
+		for (int a = 0; a < 3; a++) {
+			Bin &bin = bins[a][std::min(BIN_NUM - 1, (unsigned int)((centroid[a] - centroidMin[a]) * scale[a]))];
+			bin.boxMin = glm::min(bin.boxMin, t.boxMin);
+			bin.boxMax = glm::max(bin.boxMax, t.boxMax);
+			++bin.count;
+		}
+	}
+
+	/* cost of a split in triangle tests weighted by area of node, traversal counts as one test */
+	float bestCost = INF, nodeArea = halfArea(nodeMin, nodeMax);
+	int bestAxis = -1;
+	unsigned int bestBin = 0;
+	for (int a = 0; a < 3; a++) {
+		if (extent[a] <= 0.f)
+			continue;
+		/* areas right of each plane swept from the right, then left sides from the left */
+		float rightArea[BIN_NUM];
+		size_t rightCount[BIN_NUM];
+		glm::vec3 sideMin, sideMax;
+		size_t sideCount = 0;
+		for (unsigned int b = BIN_NUM - 1; b > 0; b--) {
+			const Bin &bin = bins[a][b];
+			if (bin.count) {
+				sideMin = sideCount ? glm::min(sideMin, bin.boxMin) : bin.boxMin;
+				sideMax = sideCount ? glm::max(sideMax, bin.boxMax) : bin.boxMax;
+				sideCount += bin.count;
+			}
+			rightArea[b] = sideCount ? halfArea(sideMin, sideMax) : 0.f;
+			rightCount[b] = sideCount;
+		}
+		sideCount = 0;
+		for (unsigned int b = 0; b + 1 < BIN_NUM; b++) {
+			const Bin &bin = bins[a][b];
+			if (bin.count) {
+				sideMin = sideCount ? glm::min(sideMin, bin.boxMin) : bin.boxMin;
+				sideMax = sideCount ? glm::max(sideMax, bin.boxMax) : bin.boxMax;
+				sideCount += bin.count;
+			}
+			if (!sideCount || !rightCount[b + 1])
+				continue;
+			float cost = nodeArea + halfArea(sideMin, sideMax) * sideCount + rightArea[b + 1] * rightCount[b + 1];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = a;
+				bestBin = b;
+			}
+		}
+	}
+
+	if (bestAxis < 0 || (bestCost >= nodeArea * count && count <= MAX_LEAF_SIZE)) {
+		nodes[index].offset = (GLuint)begin;
+		nodes[index].count = (GLuint)count;
+		return index;
+	}
+
+	float base = centroidMin[bestAxis], binScale = scale[bestAxis];
+	BuildTriangle *middle = std::partition(&triangles[begin], &triangles[0] + end, [&](const BuildTriangle &t) {
+		return std::min(BIN_NUM - 1, (unsigned int)((t.boxMin[bestAxis] + t.boxMax[bestAxis] - base) * binScale)) <= bestBin;
+	});
+	size_t split = middle - &triangles[0];
+	/* rounding put everything on one side, halves by centroid still make progress */
+	if (split == begin || split == end) {
+		split = begin + count / 2;
+		std::nth_element(&triangles[begin], &triangles[split], &triangles[0] + end, [&](const BuildTriangle &l, const BuildTriangle &r) {
+			return l.boxMin[axis] + l.boxMax[axis] < r.boxMin[axis] + r.boxMax[axis];
+		});
+	}
+
+	build(nodes, triangles, begin, split, depth + 1, grain, subtrees);
+	GLuint right = build(nodes, triangles, split, end, depth + 1, grain, subtrees);
+	nodes[index].offset = right;
+	nodes[index].count = 0;
+	return index;
+}
+
+GLuint MeshBVH::place(const std::vector<Node> &top, GLuint index, const std::vector<Subtree> &subtrees) {
+	GLuint placed = (GLuint)_nodes.size();
+	const Node &node = top[index];
+	if (node.count == SUBTREE) {
+		/* offsets of inner nodes move with subtree, leaves already point into shared triangles */
+		const std::vector<Node> &nodes = subtrees[node.offset].nodes;
+		for (size_t i = 0; i < nodes.size(); i++) {
+			_nodes.push_back(nodes[i]);
+			if (!nodes[i].count)
+				_nodes.back().offset += placed;
+		}
+		return placed;
+	}
+	_nodes.push_back(node);
+	if (node.count)
+		return placed;
+	place(top, index + 1, subtrees);
+	_nodes[placed].offset = place(top, node.offset, subtrees);
+	return placed;
+}
+
+bool MeshBVH::intersect(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, Hit &hit) const {
+	if (_nodes.empty())
+		return false;
+	const float INF = std::numeric_limits<float>::infinity();
+	glm::vec3 inverse(1.f / direction.x, 1.f / direction.y, 1.f / direction.z);
+	float nearest = maxDistance;
+	bool found = false;
+
+	/* nodes waiting with the distance ray enters them, skipped if a closer hit turned up meanwhile */
+	GLuint stack[STACK_SIZE];
+	float entries[STACK_SIZE];
+	unsigned int top = 0;
+	float entry = enterBox(_nodes[0].boundsMin, _nodes[0].boundsMax, origin, inverse, nearest);
+	GLuint node = 0;
+	if (entry == INF)
+		return false;
+	for (;;) {
+		const Node &current = _nodes[node];
+		if (current.count) {
+			for (GLuint i = current.offset; i < current.offset + current.count; i++) {
+				const GLuint *triangle = &_indices[3 * (size_t)i];
+				float t = intersectTriangle(origin, direction, _positions[triangle[0]], _positions[triangle[1]], _positions[triangle[2]]);
+				if (t < nearest) {
+					nearest = t;
+					hit.distance = t;
+					hit.triangle = _triangles[i];
+					found = true;
+				}
+			}
+		} else {
+			/* nearer child first, farther one waits */
+			GLuint left = node + 1, right = current.offset;
+			float leftEntry = enterBox(_nodes[left].boundsMin, _nodes[left].boundsMax, origin, inverse, nearest);
+			float rightEntry = enterBox(_nodes[right].boundsMin, _nodes[right].boundsMax, origin, inverse, nearest);
+			if (leftEntry > rightEntry) {
+				std::swap(left, right);
+				std::swap(leftEntry, rightEntry);
+			}
+			if (leftEntry != INF) {
+				if (rightEntry != INF) {
+					stack[top] = right;
+					entries[top++] = rightEntry;
+				}
+				node = left;
+				continue;
+			}
+		}
+		do {
+			if (!top)
+				return found;
+			node = stack[--top];
+			entry = entries[top];
+		} while (entry > nearest);
+	}
+}
+
+size_t MeshBVH::getNodeNum() const { return _nodes.size(); }
+
+size_t MeshBVH::getTriangleNum() const { return _triangles.size(); }
+
+size_t MeshBVH::getMemory() const {
+	return _nodes.capacity() * sizeof(Node) + _positions.capacity() * sizeof(glm::vec3)
+		+ (_indices.capacity() + _triangles.capacity()) * sizeof(GLuint);
+}
+
+bool MeshBVH::empty() const { return _nodes.empty(); }
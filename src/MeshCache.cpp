@@ -0,0 +1,422 @@
+#include "MeshCache.h"
+#include "FileWatcher.h"
+#include <sys/stat.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char MAGIC[8] = { 'M', 'V', 'C', 'A', 'C', 'H', 'E', '\0' };
+
+struct FileHeader {
+	char magic[8];
+	unsigned int version;
+	unsigned int flags;/* assimp import flags */
+	unsigned long long sourceSize;
+	long long sourceTime;/* modification time of source file in ns */
+	unsigned int pathLength, materialNum, meshNum, format;
+	float center[3], maxDistance;
+	unsigned int options;
+	float weldEpsilon;/* 0 in files older than welding, which were not welded */
+	unsigned int reserved[2];
+};
+
+struct MaterialRecord {
+	float color[3];
+	unsigned int pathLength;/* followed by path, padded to 4 bytes */
+};
+
+size_t align(size_t offset, size_t alignment) {
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+/* FNV-1a over 8 bytes at a time, converted data is a multiple of 4 bytes */
+unsigned long long hashData(const void *data, size_t bytes, unsigned long long hash) {
+	const unsigned char *bytePointer = (const unsigned char *)data;
+	size_t words = bytes / 8;
+	for (size_t i = 0; i < words; i++) {
+		unsigned long long word;
+		memcpy(&word, bytePointer + 8 * i, 8);
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	for (size_t i = 8 * words; i < bytes; i++)
+		hash = (hash ^ bytePointer[i]) * 1099511628211ull;
+	return hash;
+}
+
+}
+
+bool MeshCache::map(const std::string &cachePath) {
+#ifdef _WIN32
+	_file = CreateFileA(cachePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (_file == INVALID_HANDLE_VALUE) {
+		_file = nullptr;
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx((HANDLE)_file, &size) || !size.QuadPart)
+		return false;
+	_mapping = CreateFileMappingA((HANDLE)_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!_mapping)
+		return false;
+	_data = MapViewOfFile((HANDLE)_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!_data)
+		return false;
+	_size = (size_t)size.QuadPart;
+#else
+	int fd = open(cachePath.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat status;
+	if (fstat(fd, &status) || !status.st_size) {
+		close(fd);
+		return false;
+	}
+	void *data = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	/* mapping stays valid after descriptor is closed */
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+	/* whole file is read right away */
+	madvise(data, (size_t)status.st_size, MADV_WILLNEED);
+	_data = data;
+	_size = (size_t)status.st_size;
+#endif
+	return true;
+}
+
+bool MeshCache::create(const std::string &tempPath, size_t size) {
+#ifdef _WIN32
+	/* committed file is renamed while mapped, which needs delete sharing */
+	_file = CreateFileA(tempPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (_file == INVALID_HANDLE_VALUE) {
+		_file = nullptr;
+		return false;
+	}
+	_mapping = CreateFileMappingA((HANDLE)_file, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, NULL);
+	if (!_mapping)
+		return false;
+	_data = MapViewOfFile((HANDLE)_mapping, FILE_MAP_WRITE, 0, 0, 0);
+	if (!_data)
+		return false;
+#else
+	int fd = open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+#ifdef __linux__
+	/* blocks are reserved, a full disk fails here instead of faulting on a write into the mapping */
+	bool sized = !posix_fallocate(fd, 0, (off_t)size);
+#else
+	bool sized = !ftruncate(fd, (off_t)size);
+#endif
+	void *data = sized ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	if (data == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	/* kept open to be synced by commit() */
+	_fd = fd;
+	_data = data;
+#endif
+	/* new file reads as zeros, padding needs no writing */
+	_size = size;
+	return true;
+}
+
+void MeshCache::unmap() {
+#ifdef _WIN32
+	if (_data != nullptr)
+		UnmapViewOfFile(_data);
+	if (_mapping != nullptr)
+		CloseHandle((HANDLE)_mapping);
+	if (_file != nullptr)
+		CloseHandle((HANDLE)_file);
+	_file = _mapping = nullptr;
+#else
+	if (_data != nullptr)
+		munmap(_data, _size);
+	if (_fd >= 0)
+		close(_fd);
+	_fd = -1;
+#endif
+	_data = nullptr;
+	_size = 0;
+}
+
+bool MeshCache::parse(const std::string &path, unsigned int flags, VertexFormat format, unsigned int options, float weldEpsilon) {
+	const char *data = (const char *)_data;
+	if (_size < sizeof(FileHeader))
+		return false;
+	FileHeader header;
+	memcpy(&header, data, sizeof(FileHeader));
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION || header.flags != flags || header.format != (unsigned int)format)
+		return false;
+	if (header.options != options || header.weldEpsilon != weldEpsilon)
+		return false;
+
+	/* cache is stale if source file changed */
+	unsigned long long sourceSize;
+	long long sourceTime;
+	if (!FileWatcher::identity(path, sourceSize, sourceTime))
+		return false;
+	if (header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+		return false;
+
+	size_t offset = sizeof(FileHeader);
+	if (offset + header.pathLength > _size || path != std::string(data + offset, header.pathLength))
+		return false;
+	offset = align(offset + header.pathLength, 4);
+
+	_materials.resize(header.materialNum);
+	for (unsigned int i = 0; i < header.materialNum; i++) {
+		MaterialRecord record;
+		if (offset + sizeof(MaterialRecord) > _size)
+			return false;
+		memcpy(&record, data + offset, sizeof(MaterialRecord));
+		offset += sizeof(MaterialRecord);
+		if (offset + record.pathLength > _size)
+			return false;
+		_materials[i].color = aiColor3D(record.color[0], record.color[1], record.color[2]);
+		_materials[i].texturePath.assign(data + offset, record.pathLength);
+		offset = align(offset + record.pathLength, 4);
+	}
+
+	offset = align(offset, 16);
+	if (offset + header.meshNum * sizeof(MeshEntry) > _size)
+		return false;
+	_meshes = (const MeshEntry *)(data + offset);
+	_meshNum = header.meshNum;
+	_format = format;
+	for (unsigned int i = 0; i < _meshNum; i++) {
+		const MeshEntry &mesh = _meshes[i];
+		if (mesh.materialIndex >= header.materialNum)
+			return false;
+		if (mesh.vertexOffset + Mesh::vertexDataSize(getMeshInfo(i)) > _size)
+			return false;
+		if (!mesh.lodNum || mesh.lodNum > MAX_LOD_NUM || mesh.lodFaceNum[0] != mesh.faceNum)
+			return false;
+		if (mesh.indexOffset + Mesh::indexNum(getMeshInfo(i)) * sizeof(GLuint) > _size)
+			return false;
+	}
+
+	_center = glm::vec3(header.center[0], header.center[1], header.center[2]);
+	_maxDistance = header.maxDistance;
+	return true;
+}
+
+MeshCache::MeshCache(const std::string &path, unsigned int flags, VertexFormat format, unsigned int options, float weldEpsilon) {
+	_exist = false;
+	_data = nullptr;
+	_size = 0;
+#ifdef _WIN32
+	_file = _mapping = nullptr;
+#else
+	_fd = -1;
+#endif
+	_format = format;
+	_meshes = nullptr;
+	_meshNum = 0;
+	_center = glm::vec3(0.f, 0.f, 0.f);
+	_maxDistance = 0.f;
+
+	if (!map(cachePath(path)) || !parse(path, flags, format, options, weldEpsilon)) {
+		unmap();
+		_materials.clear();
+		_meshes = nullptr;
+		_meshNum = 0;
+		return;
+	}
+	_exist = true;
+}
+
+MeshCache::MeshCache(const std::string &path, unsigned int flags, VertexFormat format, unsigned int options, float weldEpsilon, const aiScene *scene,
+	const std::vector<MeshInfo> &infos, const std::vector<Material> &materials, const glm::vec3 &center, GLfloat maxDistance) {
+	_exist = false;
+	_data = nullptr;
+	_size = 0;
+#ifdef _WIN32
+	_file = _mapping = nullptr;
+#else
+	_fd = -1;
+#endif
+	_format = format;
+	_meshes = nullptr;
+	_meshNum = 0;
+	_center = center;
+	_maxDistance = maxDistance;
+
+	FileHeader header;
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.flags = flags;
+	if (!FileWatcher::identity(path, header.sourceSize, header.sourceTime))
+		return;
+	header.pathLength = (unsigned int)path.size();
+	header.materialNum = (unsigned int)materials.size();
+	header.meshNum = scene->mNumMeshes;
+	header.format = (unsigned int)format;
+	header.center[0] = center[0];
+	header.center[1] = center[1];
+	header.center[2] = center[2];
+	header.maxDistance = maxDistance;
+	header.options = options;
+	header.weldEpsilon = weldEpsilon;
+	header.reserved[0] = header.reserved[1] = 0;
+
+	/* lay out file before creating it */
+	size_t offset = align(sizeof(FileHeader) + path.size(), 4);
+	for (size_t i = 0; i < materials.size(); i++)
+		offset = align(offset + sizeof(MaterialRecord) + materials[i].texturePath.size(), 4);
+	size_t tableOffset = align(offset, 16);
+	offset = tableOffset + scene->mNumMeshes * sizeof(MeshEntry);
+	std::vector<MeshEntry> table(scene->mNumMeshes);
+	for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+		const aiMesh *mesh = scene->mMeshes[i];
+		table[i].vertexNum = mesh->mNumVertices;
+		table[i].faceNum = mesh->mNumFaces;
+		table[i].materialIndex = mesh->mMaterialIndex;
+		table[i].texCoords = infos[i].texCoords ? 1 : 0;
+		for (int j = 0; j < 3; j++) {
+			table[i].boundsMin[j] = infos[i].boundsMin[j];
+			table[i].boundsMax[j] = infos[i].boundsMax[j];
+			table[i].aabbMin[j] = infos[i].aabbMin[j];
+			table[i].aabbMax[j] = infos[i].aabbMax[j];
+		}
+		table[i].lodNum = infos[i].lodNum;
+		memcpy(table[i].lodFaceNum, infos[i].lodFaceNum, sizeof(table[i].lodFaceNum));
+		table[i].hash = 0;
+		table[i].vertexOffset = offset = align(offset, 16);
+		offset += Mesh::vertexDataSize(infos[i]);
+		table[i].indexOffset = offset = align(offset, 16);
+		offset += Mesh::indexNum(infos[i]) * sizeof(GLuint);
+	}
+
+	/* written into temporary file so that a partial cache is never mapped, processes importing the same
+	   model at once write files of their own */
+	static std::atomic<unsigned int> tempCounter(0);
+	std::ostringstream tempFile;
+#ifdef _WIN32
+	tempFile << cachePath(path) << "." << GetCurrentProcessId() << "." << tempCounter++ << ".tmp";
+#else
+	tempFile << cachePath(path) << "." << getpid() << "." << tempCounter++ << ".tmp";
+#endif
+	if (!create(tempFile.str(), offset)) {
+		unmap();
+		std::remove(tempFile.str().c_str());
+		return;
+	}
+	_writePath = cachePath(path);
+	_tempPath = tempFile.str();
+	char *data = (char *)_data;
+	memcpy(data, &header, sizeof(FileHeader));
+	memcpy(data + sizeof(FileHeader), path.data(), path.size());
+	offset = align(sizeof(FileHeader) + path.size(), 4);
+	for (size_t i = 0; i < materials.size(); i++) {
+		MaterialRecord record;
+		record.color[0] = materials[i].color.r;
+		record.color[1] = materials[i].color.g;
+		record.color[2] = materials[i].color.b;
+		record.pathLength = (unsigned int)materials[i].texturePath.size();
+		memcpy(data + offset, &record, sizeof(MaterialRecord));
+		memcpy(data + offset + sizeof(MaterialRecord), materials[i].texturePath.data(), record.pathLength);
+		offset = align(offset + sizeof(MaterialRecord) + record.pathLength, 4);
+	}
+	if (!table.empty())
+		memcpy(data + tableOffset, &table[0], table.size() * sizeof(MeshEntry));
+
+	_materials = materials;
+	_meshes = (const MeshEntry *)(data + tableOffset);
+	_meshNum = scene->mNumMeshes;
+	_exist = true;
+}
+
+MeshCache::~MeshCache() {
+	unmap();
+	if (!_tempPath.empty())
+		std::remove(_tempPath.c_str());
+}
+
+bool MeshCache::empty() const { return !_exist; }
+
+const std::vector<MeshCache::Material> & MeshCache::getMaterials() const { return _materials; }
+
+unsigned int MeshCache::getMeshNum() const { return _meshNum; }
+
+const MeshCache::MeshEntry & MeshCache::getMesh(unsigned int i) const { return _meshes[i]; }
+
+MeshInfo MeshCache::getMeshInfo(unsigned int i) const {
+	const MeshEntry &mesh = _meshes[i];
+	MeshInfo info;
+	info.format = _format;
+	info.texCoords = (mesh.texCoords != 0);
+	info.vertexNum = mesh.vertexNum;
+	info.faceNum = mesh.faceNum;
+	info.boundsMin = glm::vec3(mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2]);
+	info.boundsMax = glm::vec3(mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2]);
+	info.aabbMin = glm::vec3(mesh.aabbMin[0], mesh.aabbMin[1], mesh.aabbMin[2]);
+	info.aabbMax = glm::vec3(mesh.aabbMax[0], mesh.aabbMax[1], mesh.aabbMax[2]);
+	info.lodNum = mesh.lodNum;
+	memcpy(info.lodFaceNum, mesh.lodFaceNum, sizeof(info.lodFaceNum));
+	return info;
+}
+
+const void * MeshCache::getVertexData(unsigned int i) const {
+	return (const char *)_data + _meshes[i].vertexOffset;
+}
+
+const GLuint * MeshCache::getIndices(unsigned int i) const {
+	return (const GLuint *)((const char *)_data + _meshes[i].indexOffset);
+}
+
+const glm::vec3 & MeshCache::getCenter() const { return _center; }
+
+GLfloat MeshCache::getMaxDistance() const { return _maxDistance; }
+
+void * MeshCache::getVertexTarget(unsigned int i) {
+	return (char *)_data + _meshes[i].vertexOffset;
+}
+
+GLuint * MeshCache::getIndexTarget(unsigned int i) {
+	return (GLuint *)((char *)_data + _meshes[i].indexOffset);
+}
+
+bool MeshCache::commit() {
+	if (_writePath.empty())
+		return false;
+	/* hashes are known once data is converted */
+	MeshEntry *table = (MeshEntry *)_meshes;
+	for (unsigned int i = 0; i < _meshNum; i++) {
+		MeshInfo info = getMeshInfo(i);
+		table[i].hash = hashData(getIndices(i), Mesh::indexNum(info) * sizeof(GLuint),
+			hashData(getVertexData(i), Mesh::vertexDataSize(info), 14695981039346656037ull));
+	}
+	/* data is on disk before the name is, a crash never leaves a cache with valid header and partial body */
+#ifdef _WIN32
+	if (!FlushViewOfFile(_data, 0) || !FlushFileBuffers((HANDLE)_file))
+		return false;
+	bool moved = MoveFileExA(_tempPath.c_str(), _writePath.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	if (msync(_data, _size, MS_SYNC) || fsync(_fd))
+		return false;
+	/* mapping follows the file, pages written so far are what later loads read */
+	bool moved = !std::rename(_tempPath.c_str(), _writePath.c_str());
+#endif
+	if (!moved)
+		return false;
+	_writePath.clear();
+	_tempPath.clear();
+	return true;
+}
+
+std::string MeshCache::cachePath(const std::string &path) {
+	return path + ".mvcache";
+}
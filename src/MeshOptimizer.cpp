@@ -0,0 +1,496 @@
+#include "MeshOptimizer.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/* tuning of Forsyth, cache is modelled as LRU of this size */
+const int CACHE_SIZE = 32;
+const float CACHE_DECAY_POWER = 1.5f;
+const float LAST_TRIANGLE_SCORE = .75f;
+const float VALENCE_BOOST_SCALE = 2.f;
+const float VALENCE_BOOST_POWER = .5f;
+const size_t NO_TRIANGLE = ~(size_t)0;
+
+/* scores of cache positions and of valences, powers are too slow to compute per vertex update */
+struct ScoreTables {
+	float position[CACHE_SIZE];
+	float valence[64];
+
+	ScoreTables() {
+		/* vertices used by last triangle score a fixed value, so that it does not matter in which order they were added */
+		for (int i = 0; i < CACHE_SIZE; i++)
+			position[i] = i < 3 ? LAST_TRIANGLE_SCORE : std::pow(1.f - (i - 3) / float(CACHE_SIZE - 3), CACHE_DECAY_POWER);
+		/* vertices with few triangles left are finished first, they would stay in the way otherwise */
+		for (int i = 1; i < 64; i++)
+			valence[i] = VALENCE_BOOST_SCALE * std::pow((float)i, -VALENCE_BOOST_POWER);
+		valence[0] = 0.f;
+	}
+};
+
+float vertexScore(const ScoreTables &tables, int cachePosition, unsigned int remaining) {
+	if (!remaining)
+		return -1.f;
+	float score = cachePosition >= 0 ? tables.position[cachePosition] : 0.f;
+	return score + (remaining < 64 ? tables.valence[remaining] : VALENCE_BOOST_SCALE * std::pow((float)remaining, -VALENCE_BOOST_POWER));
+}
+
+/* reorder array of vertex attribute by remap, in place because assimp owns the allocation */
+template <typename T>
+void permute(T *array, const std::vector<GLuint> &remap) {
+	if (array == nullptr)
+		return;
+	std::vector<T> ordered(remap.size());
+	for (size_t i = 0; i < remap.size(); i++)
+		ordered[remap[i]] = array[i];
+	std::copy(ordered.begin(), ordered.end(), array);
+}
+
+}
+
+VertexCacheStats analyzeVertexCache(const std::vector<GLuint> &indices, unsigned int vertexNum, unsigned int cacheSize) {
+	VertexCacheStats stats = { 0.f, 0.f };
+	if (indices.size() < 3)
+		return stats;
+	/* vertex is in FIFO cache while fewer than cacheSize vertices were added after it */
+	std::vector<unsigned int> added(vertexNum, 0);
+	unsigned int time = cacheSize + 1, misses = 0, used = 0;
+	for (size_t i = 0; i < indices.size(); i++) {
+		GLuint v = indices[i];
+		if (!added[v])
+			++used;
+		if (time - added[v] > cacheSize) {
+			added[v] = time++;
+			++misses;
+		}
+	}
+	stats.acmr = (float)misses / (indices.size() / 3);
+	stats.atvr = (float)misses / used;
+	return stats;
+}
+
+void optimizeVertexCache(std::vector<GLuint> &indices, unsigned int vertexNum) {
+	size_t triangleNum = indices.size() / 3;
+	if (triangleNum < 2)
+		return;
+
+	/* triangles of each vertex not emitted yet, as a compact list per vertex */
+	std::vector<unsigned int> remaining(vertexNum, 0), offsets(vertexNum + 1, 0);
+	for (size_t i = 0; i < 3 * triangleNum; i++)
+		++remaining[indices[i]];
+	for (unsigned int v = 0; v < vertexNum; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+	std::vector<size_t> adjacency(3 * triangleNum);
+	std::vector<unsigned int> filled(vertexNum, 0);
+	for (size_t i = 0; i < 3 * triangleNum; i++) {
+		GLuint v = indices[i];
+		adjacency[offsets[v] + filled[v]++] = i / 3;
+	}
+
+	static const ScoreTables tables;
+	std::vector<int> cachePosition(vertexNum, -1);
+	std::vector<float> vertexScores(vertexNum), triangleScores(triangleNum);
+	for (unsigned int v = 0; v < vertexNum; v++)
+		vertexScores[v] = vertexScore(tables, -1, remaining[v]);
+	size_t best = 0;
+	for (size_t t = 0; t < triangleNum; t++) {
+		triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+		if (triangleScores[t] > triangleScores[best])
+			best = t;
+	}
+
+	std::vector<char> emitted(triangleNum, 0);
+	std::vector<GLuint> optimized;
+	optimized.reserve(3 * triangleNum);
+	GLuint cache[CACHE_SIZE + 3], nextCache[CACHE_SIZE + 3];
+	int cacheNum = 0;
+	size_t cursor = 0;
+	for (size_t n = 0; n < triangleNum; n++) {
+		/* nothing adjacent to cache is left, continue at first triangle not emitted */
+		if (best == NO_TRIANGLE) {
+			while (emitted[cursor])
+				++cursor;
+			best = cursor;
+		}
+		emitted[best] = 1;
+		const GLuint *triangle = &indices[3 * best];
+		optimized.insert(optimized.end(), triangle, triangle + 3);
+
+		int nextNum = 0;
+		for (int k = 0; k < 3; k++) {
+			GLuint v = triangle[k];
+			size_t *list = &adjacency[offsets[v]];
+			unsigned int count = remaining[v];
+			for (unsigned int j = 0; j < count; j++)
+				if (list[j] == best) {
+					std::swap(list[j], list[count - 1]);
+					break;
+				}
+			--remaining[v];
+			if (std::find(nextCache, nextCache + nextNum, v) == nextCache + nextNum)
+				nextCache[nextNum++] = v;
+		}
+		for (int i = 0; i < cacheNum; i++)
+			if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+				nextCache[nextNum++] = cache[i];
+
+		/* vertices pushed out of cache lose their position */
+		for (int i = 0; i < nextNum; i++) {
+			GLuint v = nextCache[i];
+			cachePosition[v] = i < CACHE_SIZE ? i : -1;
+			vertexScores[v] = vertexScore(tables, cachePosition[v], remaining[v]);
+		}
+		best = NO_TRIANGLE;
+		float bestScore = -1.f;
+		for (int i = 0; i < nextNum; i++) {
+			GLuint v = nextCache[i];
+			const size_t *list = &adjacency[offsets[v]];
+			for (unsigned int j = 0; j < remaining[v]; j++) {
+				size_t t = list[j];
+				float score = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+				triangleScores[t] = score;
+				if (score > bestScore) {
+					bestScore = score;
+					best = t;
+				}
+			}
+		}
+		cacheNum = std::min(nextNum, CACHE_SIZE);
+		std::copy(nextCache, nextCache + cacheNum, cache);
+	}
+	indices.swap(optimized);
+}
+
+void optimizeOverdraw(std::vector<GLuint> &indices, const aiVector3D *positions) {
+	size_t triangleNum = indices.size() / 3;
+	if (triangleNum < 2)
+		return;
+
+	/* cluster boundaries where all vertices of a triangle miss a 16 entries FIFO cache, so
+	   that reordering clusters costs little cache efficiency */
+	const unsigned int cacheSize = 16;
+	GLuint vertexNum = *std::max_element(indices.begin(), indices.end()) + 1;
+	std::vector<unsigned int> added(vertexNum, 0);
+	unsigned int time = cacheSize + 1;
+	std::vector<size_t> clusters;
+	for (size_t t = 0; t < triangleNum; t++) {
+		int misses = 0;
+		for (int k = 0; k < 3; k++) {
+			GLuint v = indices[3 * t + k];
+			if (time - added[v] > cacheSize) {
+				added[v] = time++;
+				++misses;
+			}
+		}
+		if (misses == 3)
+			clusters.push_back(t);
+	}
+	if (clusters.size() < 2)
+		return;
+	clusters.push_back(triangleNum);
+
+	/* area weighted centroid and normal of whole mesh and of each cluster */
+	size_t clusterNum = clusters.size() - 1;
+	std::vector<aiVector3D> centroids(clusterNum), normals(clusterNum);
+	std::vector<float> areas(clusterNum, 0.f);
+	aiVector3D meshCentroid(0.f, 0.f, 0.f);
+	float meshArea = 0.f;
+	for (size_t c = 0; c < clusterNum; c++) {
+		for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+			const aiVector3D &a = positions[indices[3 * t]], &b = positions[indices[3 * t + 1]], &d = positions[indices[3 * t + 2]];
+			aiVector3D normal = (b - a) ^ (d - a);
+			float area = normal.Length();
+			centroids[c] += (a + b + d) * (area / 3.f);
+			normals[c] += normal;
+			areas[c] += area;
+		}
+		meshCentroid += centroids[c];
+		meshArea += areas[c];
+		if (areas[c] > 0.f)
+			centroids[c] /= areas[c];
+	}
+	if (meshArea > 0.f)
+		meshCentroid /= meshArea;
+
+	/* clusters far out along their normal are in front of the rest from most directions */
+	std::vector<float> keys(clusterNum);
+	std::vector<size_t> order(clusterNum);
+	for (size_t c = 0; c < clusterNum; c++) {
+		float length = normals[c].Length();
+		keys[c] = length > 0.f ? (centroids[c] - meshCentroid) * normals[c] / length : 0.f;
+		order[c] = c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+	std::vector<GLuint> sorted;
+	sorted.reserve(indices.size());
+	for (size_t i = 0; i < clusterNum; i++) {
+		size_t c = order[i];
+		sorted.insert(sorted.end(), indices.begin() + 3 * clusters[c], indices.begin() + 3 * clusters[c + 1]);
+	}
+	indices.swap(sorted);
+}
+
+std::vector<GLuint> optimizeVertexFetch(std::vector<GLuint> &indices, unsigned int vertexNum) {
+	std::vector<GLuint> remap(vertexNum, ~0u);
+	GLuint next = 0;
+	for (size_t i = 0; i < indices.size(); i++) {
+		GLuint &v = indices[i];
+		if (remap[v] == ~0u)
+			remap[v] = next++;
+		v = remap[v];
+	}
+	/* vertices of no triangle go last */
+	for (unsigned int v = 0; v < vertexNum; v++)
+		if (remap[v] == ~0u)
+			remap[v] = next++;
+	return remap;
+}
+
+void optimizeMesh(aiMesh *mesh, bool overdraw, VertexCacheStats &before, VertexCacheStats &after) {
+	std::vector<GLuint> indices;
+	indices.reserve(3 * (size_t)mesh->mNumFaces);
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+		if (mesh->mFaces[i].mNumIndices == 3)
+			indices.insert(indices.end(), mesh->mFaces[i].mIndices, mesh->mFaces[i].mIndices + 3);
+	before = analyzeVertexCache(indices, mesh->mNumVertices);
+	after = before;
+	if (indices.size() < 6)
+		return;
+
+	optimizeVertexCache(indices, mesh->mNumVertices);
+	if (overdraw)
+		optimizeOverdraw(indices, mesh->mVertices);
+	std::vector<GLuint> remap = optimizeVertexFetch(indices, mesh->mNumVertices);
+	after = analyzeVertexCache(indices, mesh->mNumVertices);
+
+	/* triangles take the places of triangles, other faces only follow vertices */
+	size_t next = 0;
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+		aiFace &face = mesh->mFaces[i];
+		if (face.mNumIndices == 3) {
+			std::copy(indices.begin() + next, indices.begin() + next + 3, face.mIndices);
+			next += 3;
+		} else
+			for (unsigned int j = 0; j < face.mNumIndices; j++)
+				face.mIndices[j] = remap[face.mIndices[j]];
+	}
+
+	permute(mesh->mVertices, remap);
+	permute(mesh->mNormals, remap);
+	permute(mesh->mTangents, remap);
+	permute(mesh->mBitangents, remap);
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_COLOR_SETS; i++)
+		permute(mesh->mColors[i], remap);
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; i++)
+		permute(mesh->mTextureCoords[i], remap);
+	for (unsigned int i = 0; i < mesh->mNumBones; i++)
+		for (unsigned int j = 0; j < mesh->mBones[i]->mNumWeights; j++)
+			mesh->mBones[i]->mWeights[j].mVertexId = remap[mesh->mBones[i]->mWeights[j].mVertexId];
+	for (unsigned int i = 0; i < mesh->mNumAnimMeshes; i++) {
+		aiAnimMesh *anim = mesh->mAnimMeshes[i];
+		if (anim->mNumVertices != mesh->mNumVertices)
+			continue;
+		permute(anim->mVertices, remap);
+		permute(anim->mNormals, remap);
+		permute(anim->mTangents, remap);
+		permute(anim->mBitangents, remap);
+		for (unsigned int j = 0; j < AI_MAX_NUMBER_OF_COLOR_SETS; j++)
+			permute(anim->mColors[j], remap);
+		for (unsigned int j = 0; j < AI_MAX_NUMBER_OF_TEXTURECOORDS; j++)
+			permute(anim->mTextureCoords[j], remap);
+	}
+}
+
+namespace {
+
+const size_t WELD_CHUNK = 16384;/* vertices or faces of one welding task */
+const unsigned int WELD_PARTITION_BITS = 6;/* hash partitions matched in parallel */
+
+/* cells of position, normal and first texture coords */
+struct WeldKey {
+	int cells[8];
+
+	bool operator==(const WeldKey &other) const {
+		return std::equal(cells, cells + 8, other.cells);
+	}
+};
+
+/* nearest cell, faster than lround, which is a library call. values too far for int share the last cell, non finite ones cell 0 */
+inline int cell(float value, float scale) {
+	float scaled = value * scale;
+	if (!(std::fabs(scaled) < 2e9f))
+		return scaled > 0.f ? 2000000000 : scaled < 0.f ? -2000000000 : 0;
+	return (int)(scaled >= 0.f ? scaled + .5f : scaled - .5f);
+}
+
+WeldKey weldKey(const aiMesh *mesh, unsigned int v, float scale) {
+	WeldKey key;
+	key.cells[0] = cell(mesh->mVertices[v].x, scale);
+	key.cells[1] = cell(mesh->mVertices[v].y, scale);
+	key.cells[2] = cell(mesh->mVertices[v].z, scale);
+	const aiVector3D *normal = mesh->mNormals != nullptr ? &mesh->mNormals[v] : nullptr;
+	key.cells[3] = normal != nullptr ? cell(normal->x, scale) : 0;
+	key.cells[4] = normal != nullptr ? cell(normal->y, scale) : 0;
+	key.cells[5] = normal != nullptr ? cell(normal->z, scale) : 0;
+	const aiVector3D *uv = mesh->mTextureCoords[0] != nullptr ? &mesh->mTextureCoords[0][v] : nullptr;
+	key.cells[6] = uv != nullptr ? cell(uv->x, scale) : 0;
+	key.cells[7] = uv != nullptr ? cell(uv->y, scale) : 0;
+	return key;
+}
+
+unsigned long long weldHash(const WeldKey &key) {
+	/* 64 bit FNV-1a over cells, then mixed so that top bits pick partitions well */
+	unsigned long long hash = 14695981039346656037ull;
+	for (int i = 0; i < 8; i++) {
+		hash ^= (unsigned int)key.cells[i];
+		hash *= 1099511628211ull;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+/* vertex with its key */
+struct WeldEntry {
+	WeldKey key;
+	unsigned long long hash;
+	GLuint vertex;
+};
+
+/* attributes outside key must match exactly */
+bool sameAttributes(const aiMesh *mesh, unsigned int a, unsigned int b) {
+	if (mesh->mTangents != nullptr && (mesh->mTangents[a] != mesh->mTangents[b] || mesh->mBitangents[a] != mesh->mBitangents[b]))
+		return false;
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_COLOR_SETS; i++)
+		if (mesh->mColors[i] != nullptr && mesh->mColors[i][a] != mesh->mColors[i][b])
+			return false;
+	for (unsigned int i = 1; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; i++)
+		if (mesh->mTextureCoords[i] != nullptr && mesh->mTextureCoords[i][a] != mesh->mTextureCoords[i][b])
+			return false;
+	return true;
+}
+
+/* keep vertices listed in kept, in their order, at the front of array */
+template <typename T>
+void compact(T *array, const std::vector<GLuint> &kept) {
+	if (array == nullptr)
+		return;
+	std::vector<T> gathered(kept.size());
+	ThreadPool::shared().parallelFor((kept.size() + WELD_CHUNK - 1) / WELD_CHUNK, [&](size_t chunk) {
+		size_t end = std::min(kept.size(), (chunk + 1) * WELD_CHUNK);
+		for (size_t i = chunk * WELD_CHUNK; i < end; i++)
+			gathered[i] = array[kept[i]];
+	});
+	std::copy(gathered.begin(), gathered.end(), array);
+}
+
+}
+
+unsigned int weldVertices(aiMesh *mesh, float epsilon) {
+	unsigned int vertexNum = mesh->mNumVertices;
+	if (epsilon <= 0.f || vertexNum < 2 || mesh->mNumBones || mesh->mNumAnimMeshes)
+		return vertexNum;
+	ThreadPool &pool = ThreadPool::shared();
+	const float scale = 1.f / epsilon;
+	const size_t chunkNum = (vertexNum + WELD_CHUNK - 1) / WELD_CHUNK;
+	/* one partition for a mesh handled by one task, partitioning would only cost */
+	const unsigned int partitionBits = chunkNum > 1 ? WELD_PARTITION_BITS : 0;
+	const size_t partitionNum = (size_t)1 << partitionBits;
+	const unsigned int partitionShift = 64 - partitionBits;
+	std::vector<size_t> counts(chunkNum * partitionNum, 0);/* vertices of each chunk in each partition, then write offsets */
+
+	/* count vertices per partition, keys are computed again below rather than stored twice */
+	pool.parallelFor(chunkNum, [&](size_t chunk) {
+		size_t end = std::min((size_t)vertexNum, (chunk + 1) * WELD_CHUNK);
+		size_t *chunkCounts = &counts[chunk * partitionNum];
+		for (size_t v = chunk * WELD_CHUNK; v < end; v++)
+			++chunkCounts[partitionBits ? weldHash(weldKey(mesh, (unsigned int)v, scale)) >> partitionShift : 0];
+	});
+
+	/* partitions keep vertex order, chunks of a partition follow each other */
+	std::vector<size_t> partitionBegin(partitionNum + 1, 0);
+	size_t offset = 0;
+	for (size_t p = 0; p < partitionNum; p++) {
+		partitionBegin[p] = offset;
+		for (size_t chunk = 0; chunk < chunkNum; chunk++) {
+			size_t count = counts[chunk * partitionNum + p];
+			counts[chunk * partitionNum + p] = offset;
+			offset += count;
+		}
+	}
+	partitionBegin[partitionNum] = offset;
+	/* keys travel with vertices, matching reads its partition only */
+	std::vector<WeldEntry> order(vertexNum);
+	pool.parallelFor(chunkNum, [&](size_t chunk) {
+		size_t end = std::min((size_t)vertexNum, (chunk + 1) * WELD_CHUNK);
+		size_t *offsets = &counts[chunk * partitionNum];
+		for (size_t v = chunk * WELD_CHUNK; v < end; v++) {
+			WeldEntry entry;
+			entry.key = weldKey(mesh, (unsigned int)v, scale);
+			entry.hash = weldHash(entry.key);
+			entry.vertex = (GLuint)v;
+			order[offsets[partitionBits ? entry.hash >> partitionShift : 0]++] = entry;
+		}
+	});
+
+	/* first vertex of each class in a partition represents it, open addressing on hash over entries of partition */
+	std::vector<GLuint> representative(vertexNum);
+	pool.parallelFor(partitionNum, [&](size_t p) {
+		size_t begin = partitionBegin[p], end = partitionBegin[p + 1];
+		size_t tableSize = 16;
+		while (tableSize < 2 * (end - begin))
+			tableSize *= 2;
+		std::vector<GLuint> table(tableSize, ~0u);
+		for (size_t i = begin; i < end; i++) {
+			const WeldEntry &entry = order[i];
+			for (size_t slot = entry.hash & (tableSize - 1);; slot = (slot + 1) & (tableSize - 1)) {
+				if (table[slot] == ~0u) {
+					table[slot] = (GLuint)i;
+					representative[entry.vertex] = entry.vertex;
+					break;
+				}
+				const WeldEntry &other = order[table[slot]];
+				if (other.hash == entry.hash && other.key == entry.key && sameAttributes(mesh, entry.vertex, other.vertex)) {
+					representative[entry.vertex] = other.vertex;
+					break;
+				}
+			}
+		}
+	});
+
+	/* representatives come first in their class, so numbering in vertex order is one pass */
+	std::vector<GLuint> remap(vertexNum), kept;
+	kept.reserve(vertexNum);
+	for (unsigned int v = 0; v < vertexNum; v++) {
+		if (representative[v] == v) {
+			remap[v] = (GLuint)kept.size();
+			kept.push_back(v);
+		} else
+			remap[v] = remap[representative[v]];
+	}
+	if (kept.size() == vertexNum)
+		return vertexNum;
+
+	pool.parallelFor((mesh->mNumFaces + WELD_CHUNK - 1) / WELD_CHUNK, [&](size_t chunk) {
+		size_t end = std::min((size_t)mesh->mNumFaces, (chunk + 1) * WELD_CHUNK);
+		for (size_t i = chunk * WELD_CHUNK; i < end; i++) {
+			aiFace &face = mesh->mFaces[i];
+			for (unsigned int j = 0; j < face.mNumIndices; j++)
+				face.mIndices[j] = remap[face.mIndices[j]];
+		}
+	});
+	compact(mesh->mVertices, kept);
+	compact(mesh->mNormals, kept);
+	compact(mesh->mTangents, kept);
+	compact(mesh->mBitangents, kept);
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_COLOR_SETS; i++)
+		compact(mesh->mColors[i], kept);
+	for (unsigned int i = 0; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; i++)
+		compact(mesh->mTextureCoords[i], kept);
+	/* arrays keep their allocation, assimp frees them by pointer */
+	mesh->mNumVertices = (unsigned int)kept.size();
+	return mesh->mNumVertices;
+}
@@ -1,85 +1,457 @@
 #include "Model.h"
+#include "FrameProfiler.h"
+#include "MeshOptimizer.h"
+#include "ThreadPool.h"
 #include <assimp/Importer.hpp>
 #include <assimp/Exporter.hpp>
 #include <assimp/postprocess.h>
 #include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 #define __DEBUG__
 
-void Model::loadTextures(const aiScene *scene, const std::string &path) {
-	_textureNum = scene->mNumMaterials;
-	_textures = new GLuint[_textureNum];
-	_colors = new aiColor3D[_textureNum];
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/* streamed textures show levels up to this size at once, finer ones follow */
+const int STREAM_FIRST_SIZE = 64;
+
+double elapsed(const Clock::time_point &begin) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+/* converted meshes waiting for upload beyond this stall the loader */
+const size_t MAX_PENDING_BYTES = 256u << 20;
+
+/* vertices or faces of a mesh converted by one task, large meshes are cut into several */
+const unsigned int CONVERT_CHUNK = 1u << 16;
+
+/* assimp post processing of loads and reloads, part of mesh cache key */
+const unsigned int IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenSmoothNormals | aiProcess_RemoveRedundantMaterials;
+
+/* start measuring peak resident memory from here where the system allows it */
+void resetPeakMemory() {
+#if defined(__linux__)
+	/* writing 5 resets VmHWM, fails silently on old kernels */
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	clearRefs << "5";
+#endif
+}
+
+/* peak resident memory of process in MB */
+double peakMemory() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0.0;
+	return counters.PeakWorkingSetSize / 1048576.0;
+#elif defined(__linux__)
+	/* unlike ru_maxrss, VmHWM follows resetPeakMemory() */
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line))
+		if (line.compare(0, 6, "VmHWM:") == 0)
+			return atof(line.c_str() + 6) / 1024.0;
+	return 0.0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0.0;
+	return usage.ru_maxrss / 1048576.0;/* bytes on macOS */
+#endif
+}
+
+}
+
+/* texture image decoded by a worker, ready for upload */
+struct Model::DecodedTexture {
+	size_t materialIndex;
+	cv::Mat image;/* empty when compressed */
+	std::vector<cv::Mat> levels;/* mip chain of image when it streams, first one is image */
+	GLenum format;
+	TextureCache *compressed;/* levels read from texture cache or just encoded */
+	GLuint shared;/* image is on GPU already, loader took a reference of it in texture library */
+	bool reload;/* image changed on disk, goes into texture of material again */
+	double decodeTime;/* ms */
+	double encodeTime;
+
+	DecodedTexture();
+	~DecodedTexture();
+
+	/* mip levels of full chain */
+	unsigned int levelNum() const;
+	/* GPU bytes of chain without its skip finest levels */
+	size_t bytes(unsigned int skip) const;
+	/* build mip chain of image on CPU */
+	void buildLevels();
+	/* every level is at hand for streaming */
+	bool streamable() const;
+	/* size of a level of streamable chain */
+	void levelSize(unsigned int level, int &width, int &height) const;
+	/* bytes of a level of streamable chain as kept on CPU */
+	size_t levelBytes(unsigned int level) const;
+};
+
+/* texture showing its coarse levels while finer ones are uploaded strip by strip */
+struct Model::StreamingTexture {
+	GLuint texture;
+	DecodedTexture *source;/* levels still to upload */
+	unsigned int skip;/* image levels dropped for memory budget, image level skip is texture level 0 */
+	unsigned int base;/* finest texture level uploaded completely */
+	int row;/* rows of texture level base - 1 uploaded so far */
+};
+
+Model::DecodedTexture::DecodedTexture() {
+	materialIndex = 0;
+	format = 0;
+	compressed = nullptr;
+	shared = 0;
+	reload = false;
+	decodeTime = encodeTime = 0.0;
+}
+
+Model::DecodedTexture::~DecodedTexture() {
+	if (compressed != nullptr)
+		delete compressed;
+}
+
+unsigned int Model::DecodedTexture::levelNum() const {
+	if (compressed != nullptr)
+		return compressed->getLevelNum();
+	unsigned int num = 1;
+	for (int size = std::max(image.cols, image.rows); size > 1; size >>= 1)
+		++num;
+	return num;
+}
+
+size_t Model::DecodedTexture::bytes(unsigned int skip) const {
+	if (compressed != nullptr) {
+		size_t sum = 0;
+		for (unsigned int level = skip; level < compressed->getLevelNum(); level++)
+			sum += compressed->getLevel(level).data.size();
+		return sum;
+	}
+	/* mip chain adds a third, drivers pad 3 channels to 4 */
+	return (size_t)std::max(image.cols >> skip, 1) * std::max(image.rows >> skip, 1) * (image.channels() == 1 ? 1 : 4) * 4 / 3;
+}
+
+void Model::DecodedTexture::buildLevels() {
+	unsigned int num = levelNum();
+	levels.assign(1, image);
+	/* halves round down like GL level sizes */
+	for (unsigned int level = 1; level < num; level++) {
+		const cv::Mat &finer = levels.back();
+		cv::Mat coarser;
+		cv::resize(finer, coarser, cv::Size(std::max(finer.cols / 2, 1), std::max(finer.rows / 2, 1)), 0, 0, cv::INTER_AREA);
+		levels.push_back(coarser);
+	}
+}
+
+bool Model::DecodedTexture::streamable() const {
+	return compressed != nullptr || (!levels.empty() && image.isContinuous());
+}
+
+void Model::DecodedTexture::levelSize(unsigned int level, int &width, int &height) const {
+	if (compressed != nullptr) {
+		width = compressed->getLevel(level).width;
+		height = compressed->getLevel(level).height;
+	} else {
+		width = levels[level].cols;
+		height = levels[level].rows;
+	}
+}
+
+size_t Model::DecodedTexture::levelBytes(unsigned int level) const {
+	return compressed != nullptr ? compressed->getLevel(level).data.size() : levels[level].total() * levels[level].elemSize();
+}
+
+/*
+ * mesh on its way to GL. loader queues it, GL thread prepares buffers and maps them,
+ * loader converts into them and marks it ready, GL thread unmaps and adds it.
+ */
+struct Model::PendingMesh {
+	unsigned int index;/* mesh index in scene */
+	unsigned int materialIndex;
+	MeshInfo info;
+	size_t bytes;/* converted size counted against pending limit */
+	bool prepared;/* GL thread has mapped buffers or decided against it */
+	bool ready;/* data is written */
+	Mesh *mesh;/* mesh with mapped buffers, null when data is staged */
+	void *vertexTarget;/* mapped buffers written by loader */
+	GLuint *indexTarget;
+	std::vector<unsigned char> vertexData;/* staged data for arenas or when mapping fails */
+	std::vector<GLuint> indices;
+	const void *mappedVertexData;/* data mapped from cache */
+	const GLuint *mappedIndices;
+
+	PendingMesh(unsigned int index, unsigned int materialIndex, const MeshInfo &info);
+	~PendingMesh();
+};
+
+Model::PendingMesh::PendingMesh(unsigned int index, unsigned int materialIndex, const MeshInfo &info) {
+	this->index = index;
+	this->materialIndex = materialIndex;
+	this->info = info;
+	bytes = 0;
+	prepared = ready = false;
+	mesh = nullptr;
+	vertexTarget = nullptr;
+	indexTarget = nullptr;
+	mappedVertexData = nullptr;
+	mappedIndices = nullptr;
+}
+
+/* deleting buffers of a mesh still mapped unmaps them */
+Model::PendingMesh::~PendingMesh() {
+	if (mesh != nullptr)
+		delete mesh;
+}
+
+std::vector<MeshCache::Material> Model::readMaterials(const aiScene *scene, const std::string &path) {
+	std::vector<MeshCache::Material> materials(scene->mNumMaterials);
 	for (unsigned int i = 0; i < scene->mNumMaterials; i++) {
 		const aiMaterial *material = scene->mMaterials[i];
-		_colors[i] = aiColor3D(.5f, .5f, .5f);
-		material->Get(AI_MATKEY_COLOR_DIFFUSE, _colors[i]);
+		materials[i].color = aiColor3D(.5f, .5f, .5f);
+		material->Get(AI_MATKEY_COLOR_DIFFUSE, materials[i].color);
 		unsigned int diffuseCount = material->GetTextureCount(aiTextureType_DIFFUSE);
-		if (!diffuseCount) {
-			_textures[i] = 0;
+		if (!diffuseCount)
 			continue;
-		}
 		aiString texturePath;
-		if (AI_SUCCESS != material->GetTexture(aiTextureType_DIFFUSE, 0, &texturePath, NULL, NULL, NULL, NULL, NULL)) {
-			_textures[i] = 0;
+		if (AI_SUCCESS != material->GetTexture(aiTextureType_DIFFUSE, 0, &texturePath, NULL, NULL, NULL, NULL, NULL))
 			continue;
-		}
 
-		std::string fullPath;
 		size_t pos;
 		pos = path.find_last_of("/\\");
 		if (pos != std::string::npos)
-			fullPath = path.substr(0, pos + 1) + texturePath.data;
+			materials[i].texturePath = path.substr(0, pos + 1) + texturePath.data;
 		else
-			fullPath = texturePath.data;
+			materials[i].texturePath = texturePath.data;
+	}
+	return materials;
+}
 
-		cv::Mat textureImage = cv::imread(fullPath, cv::IMREAD_UNCHANGED);
-		if (textureImage.empty()) {
-			_textures[i] = 0;
-			continue;
+void Model::decodeTexture(const std::string &fullPath, bool compress, bool stream, DecodedTexture &texture) {
+	Clock::time_point begin = Clock::now();
+	if (compress) {
+		/* compressed levels are ready to upload, source image is not decoded at all */
+		TextureCache *cache = new TextureCache(fullPath);
+		if (!cache->empty()) {
+			texture.compressed = cache;
+			texture.decodeTime = elapsed(begin);
+			return;
 		}
-
-		GLenum format;
-		if (textureImage.channels() == 1)
-			format = GL_RED;
-		else if (textureImage.channels() == 3) {
-			cv::cvtColor(textureImage, textureImage, cv::COLOR_BGR2RGB);
-			format = GL_RGB;
+		delete cache;
+	}
+	texture.image = cv::imread(fullPath, cv::IMREAD_UNCHANGED);
+	if (!texture.image.empty()) {
+		if (texture.image.channels() == 1)
+			texture.format = GL_RED;
+		else if (texture.image.channels() == 3) {
+			cv::cvtColor(texture.image, texture.image, cv::COLOR_BGR2RGB);
+			texture.format = GL_RGB;
 		}
 		else {
-			cv::cvtColor(textureImage, textureImage, cv::COLOR_BGRA2RGBA);
-			format = GL_RGBA;
+			cv::cvtColor(texture.image, texture.image, cv::COLOR_BGRA2RGBA);
+			texture.format = GL_RGBA;
 		}
-		GLuint textureId;
-		glGenTextures(1, &textureId);
-		glBindTexture(GL_TEXTURE_2D, textureId);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, textureImage.cols, textureImage.rows, 0, format, GL_UNSIGNED_BYTE, textureImage.data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		_textures[i] = textureId;
 	}
+	if (!compress || texture.image.empty() || texture.image.depth() != CV_8U) {
+		/* chain is built here so that GL thread only copies levels */
+		if (stream && !texture.image.empty() && texture.image.depth() == CV_8U)
+			texture.buildLevels();
+		texture.decodeTime = elapsed(begin);
+		return;
+	}
+	texture.decodeTime = elapsed(begin);
+
+	begin = Clock::now();
+	TextureCache *cache = new TextureCache(texture.image.data, texture.image.cols, texture.image.rows, texture.image.channels(), texture.image.step);
+	if (cache->empty()) {
+		delete cache;
+		if (stream)
+			texture.buildLevels();
+		return;
+	}
+	if (!cache->write(fullPath))
+		std::cout << "Fail to write texture cache " << TextureCache::cachePath(fullPath) << " ." << std::endl;
+	texture.compressed = cache;
+	texture.image.release();
+	texture.encodeTime = elapsed(begin);
 }
 
-Model::Model(const std::string &path) {
-	/* default value is important because initializer may be interrupted */
-	_exist = false;
-	_errorInfo = "";
-	_textureNum = _vertexNum = 0;
-	_textures = nullptr;
-	_colors = nullptr;
-	_center = glm::vec3(0.f, 0.f, 0.f);
-	_maxDistance = 0.f;
+void Model::load(const std::string &path) {
+	Clock::time_point begin = Clock::now();
+	unsigned int flags = IMPORT_FLAGS;
+	MeshCache *cache = new MeshCache(path, flags, _options.format, cacheOptions(), _options.weldEpsilon);
+	_stats.cacheRead = elapsed(begin);
+	_stats.cached = !cache->empty();
+	bool loaded = true;
+	if (_stats.cached)
+		loadCache(cache);
+	else {
+		delete cache;
+		loaded = loadScene(path, flags);
+	}
 
-	Assimp::Importer importer;
-	unsigned int flags = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenSmoothNormals | aiProcess_RemoveRedundantMaterials;
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!loaded)
+		_loaderError = _errorInfo;
+	_loaderDone = true;
+	++_sequence;
+	_condition.notify_all();
+}
+
+void Model::publishMaterials(const std::vector<MeshCache::Material> &materials) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_materials = materials;
+	_textureKeys.assign(materials.size(), "");
+	for (size_t i = 0; i < materials.size(); i++)
+		if (!materials[i].texturePath.empty())
+			_textureKeys[i] = TextureLibrary::key(materials[i].texturePath);
+	_materialsReady = true;
+	_texturesBegin = Clock::now();
+	++_sequence;
+	_condition.notify_all();
+
+	/* decode on workers, GL thread uploads in the order images become ready */
+	for (size_t i = 0; i < materials.size(); i++) {
+		if (materials[i].texturePath.empty())
+			continue;
+		/* materials showing an image decoded for an earlier one get its texture with it */
+		if (std::find(_textureKeys.begin(), _textureKeys.begin() + i, _textureKeys[i]) != _textureKeys.begin() + i)
+			continue;
+		GLuint shared = TextureLibrary::shared().acquire(_textureKeys[i]);
+		if (shared) {
+			DecodedTexture *texture = new DecodedTexture();
+			texture->materialIndex = i;
+			texture->shared = shared;
+			_decodedTextures.push_back(texture);
+			continue;
+		}
+		++_decodePending;
+		std::string fullPath = materials[i].texturePath;
+		bool compress = _compressTextures;
+		bool stream = _options.progressive && _options.streamTextures;
+		ThreadPool::shared().push([this, i, fullPath, compress, stream] {
+			DecodedTexture *texture = new DecodedTexture();
+			texture->materialIndex = i;
+			decodeTexture(fullPath, compress, stream, *texture);
+			bool failed = texture->image.empty() && texture->compressed == nullptr;
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stats.textureDecode += texture->decodeTime;
+			_stats.textureEncode += texture->encodeTime;
+			if (failed)
+				std::cout << "Fail to read texture " << fullPath << " ." << std::endl;
+			if (_cancel || failed)
+				delete texture;
+			else
+				_decodedTextures.push_back(texture);
+			--_decodePending;
+			++_sequence;
+			_condition.notify_all();
+		});
+	}
+}
+
+void Model::publishPreview(const std::vector<MeshInfo> &infos, const std::vector<unsigned int> &materials) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_preview = infos;
+	_previewMaterials = materials;
+	_previewReady = true;
+	++_sequence;
+	_condition.notify_all();
+}
+
+void Model::publishLayout(const std::vector<MeshInfo> &infos) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_layout = infos;
+	_layoutReady = true;
+	++_sequence;
+	_condition.notify_all();
+}
+
+bool Model::pushMesh(PendingMesh *mesh, bool wait) {
+	/* mapped cache data costs no extra memory */
+	if (mesh->mappedVertexData == nullptr)
+		mesh->bytes = Mesh::vertexDataSize(mesh->info) + Mesh::indexNum(mesh->info) * sizeof(GLuint);
+	size_t bytes = mesh->bytes;
+	std::unique_lock<std::mutex> lock(_mutex);
+	/* a single mesh larger than limit still goes when queue is empty */
+	auto fits = [this, bytes] { return !_pendingBytes || _pendingBytes + bytes <= MAX_PENDING_BYTES; };
+	if (!wait && !fits())
+		return false;
+	_condition.wait(lock, [this, &fits] { return _cancel || fits(); });
+	if (_cancel)
+		return false;
+	_pendingMeshes.push_back(mesh);
+	if (mesh->prepared)
+		++_pendingPrepared;
+	_pendingBytes += bytes;
+	_stats.peakPending = std::max(_stats.peakPending, _pendingBytes / 1048576.0);
+	++_sequence;
+	_condition.notify_all();
+	return true;
+}
+
+bool Model::writeMesh(PendingMesh *mesh, const aiMesh *source, const std::vector<GLuint> &lodIndices) {
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_condition.wait(lock, [this, mesh] { return _cancel || mesh->prepared; });
+		if (_cancel)
+			return false;
+	}
+	/* GL thread does not touch mesh until it is ready, mapped memory may be written from here */
+	void *vertexData = mesh->vertexTarget;
+	GLuint *indices = mesh->indexTarget;
+	if (vertexData == nullptr) {
+		mesh->vertexData.resize(Mesh::vertexDataSize(mesh->info));
+		mesh->indices.resize(Mesh::indexNum(mesh->info));
+		vertexData = mesh->vertexData.data();
+		indices = mesh->indices.data();
+	}
+	/* chunks of vertices first, then chunks of faces, each written by whichever thread takes it */
+	const MeshInfo &info = mesh->info;
+	size_t vertexChunks = (info.vertexNum + CONVERT_CHUNK - 1) / CONVERT_CHUNK, faceChunks = (info.faceNum + CONVERT_CHUNK - 1) / CONVERT_CHUNK;
+	ThreadPool::shared().parallelFor(vertexChunks + faceChunks, [&](size_t chunk) {
+		if (chunk < vertexChunks) {
+			unsigned int first = (unsigned int)chunk * CONVERT_CHUNK;
+			Mesh::convertVertices(source, info, vertexData, first, std::min(CONVERT_CHUNK, info.vertexNum - first));
+		} else {
+			unsigned int first = (unsigned int)(chunk - vertexChunks) * CONVERT_CHUNK;
+			Mesh::convertFaces(source, indices, first, std::min(CONVERT_CHUNK, info.faceNum - first));
+		}
+	});
+	std::copy(lodIndices.begin(), lodIndices.end(), indices + 3 * (size_t)info.faceNum);
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	mesh->ready = true;
+	++_sequence;
+	_condition.notify_all();
+	return true;
+}
+
+const aiScene * Model::importScene(Assimp::Importer &importer, const std::string &path, unsigned int flags, bool publish, LoadStats &stats,
+	std::vector<MeshCache::Material> &materials, glm::vec3 &center, GLfloat &maxDistance, std::string &error) {
+	Clock::time_point begin = Clock::now();
 	const aiScene *scene = importer.ReadFile(path, flags);/* aiProcessPreset_TargetRealtime_Quality */
 	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-		_errorInfo = importer.GetErrorString();
-		return;
+		error = importer.GetErrorString();
+		return nullptr;
 	}
+	stats.import = elapsed(begin);
 
+	begin = Clock::now();
 #ifdef __DEBUG__
 	std::cout << "total " << scene->mNumMeshes << " meshes :" << std::endl;
 	for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
@@ -117,72 +489,1482 @@ Model::Model(const std::string &path) {
 	}
 
 #endif // __DEBUG__
+	stats.dump = elapsed(begin);
 
-	/* load all textures */
-	loadTextures(scene, path);
+	/* textures decode while geometry is processed */
+	materials = readMaterials(scene, path);
+	if (publish)
+		publishMaterials(materials);
 
-	/* compute model center */
+	/* compute model center, again on reload where GL thread may still read the current one */
+	begin = Clock::now();
+	center = glm::vec3(0.f, 0.f, 0.f);
+	maxDistance = 0.f;
+	size_t vertexNum = 0;
 	for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
 		const aiMesh * mesh = scene->mMeshes[i];
 		for (unsigned int j = 0; j < mesh->mNumVertices; j++) {
-			_center[0] += mesh->mVertices[j].x;
-			_center[1] += mesh->mVertices[j].y;
-			_center[2] += mesh->mVertices[j].z;
+			center[0] += mesh->mVertices[j].x;
+			center[1] += mesh->mVertices[j].y;
+			center[2] += mesh->mVertices[j].z;
 		}
-		_vertexNum += mesh->mNumVertices;
+		vertexNum += mesh->mNumVertices;
 	}
-	_center /= _vertexNum;
+	center /= (GLfloat)vertexNum;
 
 	/* compute max distance from vertex to model center */
 	for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
 		const aiMesh *mesh = scene->mMeshes[i];
 		for (unsigned int j = 0; j < mesh->mNumVertices; j++) {
-			mesh->mVertices[j].x -= _center[0];
-			mesh->mVertices[j].y -= _center[1];
-			mesh->mVertices[j].z -= _center[2];
+			mesh->mVertices[j].x -= center[0];
+			mesh->mVertices[j].y -= center[1];
+			mesh->mVertices[j].z -= center[2];
 			GLfloat x = glm::abs(mesh->mVertices[j].x), y = glm::abs(mesh->mVertices[j].y), z = glm::abs(mesh->mVertices[j].z);
-			_maxDistance = glm::max(_maxDistance, glm::max(x, glm::max(y, z)));
+			maxDistance = glm::max(maxDistance, glm::max(x, glm::max(y, z)));
 		}
 	}
 
-	/* load mesh data */
-	GLfloat scale = 1.f / _maxDistance;
+	GLfloat scale = 1.f / maxDistance;
 	for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
 		const aiMesh * mesh = scene->mMeshes[i];
 		for (unsigned int j = 0; j < mesh->mNumVertices; j++)
 			mesh->mVertices[j] *= scale;
-		Mesh * pMesh = new Mesh(mesh, _textures[mesh->mMaterialIndex], _colors[mesh->mMaterialIndex]);
-		if (!pMesh->empty())
-			_meshes.push_back(pMesh);
-		else
-			delete pMesh;
 	}
+	stats.normalize = elapsed(begin);
 
-	if (!_meshes.size())
-		_errorInfo = "Invalid vertices data .";
+	/* imports without shared vertices repeat them in every face, welding comes before reordering for cache */
+	begin = Clock::now();
+	if (_options.weldEpsilon > 0.f) {
+		double before = 0.0, after = 0.0;
+		for (unsigned int i = 0; i < scene->mNumMeshes && !_cancel; i++) {
+			before += scene->mMeshes[i]->mNumVertices;
+			after += weldVertices(scene->mMeshes[i], _options.weldEpsilon);
+#ifdef __DEBUG__
+			std::cout << "mesh[" << i << "] : " << scene->mMeshes[i]->mNumVertices << " vertices after welding ." << std::endl;
+#endif // __DEBUG__
+		}
+		/* merged vertices were about equal, center stays */
+		if (before > 0.0)
+			stats.weldRatio = (float)(after / before);
+	}
+	stats.weld = elapsed(begin);
+
+	/* reordered meshes go into cache, later loads get them for free */
+	begin = Clock::now();
+	if (_options.optimize != OPTIMIZE_NONE) {
+		double triangles = 0.0, vertices = 0.0;
+		for (unsigned int i = 0; i < scene->mNumMeshes && !_cancel; i++) {
+			VertexCacheStats before, after;
+			optimizeMesh(scene->mMeshes[i], _options.optimize == OPTIMIZE_OVERDRAW, before, after);
+			double faceNum = scene->mMeshes[i]->mNumFaces, vertexNum = scene->mMeshes[i]->mNumVertices;
+			stats.acmrBefore += (float)(before.acmr * faceNum);
+			stats.acmrAfter += (float)(after.acmr * faceNum);
+			stats.atvrBefore += (float)(before.atvr * vertexNum);
+			stats.atvrAfter += (float)(after.atvr * vertexNum);
+			triangles += faceNum;
+			vertices += vertexNum;
+#ifdef __DEBUG__
+			std::cout << "mesh[" << i << "] : ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << " ." << std::endl;
+#endif // __DEBUG__
+		}
+		if (triangles > 0.0) {
+			stats.acmrBefore /= (float)triangles;
+			stats.acmrAfter /= (float)triangles;
+		}
+		if (vertices > 0.0) {
+			stats.atvrBefore /= (float)vertices;
+			stats.atvrAfter /= (float)vertices;
+		}
+	}
+	stats.optimize = elapsed(begin);
+	return scene;
+}
+
+std::vector<MeshInfo> Model::measureScene(const aiScene *scene) const {
+	std::vector<MeshInfo> infos(scene->mNumMeshes);
+	bool sharedBounds = (cacheOptions() & MeshCache::SHARED_BOUNDS) != 0;
+	ThreadPool::shared().parallelFor(scene->mNumMeshes, [&](size_t i) {
+		infos[i] = Mesh::measure(scene->mMeshes[i], _options.format);
+		/* one multi draw can not switch bounds, normalized model fits in [-1,1] */
+		if (sharedBounds) {
+			infos[i].boundsMin = glm::vec3(-1.f, -1.f, -1.f);
+			infos[i].boundsMax = glm::vec3(1.f, 1.f, 1.f);
+		}
+	});
+	return infos;
+}
+
+bool Model::loadScene(const std::string &path, unsigned int flags) {
+	Assimp::Importer importer;
+	std::vector<MeshCache::Material> materials;
+	const aiScene *scene = importScene(importer, path, flags, true, _stats, materials, _center, _maxDistance, _errorInfo);
+	if (scene == nullptr)
+		return false;
+	/* counted after welding, matches loads from cache */
+	for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+		_vertexNum += scene->mMeshes[i]->mNumVertices;
+
+	/* load mesh data */
+	Clock::time_point begin = Clock::now();
+	std::vector<MeshInfo> infos = measureScene(scene);
+	std::vector<unsigned int> meshMaterials(scene->mNumMeshes);
+	for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+		meshMaterials[i] = scene->mMeshes[i]->mMaterialIndex;
+	_stats.convert += elapsed(begin);
+	publishPreview(infos, meshMaterials);
+
+	/* coarser levels have to be known before arenas are reserved */
+	begin = Clock::now();
+	std::vector<std::vector<GLuint> > lodIndices(scene->mNumMeshes);
+	if (_options.lod)
+		for (unsigned int i = 0; i < scene->mNumMeshes && !_cancel; i++)
+			lodIndices[i] = Mesh::buildLods(scene->mMeshes[i], infos[i]);
+	_stats.simplify = elapsed(begin);
+	publishLayout(infos);
+
+	/* converted once straight into cache, GL thread uploads from there as on a cached load */
+	begin = Clock::now();
+	MeshCache *cache = new MeshCache(path, flags, _options.format, cacheOptions(), _options.weldEpsilon, scene, infos, materials, _center, _maxDistance);
+	_stats.cacheWrite = elapsed(begin);
+	if (cache->empty()) {
+		delete cache;
+		cache = nullptr;
+	} else
+		_cache = cache;
+
+	/* queued meshes belong to queue, loader only writes their data */
+	std::vector<PendingMesh *> pending(scene->mNumMeshes, nullptr);
+	unsigned int queued = 0;
+	for (unsigned int i = 0; i < scene->mNumMeshes; i = queued) {
+		/* as many meshes as pending limit allows, at least one, GL thread uploads earlier ones meanwhile */
+		for (; queued < scene->mNumMeshes; queued++) {
+			PendingMesh *next = new PendingMesh(queued, meshMaterials[queued], infos[queued]);
+			/* a mesh going into cache needs no buffers mapped */
+			if (cache != nullptr) {
+				next->vertexTarget = cache->getVertexTarget(queued);
+				next->indexTarget = cache->getIndexTarget(queued);
+				next->mappedVertexData = next->vertexTarget;
+				next->mappedIndices = next->indexTarget;
+				next->prepared = true;
+			}
+			if (!pushMesh(next, queued == i)) {
+				delete next;
+				break;
+			}
+			pending[queued] = next;
+		}
+		if (queued <= i)
+			return true;
+		/* buffers are mapped in queue order, once the last one is ready none of the workers has to wait */
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			PendingMesh *last = pending[queued - 1];
+			_condition.wait(lock, [this, last] { return _cancel || last->prepared; });
+			if (_cancel)
+				return true;
+		}
+		/* one task per mesh, each ready for upload as soon as it is written */
+		begin = Clock::now();
+		std::atomic<bool> cancelled(false);
+		ThreadPool::shared().parallelFor(queued - i, [&](size_t k) {
+			if (!cancelled && !writeMesh(pending[i + k], scene->mMeshes[i + k], lodIndices[i + k]))
+				cancelled = true;
+		});
+		_stats.convert += elapsed(begin);
+		if (cancelled)
+			return true;
+	}
+
+	/* next load of the same file skips assimp */
+	begin = Clock::now();
+	_meshHashes.assign(scene->mNumMeshes, 0);
+	if (cache == nullptr || !cache->commit())
+		std::cout << "Fail to write mesh cache " << MeshCache::cachePath(path) << " ." << std::endl;
+	else
+		for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+			_meshHashes[i] = cache->getMesh(i).hash;
+	_stats.cacheWrite += elapsed(begin);
+	return true;
+}
+
+void Model::loadCache(MeshCache *cache) {
+	_cache = cache;
+	_center = cache->getCenter();
+	_maxDistance = cache->getMaxDistance();
+	publishMaterials(cache->getMaterials());
+	std::vector<MeshInfo> infos(cache->getMeshNum());
+	std::vector<unsigned int> meshMaterials(cache->getMeshNum());
+	_meshHashes.resize(cache->getMeshNum());
+	for (unsigned int i = 0; i < cache->getMeshNum(); i++) {
+		infos[i] = cache->getMeshInfo(i);
+		meshMaterials[i] = cache->getMesh(i).materialIndex;
+		_meshHashes[i] = cache->getMesh(i).hash;
+		_vertexNum += infos[i].vertexNum;
+	}
+	publishPreview(infos, meshMaterials);
+	publishLayout(infos);
+	/* mapped data goes to GL thread as it is */
+	for (unsigned int i = 0; i < cache->getMeshNum(); i++) {
+		PendingMesh *pending = new PendingMesh(i, meshMaterials[i], infos[i]);
+		pending->mappedVertexData = cache->getVertexData(i);
+		pending->mappedIndices = cache->getIndices(i);
+		pending->prepared = pending->ready = true;
+		if (!pushMesh(pending, true)) {
+			delete pending;
+			return;
+		}
+	}
+}
+
+unsigned int Model::cacheOptions() const {
+	unsigned int options = 0;
+	if (_options.arena && _options.format == VERTEX_FORMAT_COMPACT)
+		options |= MeshCache::SHARED_BOUNDS;
+	if (_options.lod)
+		options |= MeshCache::LEVELS_OF_DETAIL;
+	if (_options.optimize != OPTIMIZE_NONE)
+		options |= MeshCache::VERTEX_CACHE;
+	if (_options.optimize == OPTIMIZE_OVERDRAW)
+		options |= MeshCache::OVERDRAW;
+	return options;
+}
+
+void Model::createArenas(const std::vector<MeshInfo> &infos) {
+	if (!_options.arena)
+		return;
+	/* meshes with and without texture coords differ in stride */
+	size_t vertexNum[2] = { 0, 0 }, indexNum[2] = { 0, 0 };
+	for (size_t i = 0; i < infos.size(); i++) {
+		vertexNum[infos[i].texCoords] += infos[i].vertexNum;
+		indexNum[infos[i].texCoords] += Mesh::indexNum(infos[i]);
+	}
+	_arenas.assign(2, nullptr);
+	for (int i = 0; i < 2; i++)
+		if (vertexNum[i])
+			_arenas[i] = new GeometryArena(_options.format, i != 0, vertexNum[i], indexNum[i]);
+}
+
+bool Model::inArena(const MeshInfo &info) const {
+	return !_arenas.empty() && _arenas[info.texCoords] && !_arenas[info.texCoords]->empty();
+}
+
+void Model::prepareMesh(PendingMesh *pending) {
+	/* arenas are drawn from while loading, a mapped range would block them, arena meshes are staged */
+	if (inArena(pending->info))
+		return;
+	Mesh *pMesh = new Mesh(pending->info, _textures[pending->materialIndex], _colors[pending->materialIndex]);
+	if (!pMesh->empty() && pMesh->map(pending->vertexTarget, pending->indexTarget))
+		pending->mesh = pMesh;
+	else {
+		pending->vertexTarget = nullptr;
+		pending->indexTarget = nullptr;
+		delete pMesh;
+	}
+}
+
+void Model::completeMesh(PendingMesh *pending) {
+	if (pending->mesh != nullptr) {
+		Mesh *pMesh = pending->mesh;
+		pending->mesh = nullptr;
+		if (pMesh->unmap()) {
+			/* texture may have arrived while loader was writing */
+			pMesh->setTexture(_textures[pending->materialIndex]);
+			addMesh(pMesh, pending->index, pending->materialIndex);
+		} else {
+			std::cout << "Fail to upload mesh[" << pending->index << "], its buffers were lost ." << std::endl;
+			delete pMesh;
+		}
+		return;
+	}
+	const MeshInfo &info = pending->info;
+	const void *vertexData = pending->mappedVertexData ? pending->mappedVertexData : pending->vertexData.data();
+	const GLuint *indices = pending->mappedIndices ? pending->mappedIndices : pending->indices.data();
+	if (inArena(info))
+		addMesh(new Mesh(info, *_arenas[info.texCoords], vertexData, indices, _textures[pending->materialIndex], _colors[pending->materialIndex]),
+			pending->index, pending->materialIndex);
 	else
+		addMesh(new Mesh(info, vertexData, indices, _textures[pending->materialIndex], _colors[pending->materialIndex]), pending->index, pending->materialIndex);
+}
+
+void Model::addMesh(Mesh *pMesh, unsigned int sourceIndex, unsigned int materialIndex) {
+	if (!pMesh->empty()) {
+		_meshes.push_back(pMesh);
+		_meshSources.push_back(sourceIndex);
+		_meshMaterials.push_back(materialIndex);
+	} else
+		delete pMesh;
+}
+
+void Model::buildBatches() {
+	if (_arenas.empty())
+		return;
+	/* meshes that did not fit in an arena keep own buffers and get a batch of their own */
+	std::vector<int> batchOf(_textureNum * 2, -1);
+	for (size_t i = 0; i < _meshes.size(); i++) {
+		const Mesh *mesh = _meshes[i];
+		int *batch = nullptr, single = -1;
+		bool shared = !!_arenas[mesh->getInfo().texCoords] && mesh->getVAO() == _arenas[mesh->getInfo().texCoords]->getVAO();
+		batch = shared ? &batchOf[2 * _meshMaterials[i] + mesh->getInfo().texCoords] : &single;
+		if (*batch < 0) {
+			*batch = (int)_batches.size();
+			_batches.push_back(DrawBatch());
+			_batches.back().mesh = mesh;
+			_batches.back().materialIndex = _meshMaterials[i];
+			_batches.back().VAO = mesh->getVAO();
+		}
+		DrawBatch &drawBatch = _batches[*batch];
+		drawBatch.meshes.push_back(mesh);
+		drawBatch.counts.push_back(mesh->getIndexCount());
+		drawBatch.offsets.push_back((void *)mesh->getIndexOffset());
+		drawBatch.baseVertices.push_back(mesh->getBaseVertex());
+	}
+#ifdef __DEBUG__
+	std::cout << "arena : " << _meshes.size() << " meshes in " << _batches.size() << " draw batches ." << std::endl;
+#endif // __DEBUG__
+}
+
+void Model::sortDrawOrder() {
+	/* texture switches cost most, then material uniforms, then vertex arrays */
+	std::vector<Mesh *> &meshes = _meshes;
+	std::vector<unsigned int> &materials = _meshMaterials;
+	_drawOrder.resize(_meshes.size());
+	for (size_t i = 0; i < _drawOrder.size(); i++)
+		_drawOrder[i] = i;
+	std::stable_sort(_drawOrder.begin(), _drawOrder.end(), [&meshes, &materials](size_t a, size_t b) {
+		if (meshes[a]->getTexture() != meshes[b]->getTexture())
+			return meshes[a]->getTexture() < meshes[b]->getTexture();
+		if (materials[a] != materials[b])
+			return materials[a] < materials[b];
+		return meshes[a]->getVAO() < meshes[b]->getVAO();
+	});
+	std::stable_sort(_batches.begin(), _batches.end(), [](const DrawBatch &a, const DrawBatch &b) {
+		if (a.mesh->getTexture() != b.mesh->getTexture())
+			return a.mesh->getTexture() < b.mesh->getTexture();
+		return a.materialIndex < b.materialIndex;
+	});
+}
+
+ModelOptions::ModelOptions() {
+	format = VERTEX_FORMAT_COMPACT;
+	arena = false;
+	lod = false;
+	progressive = false;
+	optimize = OPTIMIZE_VERTEX_CACHE;
+	weldEpsilon = 1e-5f;
+	compressTextures = true;
+	streamTextures = true;
+	streamBytes = 4 << 20;
+	memoryBudget = 0;
+}
+
+Model::Model(const std::string &path, const ModelOptions &options) {
+	/* default value is important because initializer may be interrupted */
+	_exist = false;
+	_errorInfo = "";
+	_textureNum = _vertexNum = 0;
+	_textures = nullptr;
+	_colors = nullptr;
+	_center = glm::vec3(0.f, 0.f, 0.f);
+	_maxDistance = 0.f;
+	_geometryBytes = 0;
+	_options = options;
+	_compressTextures = _options.compressTextures && TextureCache::supported();
+	_occlusion = false;
+	_proxyBox = nullptr;
+	memset(&_stats, 0, sizeof(LoadStats));
+	_loading = true;
+	_loadBegin = _texturesBegin = Clock::now();
+	_cache = nullptr;
+	_layoutTaken = false;
+	_sequence = 0;
+	_cancel = _loaderDone = false;
+	_materialsReady = _previewReady = _layoutReady = false;
+	_decodePending = 0;
+	_pendingBytes = 0;
+	_pendingPrepared = 0;
+	_path = path;
+	_reloading = _reloadDone = false;
+	_reloaded = nullptr;
+	_texturesReloading = 0;
+	memset(&_reloadStats, 0, sizeof(ReloadStats));
+	resetPeakMemory();
+
+	_loader = std::thread(&Model::load, this, path);
+	if (_options.progressive) {
 		_exist = true;
+		return;
+	}
+
+	/* blocking load still uploads while loader converts */
+	unsigned long long seen = 0;
+	while (_loading) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_condition.wait(lock, [this, &seen] { return _sequence != seen; });
+			seen = _sequence;
+		}
+		update(std::numeric_limits<double>::infinity());
+	}
 }
 
 Model::~Model() {
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_cancel = true;
+		_condition.notify_all();
+	}
+	if (_loader.joinable())
+		_loader.join();
+	if (_reloader.joinable())
+		_reloader.join();
+	if (_reloaded != nullptr)
+		delete _reloaded;
+	{
+		/* decodes in flight still refer to model */
+		std::unique_lock<std::mutex> lock(_mutex);
+		_condition.wait(lock, [this] { return !_decodePending; });
+	}
+	for (size_t i = 0; i < _decodedTextures.size(); i++) {
+		if (_decodedTextures[i]->shared)
+			TextureLibrary::shared().release(_decodedTextures[i]->shared);
+		delete _decodedTextures[i];
+	}
+	for (size_t i = 0; i < _pendingMeshes.size(); i++)
+		delete _pendingMeshes[i];
+	if (_cache != nullptr)
+		delete _cache;
+	for (size_t i = 0; i < _streams.size(); i++) {
+		delete _streams[i]->source;
+		delete _streams[i];
+	}
+
 	for (size_t i = 0; i < _meshes.size(); i++)
 		delete _meshes[i];
 	_meshes.clear();
+	for (size_t i = 0; i < _bvhs.size(); i++)
+		delete _bvhs[i];
+	_bvhs.clear();
+	for (size_t i = 0; i < _arenas.size(); i++)
+		delete _arenas[i];
+	_arenas.clear();
+	if (!_queries.empty())
+		glDeleteQueries((GLsizei)_queries.size(), _queries.data());
+	if (_proxyBox != nullptr)
+		delete _proxyBox;
 	if (_textures != nullptr) {
 		glBindTexture(GL_TEXTURE_2D, 0);
 		for (size_t i = 0; i < _textureNum; i++)
 			if (_textures[i])
-				glDeleteTextures(1, _textures + i);
+				TextureLibrary::shared().release(_textures[i]);
 		delete[]_textures;
 	}
 	if (_colors != nullptr)
 		delete[] _colors;
 }
 
-void Model::draw(GLuint programId) {
-	for (size_t i = 0; i < _meshes.size(); i++)
-		if (!_meshes[i]->empty())
-			_meshes[i]->draw(programId);
+bool Model::update(double budget) {
+	if (!_loading) {
+		bool shown = streamTextures(budget);
+		return updateReload() || shown;
+	}
+	Clock::time_point begin = Clock::now();
+	bool changed = false, added = false;
+	std::unique_lock<std::mutex> lock(_mutex);
+	if (_materialsReady && _textures == nullptr) {
+		_textureNum = (GLsizei)_materials.size();
+		_textures = new GLuint[_textureNum];
+		_colors = new aiColor3D[_textureNum];
+		for (size_t i = 0; i < _materials.size(); i++) {
+			_textures[i] = 0;
+			_colors[i] = _materials[i].color;
+		}
+	}
+	if (_previewReady && _uploaded.empty()) {
+		_uploaded.assign(_preview.size(), 0);
+		for (size_t i = 0; i < _preview.size(); i++)
+			_geometryBytes += Mesh::vertexDataSize(_preview[i]) + Mesh::indexNum(_preview[i]) * sizeof(GLuint);
+		changed = true;
+	}
+	if (_layoutReady && !_layoutTaken) {
+		std::vector<MeshInfo> layout;
+		layout.swap(_layout);
+		lock.unlock();
+		createArenas(layout);
+		lock.lock();
+		_layoutTaken = true;
+	}
+
+	for (bool first = true; first || elapsed(begin) < budget; first = false) {
+		if (!_decodedTextures.empty()) {
+			DecodedTexture *texture = _decodedTextures.front();
+			_decodedTextures.pop_front();
+			lock.unlock();
+			uploadTexture(texture);
+			lock.lock();
+		} else if (_layoutTaken && !_pendingMeshes.empty() && _pendingMeshes.front()->ready) {
+			PendingMesh *pending = _pendingMeshes.front();
+			_pendingMeshes.pop_front();
+			--_pendingPrepared;
+			lock.unlock();
+			Clock::time_point uploadBegin = Clock::now();
+			completeMesh(pending);
+			_uploaded[pending->index] = 1;
+			_stats.meshUpload += elapsed(uploadBegin);
+			/* staged data is released before loader may convert more */
+			size_t bytes = pending->bytes;
+			delete pending;
+			added = true;
+			lock.lock();
+			_pendingBytes -= bytes;
+			_condition.notify_all();
+		} else if (_layoutTaken && _pendingPrepared < _pendingMeshes.size()) {
+			/* loader waits for buffers of next mesh, they are mapped in queue order */
+			PendingMesh *pending = _pendingMeshes[_pendingPrepared];
+			lock.unlock();
+			Clock::time_point uploadBegin = Clock::now();
+			prepareMesh(pending);
+			_stats.meshUpload += elapsed(uploadBegin);
+			lock.lock();
+			pending->prepared = true;
+			++_pendingPrepared;
+			++_sequence;
+			_condition.notify_all();
+		} else
+			break;
+		changed = true;
+	}
+	bool finished = _loaderDone && !_decodePending && _decodedTextures.empty() && _pendingMeshes.empty();
+	lock.unlock();
+	/* finer levels of textures already shown follow in what is left of budget */
+	if (!_streams.empty() && streamTextures(budget - elapsed(begin)))
+		changed = true;
+
+	if (added)
+		sortDrawOrder();
+	if (finished)
+		finish();
+	return changed || finished;
+}
+
+void Model::setMaterialTexture(size_t i, GLuint textureId) {
+	_textures[i] = textureId;
+	/* meshes uploaded before their texture get it now */
+	for (size_t j = 0; j < _meshes.size(); j++)
+		if (_meshMaterials[j] == i)
+			_meshes[j]->setTexture(textureId);
+	/* materials showing the same image take their own reference */
+	for (size_t j = 0; j < _textureKeys.size(); j++)
+		if (j != i && !_textures[j] && _textureKeys[j] == _textureKeys[i])
+			setMaterialTexture(j, TextureLibrary::shared().acquire(_textureKeys[i]));
+}
+
+void Model::uploadTexture(DecodedTexture *texture) {
+	Clock::time_point begin = Clock::now();
+	size_t i = texture->materialIndex;
+	if (texture->shared) {
+		setMaterialTexture(i, texture->shared);
+		_stats.textures = elapsed(_texturesBegin);
+		delete texture;
+		return;
+	}
+	if (texture->reload) {
+		--_texturesReloading;
+		if (texture->image.empty() && texture->compressed == nullptr) {
+			delete texture;
+			return;
+		}
+	}
+	/* a changed image keeps texture object, meshes and other holders see it at once */
+	bool replace = texture->reload && _textures[i];
+	GLuint textureId = replace ? _textures[i] : 0;
+	if (replace)
+		cancelStream(textureId);
+	else
+		glGenTextures(1, &textureId);
+	glBindTexture(GL_TEXTURE_2D, textureId);
+	/* new textures of progressive models show coarse levels first */
+	bool streamed = !texture->reload && _options.progressive && _options.streamTextures && texture->streamable();
+	/* finest levels are dropped while texture does not fit into what budget leaves */
+	unsigned int levelNum = texture->levelNum(), skip = 0;
+	size_t left = textureBudget(replace ? textureId : 0);
+	while (skip + 1 < levelNum && texture->bytes(skip) > left)
+		++skip;
+	/* driver may run out of memory before budget does, coarser levels are tried then */
+	Mesh::clearErrors();
+	int width, height;
+	size_t bytes;
+	for (;;) {
+		bytes = streamed ? allocateLevels(*texture, skip, width, height) : uploadLevels(*texture, skip, width, height);
+		if (glGetError() != GL_OUT_OF_MEMORY || skip + 1 >= levelNum)
+			break;
+		++skip;
+	}
+	StreamingTexture *stream = streamed ? beginStream(texture, textureId, skip) : nullptr;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	double uploadTime = elapsed(begin);
+	if (replace)
+		TextureLibrary::shared().replace(textureId, _textureKeys[i], bytes);
+	else {
+		GLuint shared = TextureLibrary::shared().insert(_textureKeys[i], textureId, bytes);
+		setMaterialTexture(i, shared);
+		/* stream goes on unless library kept a texture uploaded meanwhile instead */
+		if (stream != nullptr && shared == textureId) {
+			_streams.push_back(stream);
+			_textureDemand.resize(_textureNum, 0.f);
+		} else if (stream != nullptr) {
+			delete stream;
+			stream = nullptr;
+		}
+	}
+	if (texture->reload)
+		++_reloadStats.texturesUploaded;
+	else {
+		_stats.textureUpload += uploadTime;
+		_stats.textureMemory += bytes / 1048576.0;
+		_stats.textures = elapsed(_texturesBegin);
+		if (skip)
+			++_stats.texturesReduced;
+	}
+
+#ifdef __DEBUG__
+	std::cout << "texture[" << i << "] : " << width << "x" << height << (texture->compressed ? " compressed" : "") << ", decode " << texture->decodeTime
+		<< " ms, encode " << texture->encodeTime << " ms, upload " << uploadTime << " ms, " << bytes / 1024 << " KB";
+	if (skip)
+		std::cout << ", " << skip << " finest levels dropped for memory budget";
+	if (stream != nullptr)
+		std::cout << ", finer levels stream";
+	std::cout << " ." << std::endl;
+#endif // __DEBUG__
+	/* release decoded pixels as soon as they are on GPU, stream keeps levels it still uploads */
+	if (stream == nullptr)
+		delete texture;
+}
+
+size_t Model::uploadLevels(const DecodedTexture &texture, unsigned int skip, int &width, int &height) {
+	if (texture.compressed != nullptr) {
+		/* whole mip chain comes prebuilt, dropped levels are just left out */
+		const TextureCache &cache = *texture.compressed;
+		for (unsigned int level = skip; level < cache.getLevelNum(); level++) {
+			const TextureCache::Level &data = cache.getLevel(level);
+			glCompressedTexImage2D(GL_TEXTURE_2D, level - skip, cache.getFormat(), data.width, data.height, 0, (GLsizei)data.data.size(), data.data.data());
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, cache.getLevelNum() - 1 - skip);
+		width = cache.getLevel(skip).width;
+		height = cache.getLevel(skip).height;
+		return texture.bytes(skip);
+	}
+	cv::Mat image = texture.image;
+	if (skip)
+		cv::resize(texture.image, image, cv::Size(std::max(texture.image.cols >> skip, 1), std::max(texture.image.rows >> skip, 1)), 0, 0, cv::INTER_AREA);
+	/* rows of 1 or 3 channels images are not always 4 bytes aligned */
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, texture.format, image.cols, image.rows, 0, texture.format, GL_UNSIGNED_BYTE, image.data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	/* compressed or streamed chain uploaded before may have limited levels */
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+	width = image.cols;
+	height = image.rows;
+	return texture.bytes(skip);
+}
+
+size_t Model::allocateLevels(const DecodedTexture &texture, unsigned int skip, int &width, int &height) {
+	/* storage of whole chain up front, levels are filled in by sub image uploads as they stream */
+	unsigned int levelNum = texture.levelNum();
+	for (unsigned int level = skip; level < levelNum; level++) {
+		int levelWidth, levelHeight;
+		texture.levelSize(level, levelWidth, levelHeight);
+		if (texture.compressed != nullptr)
+			glCompressedTexImage2D(GL_TEXTURE_2D, level - skip, texture.compressed->getFormat(), levelWidth, levelHeight, 0,
+				(GLsizei)texture.levelBytes(level), NULL);
+		else
+			glTexImage2D(GL_TEXTURE_2D, level - skip, texture.format, levelWidth, levelHeight, 0, texture.format, GL_UNSIGNED_BYTE, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, levelNum - 1 - skip);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelNum - 1 - skip);
+	texture.levelSize(skip, width, height);
+	return texture.bytes(skip);
+}
+
+void Model::uploadRows(const DecodedTexture &texture, unsigned int level, unsigned int target, int first, int count) {
+	int width, height;
+	texture.levelSize(level, width, height);
+	if (texture.compressed != nullptr) {
+		/* whole rows of 4x4 blocks, first is a multiple of 4 */
+		const std::vector<unsigned char> &data = texture.compressed->getLevel(level).data;
+		size_t rowBytes = data.size() / ((height + 3) / 4);
+		size_t begin = first / 4 * rowBytes, end = (size_t)(first + count + 3) / 4 * rowBytes;
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, target, 0, first, width, count, texture.compressed->getFormat(), (GLsizei)(end - begin), data.data() + begin);
+		return;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, target, 0, first, width, count, texture.format, GL_UNSIGNED_BYTE, texture.levels[level].ptr(first));
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+Model::StreamingTexture * Model::beginStream(DecodedTexture *texture, GLuint textureId, unsigned int skip) {
+	/* coarse levels at once, so that texture shows with the first frame it is drawn in */
+	unsigned int levelNum = texture->levelNum(), base = levelNum - skip;
+	int width, height;
+	do {
+		--base;
+		texture->levelSize(base + skip, width, height);
+		uploadRows(*texture, base + skip, base, 0, height);
+		if (base)
+			texture->levelSize(base - 1 + skip, width, height);
+	} while (base && std::max(width, height) <= STREAM_FIRST_SIZE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+	if (!base)
+		return nullptr;
+	StreamingTexture *stream = new StreamingTexture();
+	stream->texture = textureId;
+	stream->source = texture;
+	stream->skip = skip;
+	stream->base = base;
+	stream->row = 0;
+	return stream;
+}
+
+bool Model::streamTextures(double budget) {
+	Clock::time_point begin = Clock::now();
+	bool shown = false;
+	size_t sent = 0;
+	for (bool first = true; !_streams.empty() && (first || (elapsed(begin) < budget && sent < _options.streamBytes)); first = false) {
+		/* texture missing most levels the screen asks for goes first, textures not drawn last */
+		size_t next = 0;
+		GLfloat nextScore = -std::numeric_limits<GLfloat>::infinity();
+		for (size_t k = 0; k < _streams.size(); k++) {
+			const StreamingTexture &stream = *_streams[k];
+			GLfloat demand = 0.f;
+			for (size_t j = 0; j < _textureDemand.size(); j++)
+				if (_textures[j] == stream.texture)
+					demand = std::max(demand, _textureDemand[j]);
+			int width, height;
+			stream.source->levelSize(stream.skip, width, height);
+			/* level whose texels match pixels, as if texture spans its meshes once */
+			GLfloat score = demand > 0.f ? stream.base - std::max(std::log2(std::max(width, height) / demand), 0.f) : stream.base - 1e6f;
+			if (score > nextScore) {
+				nextScore = score;
+				next = k;
+			}
+		}
+
+		/* strip of next finer level within what is left of bytes per update, whole block rows */
+		StreamingTexture &stream = *_streams[next];
+		unsigned int target = stream.base - 1, level = target + stream.skip;
+		int width, height;
+		stream.source->levelSize(level, width, height);
+		size_t levelBytes = std::max(stream.source->levelBytes(level), (size_t)1);
+		size_t left = _options.streamBytes > sent ? _options.streamBytes - sent : 0;
+		int rows = (int)std::min((size_t)(height - stream.row), std::max((size_t)4, left * height / levelBytes / 4 * 4));
+		Clock::time_point uploadBegin = Clock::now();
+		glBindTexture(GL_TEXTURE_2D, stream.texture);
+		uploadRows(*stream.source, level, target, stream.row, rows);
+		_stats.textureUpload += elapsed(uploadBegin);
+		sent += levelBytes * rows / height;
+		stream.row += rows;
+		if (stream.row < height)
+			continue;
+		/* level is complete, sampling moves down to it */
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, target);
+		stream.base = target;
+		stream.row = 0;
+		shown = true;
+		if (target)
+			continue;
+		delete stream.source;
+		delete _streams[next];
+		_streams.erase(_streams.begin() + next);
+		if (!_streams.empty())
+			continue;
+		_stats.textureStream = elapsed(_texturesBegin);
+#ifdef __DEBUG__
+		std::cout << "textures streamed in " << _stats.textureStream << " ms ." << std::endl;
+#endif // __DEBUG__
+	}
+	return shown;
+}
+
+void Model::cancelStream(GLuint textureId) {
+	for (size_t k = 0; k < _streams.size(); k++)
+		if (_streams[k]->texture == textureId) {
+			delete _streams[k]->source;
+			delete _streams[k];
+			_streams.erase(_streams.begin() + k);
+			return;
+		}
+}
+
+size_t Model::textureBudget(GLuint replaced) {
+	if (!_options.memoryBudget)
+		return std::numeric_limits<size_t>::max();
+	MemoryUsage usage = getMemory();
+	/* meshes on their way take their part already */
+	size_t used = std::max(usage.buffers, _geometryBytes) + usage.textures;
+	if (replaced)
+		used -= std::min(used, TextureLibrary::shared().getBytes(replaced));
+	return _options.memoryBudget > used ? _options.memoryBudget - used : 0;
+}
+
+void Model::finish() {
+	_loader.join();
+	_loading = false;
+	_preview.clear();
+	_uploaded.clear();
+	if (_cache != nullptr) {
+		delete _cache;
+		_cache = nullptr;
+	}
+	if (!_loaderError.empty()) {
+		_errorInfo = _loaderError;
+		_exist = false;
+		return;
+	}
+	buildBatches();
+	sortDrawOrder();
+	_stats.total = elapsed(_loadBegin);
+	_stats.peakMemory = peakMemory();
+
+#ifdef __DEBUG__
+	std::cout << "loaded by " << (_stats.cached ? "mesh cache" : "assimp") << " in " << _stats.total << " ms, peak memory " << _stats.peakMemory
+		<< " MB, peak pending " << _stats.peakPending << " MB ." << std::endl;
+	MemoryUsage usage = getMemory();
+	std::cout << "memory : " << usage.host / 1048576.0 << " MB host, " << usage.buffers / 1048576.0 << " MB buffers, " << usage.textures / 1048576.0
+		<< " MB textures";
+	if (_stats.texturesReduced)
+		std::cout << ", " << _stats.texturesReduced << " textures reduced to fit " << _options.memoryBudget / 1048576.0 << " MB budget";
+	std::cout << " ." << std::endl;
+#endif // __DEBUG__
+
+	if (!_meshes.size()) {
+		_errorInfo = "Invalid vertices data .";
+		_exist = false;
+	} else
+		_exist = true;
+}
+
+bool Model::writeCache(const std::string &path, unsigned int flags, std::string &error) {
+	Assimp::Importer importer;
+	LoadStats stats;
+	memset(&stats, 0, sizeof(LoadStats));
+	std::vector<MeshCache::Material> materials;
+	glm::vec3 center;
+	GLfloat maxDistance;
+	const aiScene *scene = importScene(importer, path, flags, false, stats, materials, center, maxDistance, error);
+	if (scene == nullptr)
+		return false;
+	std::vector<MeshInfo> infos = measureScene(scene);
+	std::vector<std::vector<GLuint> > lodIndices(scene->mNumMeshes);
+	if (_options.lod)
+		for (unsigned int i = 0; i < scene->mNumMeshes && !_cancel; i++)
+			lodIndices[i] = Mesh::buildLods(scene->mMeshes[i], infos[i]);
+	MeshCache cache(path, flags, _options.format, cacheOptions(), _options.weldEpsilon, scene, infos, materials, center, maxDistance);
+	for (unsigned int i = 0; i < scene->mNumMeshes && !cache.empty() && !_cancel; i++) {
+		GLuint *indices = cache.getIndexTarget(i);
+		Mesh::convert(scene->mMeshes[i], infos[i], cache.getVertexTarget(i), indices);
+		std::copy(lodIndices[i].begin(), lodIndices[i].end(), indices + 3 * (size_t)infos[i].faceNum);
+	}
+	if (_cancel || cache.empty() || !cache.commit()) {
+		error = "Fail to write mesh cache " + MeshCache::cachePath(path) + " .";
+		return false;
+	}
+	return true;
+}
+
+void Model::reloadScene() {
+	/* changed file makes cache stale, new cache is written and mapped like on a cached load */
+	std::string error;
+	MeshCache *cache = new MeshCache(_path, IMPORT_FLAGS, _options.format, cacheOptions(), _options.weldEpsilon);
+	if (cache->empty()) {
+		delete cache;
+		cache = nullptr;
+		if (writeCache(_path, IMPORT_FLAGS, error)) {
+			cache = new MeshCache(_path, IMPORT_FLAGS, _options.format, cacheOptions(), _options.weldEpsilon);
+			if (cache->empty()) {
+				/* file changed again meanwhile, next change notice reloads it */
+				delete cache;
+				cache = nullptr;
+				error = "Model file changed while reloading .";
+			}
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_reloaded = cache;
+	_reloadError = error;
+	_reloadDone = true;
+	++_sequence;
+	_condition.notify_all();
+}
+
+bool Model::applyReload(const MeshCache &cache) {
+	const std::vector<MeshCache::Material> &materials = cache.getMaterials();
+	_reloadStats.meshNum = cache.getMeshNum();
+	/* decide before touching anything, a model is never drawn half reloaded */
+	bool restructured = cache.getMeshNum() != _meshHashes.size() || materials.size() != _materials.size();
+	for (size_t i = 0; i < materials.size() && !restructured; i++)
+		restructured = materials[i].texturePath != _materials[i].texturePath;
+	for (size_t j = 0; j < _meshes.size() && !restructured; j++) {
+		unsigned int i = _meshSources[j];
+		/* draw batches hold ranges and pointers of meshes, only meshes with own buffers may change size */
+		restructured = cache.getMesh(i).materialIndex != _meshMaterials[j]
+			|| (!_batches.empty() && !Mesh::sameLayout(cache.getMeshInfo(i), _meshes[j]->getInfo()));
+	}
+	if (restructured) {
+		_reloadStats.restructured = true;
+		return false;
+	}
+	/* normalization of reloaded file, applied with its meshes on GL thread */
+	_center = cache.getCenter();
+	_maxDistance = cache.getMaxDistance();
+	_vertexNum = 0;
+	for (unsigned int i = 0; i < cache.getMeshNum(); i++)
+		_vertexNum += cache.getMesh(i).vertexNum;
+
+	bool changed = false;
+	for (size_t i = 0; i < materials.size(); i++) {
+		const aiColor3D &color = materials[i].color;
+		if (color == _colors[i])
+			continue;
+		_colors[i] = _materials[i].color = color;
+		for (size_t j = 0; j < _meshes.size(); j++)
+			if (_meshMaterials[j] == i)
+				_meshes[j]->setColor(color);
+		changed = true;
+	}
+
+	bool replaced = false;
+	for (size_t j = 0; j < _meshes.size(); j++) {
+		unsigned int i = _meshSources[j];
+		unsigned long long hash = cache.getMesh(i).hash;
+		if (hash && hash == _meshHashes[i])
+			continue;
+		MeshInfo info = cache.getMeshInfo(i);
+		Mesh *pMesh = _meshes[j];
+		GeometryArena *arena = inArena(info) ? _arenas[info.texCoords] : nullptr;
+		if (!pMesh->update(info, cache.getVertexData(i), cache.getIndices(i), arena)) {
+			/* mesh with own buffers changed size, it gets new ones */
+			Mesh *resized = nullptr;
+			if (_batches.empty())
+				resized = new Mesh(info, cache.getVertexData(i), cache.getIndices(i), pMesh->getTexture(), _colors[_meshMaterials[j]]);
+			if (resized == nullptr || resized->empty()) {
+				std::cout << "Fail to reload mesh[" << i << "] ." << std::endl;
+				delete resized;
+				continue;
+			}
+			/* a new vertex array may reuse the name of the old one */
+			_instanceSerials.erase(pMesh->getVAO());
+			delete pMesh;
+			_meshes[j] = resized;
+			replaced = true;
+		}
+		/* next pick reads changed data back */
+		if (j < _bvhs.size() && _bvhs[j] != nullptr) {
+			delete _bvhs[j];
+			_bvhs[j] = nullptr;
+		}
+		_meshHashes[i] = hash;
+		++_reloadStats.meshesUploaded;
+		changed = true;
+	}
+	if (replaced)
+		sortDrawOrder();
+	return changed;
+}
+
+bool Model::updateReload() {
+	if (!reloading())
+		return false;
+	bool changed = false;
+	std::unique_lock<std::mutex> lock(_mutex);
+	/* changed images are few, all of them go at once */
+	while (!_decodedTextures.empty()) {
+		DecodedTexture *texture = _decodedTextures.front();
+		_decodedTextures.pop_front();
+		lock.unlock();
+		uploadTexture(texture);
+		lock.lock();
+		changed = true;
+	}
+	bool done = _reloading && _reloadDone;
+	MeshCache *cache = _reloaded;
+	std::string error = _reloadError;
+	if (done)
+		_reloaded = nullptr;
+	lock.unlock();
+
+	if (done) {
+		_reloader.join();
+		_reloading = false;
+		if (cache != nullptr) {
+			changed = applyReload(*cache) || changed;
+			delete cache;
+		} else {
+			_errorInfo = error;
+			_reloadStats.failed = true;
+		}
+	}
+	if (!reloading())
+		_reloadStats.time = elapsed(_reloadBegin);
+	return changed;
+}
+
+bool Model::reload() {
+	if (!_exist || _loading || _reloading)
+		return false;
+	if (!reloading()) {
+		memset(&_reloadStats, 0, sizeof(ReloadStats));
+		_reloadBegin = Clock::now();
+	}
+	/* thread of previous reload has finished */
+	if (_reloader.joinable())
+		_reloader.join();
+	_reloading = true;
+	_reloadDone = false;
+	_reloader = std::thread(&Model::reloadScene, this);
+	return true;
+}
+
+bool Model::reloadTexture(const std::string &path) {
+	if (!_exist || _loading)
+		return false;
+	/* materials showing the image share its texture, it is decoded once */
+	size_t first = _materials.size();
+	for (size_t i = 0; i < _materials.size(); i++)
+		if (_materials[i].texturePath == path) {
+			if (first == _materials.size())
+				first = i;
+			_textureKeys[i] = TextureLibrary::key(path);
+		}
+	if (first == _materials.size())
+		return false;
+	if (!reloading()) {
+		memset(&_reloadStats, 0, sizeof(ReloadStats));
+		_reloadBegin = Clock::now();
+	}
+
+	++_texturesReloading;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		++_decodePending;
+	}
+	bool compress = _compressTextures;
+	ThreadPool::shared().push([this, first, path, compress] {
+		DecodedTexture *texture = new DecodedTexture();
+		texture->materialIndex = first;
+		texture->reload = true;
+		decodeTexture(path, compress, false, *texture);
+		std::lock_guard<std::mutex> lock(_mutex);
+		/* a failed decode still goes to GL thread, which waits for it */
+		if (texture->image.empty() && texture->compressed == nullptr)
+			std::cout << "Fail to read texture " << path << " ." << std::endl;
+		if (_cancel)
+			delete texture;
+		else
+			_decodedTextures.push_back(texture);
+		--_decodePending;
+		++_sequence;
+		_condition.notify_all();
+	});
+	return true;
+}
+
+bool Model::reloading() const { return _reloading || _texturesReloading; }
+
+const ReloadStats & Model::getReloadStats() const { return _reloadStats; }
+
+std::vector<std::string> Model::getTexturePaths() const {
+	std::vector<std::string> paths;
+	for (size_t i = 0; i < _materials.size(); i++)
+		if (!_materials[i].texturePath.empty() && std::find(paths.begin(), paths.end(), _materials[i].texturePath) == paths.end())
+			paths.push_back(_materials[i].texturePath);
+	return paths;
+}
+
+/* GPU timed section of each material, when profiling */
+static void profileMaterial(FrameProfiler *profiler, unsigned int &current, unsigned int material) {
+	if (profiler == nullptr || material == current)
+		return;
+	if (current != ~0u)
+		profiler->endSection();
+	current = material;
+	if (material != ~0u)
+		profiler->beginSection("material " + std::to_string(material), true);
+}
+
+void Model::draw(RenderState &state, const Frustum *frustum, const LodSelector *lod) {
+	unsigned int drawn = 0, culled = 0, occluded = 0;
+	FrameProfiler *profiler = state.getProfiler() != nullptr && state.getProfiler()->enabled() ? state.getProfiler() : nullptr;
+	unsigned int section = ~0u;
+	/* pixels spanned by meshes of each material order texture streaming */
+	bool demand = lod != nullptr && !_streams.empty();
+	if (demand)
+		std::fill(_textureDemand.begin(), _textureDemand.end(), 0.f);
+	if (!_batches.empty()) {
+		for (size_t i = 0; i < _batches.size(); i++) {
+			DrawBatch &batch = _batches[i];
+			GLsizei *counts = batch.counts.data();
+			void **offsets = batch.offsets.data();
+			GLint *baseVertices = batch.baseVertices.data();
+			GLsizei num = (GLsizei)batch.counts.size();
+			size_t triangles = 0;
+			if (frustum != nullptr || lod != nullptr) {
+				/* entries of this frame, at their level of detail */
+				_visibleCounts.clear();
+				_visibleOffsets.clear();
+				_visibleBaseVertices.clear();
+				for (size_t j = 0; j < batch.meshes.size(); j++) {
+					const Mesh *mesh = batch.meshes[j];
+					const MeshInfo &info = mesh->getInfo();
+					if (frustum != nullptr && !frustum->intersects(info.aabbMin, info.aabbMax))
+						continue;
+					unsigned int level = lod != nullptr ? lod->select(info) : 0;
+					if (demand)
+						_textureDemand[batch.materialIndex] = std::max(_textureDemand[batch.materialIndex], lod->pixelSize(info));
+					_visibleCounts.push_back(mesh->getIndexCount(level));
+					_visibleOffsets.push_back((void *)mesh->getIndexOffset(level));
+					_visibleBaseVertices.push_back(batch.baseVertices[j]);
+				}
+				culled += num - (GLsizei)_visibleCounts.size();
+				counts = _visibleCounts.data();
+				offsets = _visibleOffsets.data();
+				baseVertices = _visibleBaseVertices.data();
+				num = (GLsizei)_visibleCounts.size();
+				if (!num)
+					continue;
+			}
+			for (GLsizei j = 0; j < num; j++)
+				triangles += counts[j] / 3;
+			profileMaterial(profiler, section, batch.materialIndex);
+			batch.mesh->bindMaterial(state);
+			state.bindVertexArray(batch.VAO);
+			if (!state.flush())
+				continue;
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts, GL_UNSIGNED_INT, offsets, num, baseVertices);
+			state.countDraw((unsigned int)triangles);
+			drawn += num;
+		}
+		profileMaterial(profiler, section, ~0u);
+		state.countMeshes(drawn, culled, occluded);
+		return;
+	}
+
+	if (_occlusion && _queries.size() != _meshes.size())
+		createQueries();
+	bool occlusion = _occlusion;
+	_hidden.clear();
+	for (size_t k = 0; k < _drawOrder.size(); k++) {
+		size_t i = _drawOrder[k];
+		const MeshInfo &info = _meshes[i]->getInfo();
+		if (frustum != nullptr && !frustum->intersects(info.aabbMin, info.aabbMax)) {
+			++culled;
+			continue;
+		}
+		if (occlusion && isOccluded(i)) {
+			_hidden.push_back(i);
+			++occluded;
+			continue;
+		}
+		/* query a visible mesh only when the previous one is read, drawing never waits for results */
+		bool query = occlusion && !_queryPending[i];
+		profileMaterial(profiler, section, _meshMaterials[i]);
+		if (query)
+			glBeginQuery(GL_ANY_SAMPLES_PASSED, _queries[i]);
+		if (demand)
+			_textureDemand[_meshMaterials[i]] = std::max(_textureDemand[_meshMaterials[i]], lod->pixelSize(info));
+		_meshes[i]->draw(state, lod != nullptr ? lod->select(info) : 0);
+		if (query) {
+			glEndQuery(GL_ANY_SAMPLES_PASSED);
+			_queryPending[i] = 1;
+		}
+		++drawn;
+	}
+	profileMaterial(profiler, section, ~0u);
+	if (!_hidden.empty()) {
+		ProfileScope scope(profiler, "occlusion proxies", true);
+		drawProxies(state);
+	}
+	if (_loading && !_uploaded.empty()) {
+		ProfileScope scope(profiler, "preview boxes", true);
+		drawPreview(state);
+	}
+	state.countMeshes(drawn, culled, occluded);
+}
+
+void Model::drawInstanced(RenderState &state, const InstanceBuffer &instances) {
+	GLsizei instanceNum = (GLsizei)instances.getCount();
+	if (instances.empty() || !instanceNum)
+		return;
+	FrameProfiler *profiler = state.getProfiler() != nullptr && state.getProfiler()->enabled() ? state.getProfiler() : nullptr;
+	unsigned int section = ~0u;
+	state.setInt(UNIFORM_INSTANCED, 1);
+	for (size_t i = 0; i < _drawOrder.size(); i++) {
+		Mesh *mesh = _meshes[_drawOrder[i]];
+		profileMaterial(profiler, section, _meshMaterials[_drawOrder[i]]);
+		/* arena meshes share their VAO, it is set up once */
+		unsigned int &serial = _instanceSerials[mesh->getVAO()];
+		if (serial != instances.getSerial()) {
+			state.bindVertexArray(mesh->getVAO());
+			instances.setAttributes();
+			serial = instances.getSerial();
+		}
+		mesh->drawInstanced(state, instanceNum);
+	}
+	profileMaterial(profiler, section, ~0u);
+	state.setInt(UNIFORM_INSTANCED, 0);
+	state.countMeshes((unsigned int)_drawOrder.size(), 0, 0);
+}
+
+void Model::setOcclusionCulling(bool enable) { _occlusion = enable; }
+
+void Model::createQueries() {
+	size_t first = _queries.size();
+	_queries.resize(_meshes.size(), 0);
+	_queryPending.resize(_meshes.size(), 0);
+	_occluded.resize(_meshes.size(), 0);
+	glGenQueries((GLsizei)(_meshes.size() - first), _queries.data() + first);
+	if (_proxyBox == nullptr)
+		createProxyBox();
+}
+
+void Model::createProxyBox() {
+	/* unit cube in compact layout, placed on a mesh box by bounds uniforms */
+	GLushort vertices[8][6];
+	memset(vertices, 0, sizeof(vertices));
+	for (int i = 0; i < 8; i++)
+		for (int j = 0; j < 3; j++)
+			vertices[i][j] = (i >> j) & 1 ? 65535 : 0;
+	const GLuint indices[36] = {
+		0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,
+		0, 1, 4, 1, 5, 4,  2, 6, 3, 3, 6, 7,
+		0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5
+	};
+	MeshInfo info;
+	info.format = VERTEX_FORMAT_COMPACT;
+	info.texCoords = false;
+	info.vertexNum = 8;
+	info.faceNum = 12;
+	info.lodNum = 1;
+	memset(info.lodFaceNum, 0, sizeof(info.lodFaceNum));
+	info.lodFaceNum[0] = info.faceNum;
+	info.boundsMin = info.aabbMin = glm::vec3(0.f, 0.f, 0.f);
+	info.boundsMax = info.aabbMax = glm::vec3(1.f, 1.f, 1.f);
+	_proxyBox = new Mesh(info, vertices, indices, 0, aiColor3D(0.f, 0.f, 0.f));
+}
+
+void Model::drawPreview(RenderState &state) {
+	if (_proxyBox == nullptr)
+		createProxyBox();
+	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+	glDisable(GL_CULL_FACE);
+	state.setInt(UNIFORM_HAVE_TEXTURE, 0);
+	state.setInt(UNIFORM_COMPACT_VERTEX, 1);
+	state.bindVertexArray(_proxyBox->getVAO());
+	for (size_t i = 0; i < _preview.size(); i++) {
+		if (_uploaded[i])
+			continue;
+		const MeshInfo &info = _preview[i];
+		const aiColor3D &color = _colors != nullptr ? _colors[_previewMaterials[i]] : aiColor3D(.5f, .5f, .5f);
+		state.setVec3(UNIFORM_MATERIAL_COLOR, glm::vec3(color.r, color.g, color.b));
+		state.setVec3(UNIFORM_BOUNDS_MIN, info.aabbMin);
+		state.setVec3(UNIFORM_BOUNDS_EXTENT, info.aabbMax - info.aabbMin);
+		if (!state.flush())
+			continue;
+		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+		state.countDraw(12);
+	}
+	if (cullFace)
+		glEnable(GL_CULL_FACE);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+}
+
+bool Model::isOccluded(size_t i) {
+	if (_queryPending[i]) {
+		GLuint available = 0, samples = 0;
+		glGetQueryObjectuiv(_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available) {
+			glGetQueryObjectuiv(_queries[i], GL_QUERY_RESULT, &samples);
+			_occluded[i] = !samples;
+			_queryPending[i] = 0;
+		}
+	}
+	return _occluded[i] != 0;
+}
+
+void Model::drawProxies(RenderState &state) {
+	/* boxes are seen from inside when camera is in them, so both sides are drawn */
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+	glDisable(GL_CULL_FACE);
+	state.setInt(UNIFORM_COMPACT_VERTEX, 1);
+	state.bindVertexArray(_proxyBox->getVAO());
+	for (size_t k = 0; k < _hidden.size(); k++) {
+		size_t i = _hidden[k];
+		if (_queryPending[i])
+			continue;
+		const MeshInfo &info = _meshes[i]->getInfo();
+		state.setVec3(UNIFORM_BOUNDS_MIN, info.aabbMin);
+		state.setVec3(UNIFORM_BOUNDS_EXTENT, info.aabbMax - info.aabbMin);
+		if (!state.flush())
+			continue;
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, _queries[i]);
+		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+		_queryPending[i] = 1;
+		state.countDraw(12);
+	}
+	if (cullFace)
+		glEnable(GL_CULL_FACE);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void Model::buildHierarchies(double &time) {
+	Clock::time_point begin = Clock::now();
+	_bvhs.resize(_meshes.size(), nullptr);
+	std::vector<size_t> missing;
+	for (size_t j = 0; j < _meshes.size(); j++)
+		if (_bvhs[j] == nullptr)
+			missing.push_back(j);
+	if (missing.empty()) {
+		time = 0.0;
+		return;
+	}
+
+	/* no mesh data is kept on CPU after upload, buffers are read back on GL thread */
+	std::vector<std::vector<glm::vec3> > positions(missing.size());
+	std::vector<std::vector<GLuint> > indices(missing.size());
+	for (size_t k = 0; k < missing.size(); k++) {
+		const MeshInfo &info = _meshes[missing[k]]->getInfo();
+		if (!_meshes[missing[k]]->readBack(positions[k], indices[k], inArena(info) ? _arenas[info.texCoords] : nullptr)) {
+			/* mesh stays unpickable */
+			std::cout << "Fail to read back mesh[" << _meshSources[missing[k]] << "] ." << std::endl;
+			positions[k].clear();
+			indices[k].clear();
+		}
+	}
+	/* large meshes split their own build further on the same pool */
+	ThreadPool::shared().parallelFor(missing.size(), [&](size_t k) {
+		_bvhs[missing[k]] = new MeshBVH(positions[k], indices[k]);
+		std::vector<GLuint>().swap(indices[k]);
+	});
+	time = elapsed(begin);
+}
+
+bool Model::pick(const glm::vec3 &origin, const glm::vec3 &direction, PickResult &result) {
+	if (!_exist || _loading)
+		return false;
+	buildHierarchies(result.buildTime);
+
+	Clock::time_point begin = Clock::now();
+	float nearest = std::numeric_limits<float>::infinity();
+	bool found = false;
+	for (size_t j = 0; j < _bvhs.size(); j++) {
+		/* root box skips meshes off the ray or behind nearest hit so far */
+		MeshBVH::Hit hit;
+		if (!_bvhs[j]->intersect(origin, direction, nearest, hit))
+			continue;
+		nearest = hit.distance;
+		result.mesh = _meshSources[j];
+		result.triangle = hit.triangle;
+		found = true;
+	}
+	if (found) {
+		result.distance = nearest;
+		result.point = origin + direction * nearest;
+	}
+	result.queryTime = elapsed(begin);
+	return found;
+}
+
+const glm::vec3 & Model::getCenter() const { return _center; }
+
+GLfloat Model::getMaxDistance() const { return _maxDistance; }
+
+bool Model::loading() const { return _loading; }
+
+bool Model::streaming() const { return !_streams.empty(); }
+
+const LoadStats & Model::getLoadStats() const { return _stats; }
+
+MemoryUsage Model::getMemory() const {
+	MemoryUsage usage;
+	memset(&usage, 0, sizeof(MemoryUsage));
+	usage.host = sizeof(Model) + _meshes.capacity() * (sizeof(Mesh *) + sizeof(MeshBVH *) + 2 * sizeof(unsigned int))
+		+ _drawOrder.capacity() * sizeof(size_t) + _textureNum * (sizeof(GLuint) + sizeof(aiColor3D));
+	for (size_t i = 0; i < _meshes.size(); i++) {
+		MemoryUsage mesh = _meshes[i]->getMemory();
+		usage.host += mesh.host;
+		/* arena buffers count once as reserved */
+		if (!_meshes[i]->isShared())
+			usage.buffers += mesh.buffers;
+	}
+	for (size_t i = 0; i < _bvhs.size(); i++)
+		if (_bvhs[i] != nullptr)
+			usage.host += _bvhs[i]->getMemory();
+	for (size_t i = 0; i < _arenas.size(); i++)
+		if (_arenas[i] != nullptr)
+			usage.buffers += _arenas[i]->getMemory();
+	for (size_t i = 0; i < _batches.size(); i++) {
+		const DrawBatch &batch = _batches[i];
+		usage.host += sizeof(DrawBatch) + batch.meshes.capacity() * sizeof(const Mesh *) + batch.counts.capacity() * sizeof(GLsizei)
+			+ batch.offsets.capacity() * sizeof(void *) + batch.baseVertices.capacity() * sizeof(GLint);
+	}
+	if (_proxyBox != nullptr)
+		usage.buffers += _proxyBox->getMemory().buffers;
+	/* levels still streaming are kept on CPU */
+	for (size_t i = 0; i < _streams.size(); i++)
+		for (unsigned int level = 0; level < _streams[i]->base + _streams[i]->skip; level++)
+			usage.host += _streams[i]->source->levelBytes(level);
+	/* materials sharing an image hold one texture */
+	std::vector<GLuint> textures;
+	for (GLsizei i = 0; i < _textureNum; i++)
+		if (_textures[i])
+			textures.push_back(_textures[i]);
+	std::sort(textures.begin(), textures.end());
+	textures.erase(std::unique(textures.begin(), textures.end()), textures.end());
+	for (size_t i = 0; i < textures.size(); i++)
+		usage.textures += TextureLibrary::shared().getBytes(textures[i]);
+	return usage;
+}
+
+std::vector<MemoryUsage> Model::getMeshMemory() const {
+	unsigned int num = 0;
+	for (size_t i = 0; i < _meshSources.size(); i++)
+		num = std::max(num, _meshSources[i] + 1);
+	MemoryUsage none;
+	memset(&none, 0, sizeof(MemoryUsage));
+	std::vector<MemoryUsage> usage(num, none);
+	for (size_t i = 0; i < _meshes.size(); i++) {
+		MemoryUsage &mesh = usage[_meshSources[i]];
+		mesh = _meshes[i]->getMemory();
+		if (i < _bvhs.size() && _bvhs[i] != nullptr)
+			mesh.host += _bvhs[i]->getMemory();
+	}
+	return usage;
+}
+
+std::vector<size_t> Model::getTextureMemory() const {
+	std::vector<size_t> bytes(_textureNum, 0);
+	for (GLsizei i = 0; i < _textureNum; i++)
+		if (_textures[i])
+			bytes[i] = TextureLibrary::shared().getBytes(_textures[i]);
+	return bytes;
+}
+
+size_t Model::videoMemory() {
+	/* ATI_meminfo only tells free memory, which depends on what else runs, it is not used */
+	GLint kilobytes = 0;
+	if (GLEW_NVX_gpu_memory_info)
+		glGetIntegerv(GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX, &kilobytes);
+	return (size_t)std::max(kilobytes, 0) * 1024;
 }
 
 const std::string & Model::getErrorInfo() const { return _errorInfo; }
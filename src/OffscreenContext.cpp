@@ -0,0 +1,113 @@
+#ifndef _WIN32
+
+#include "OffscreenContext.h"
+#include <EGL/eglext.h>
+#include <cstring>
+
+bool OffscreenContext::create(int major, int minor) {
+	EGLint version[2];
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay) {
+		_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (_display != EGL_NO_DISPLAY && !eglInitialize(_display, version, version + 1))
+			_display = EGL_NO_DISPLAY;
+	}
+#endif
+	if (_display == EGL_NO_DISPLAY) {
+		_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (_display == EGL_NO_DISPLAY || !eglInitialize(_display, version, version + 1)) {
+			_display = EGL_NO_DISPLAY;
+			_errorInfo = "Fail to initialize EGL display .";
+			return false;
+		}
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		_errorInfo = "EGL does not support OpenGL .";
+		return false;
+	}
+
+	const char *extensions = eglQueryString(_display, EGL_EXTENSIONS);
+	bool surfaceless = extensions && strstr(extensions, "EGL_KHR_surfaceless_context");
+	EGLint configAttributes[] = {
+		EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config = nullptr;
+	EGLint configNum = 0;
+	if (!eglChooseConfig(_display, configAttributes, &config, 1, &configNum) || !configNum) {
+		if (!surfaceless || !strstr(extensions, "EGL_KHR_no_config_context")) {
+			_errorInfo = "Fail to choose EGL config .";
+			return false;
+		}
+		config = nullptr;/* EGL_NO_CONFIG_KHR */
+	}
+
+	EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, major,
+		EGL_CONTEXT_MINOR_VERSION, minor,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	_context = eglCreateContext(_display, config, EGL_NO_CONTEXT, contextAttributes);
+	if (_context == EGL_NO_CONTEXT) {
+		_errorInfo = "Fail to create EGL context .";
+		return false;
+	}
+
+	if (!surfaceless) {
+		EGLint surfaceAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		_surface = eglCreatePbufferSurface(_display, config, surfaceAttributes);
+		if (_surface == EGL_NO_SURFACE) {
+			_errorInfo = "Fail to create EGL pbuffer .";
+			return false;
+		}
+	}
+	if (!eglMakeCurrent(_display, _surface, _surface, _context)) {
+		_errorInfo = "Fail to make EGL context current .";
+		return false;
+	}
+	return true;
+}
+
+OffscreenContext::OffscreenContext(int major, int minor) {
+	_exist = false;
+	_errorInfo = "";
+	_display = EGL_NO_DISPLAY;
+	_context = EGL_NO_CONTEXT;
+	_surface = EGL_NO_SURFACE;
+
+	if (!create(major, minor))
+		return;
+
+	/* EGL contexts have no GLX display, GLEW still loads the core entry points */
+	glewExperimental = GL_TRUE;
+	GLenum result = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	if (result == GLEW_ERROR_NO_GLX_DISPLAY)
+		result = GLEW_OK;
+#endif
+	if (result != GLEW_OK) {
+		_errorInfo = "Fail to initialize GLEW .";
+		return;
+	}
+	_exist = true;
+}
+
+OffscreenContext::~OffscreenContext() {
+	if (_context != EGL_NO_CONTEXT) {
+		eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(_display, _context);
+	}
+	if (_surface != EGL_NO_SURFACE)
+		eglDestroySurface(_display, _surface);
+	if (_display != EGL_NO_DISPLAY)
+		eglTerminate(_display);
+}
+
+const std::string & OffscreenContext::getErrorInfo() const { return _errorInfo; }
+
+bool OffscreenContext::empty() const { return !_exist; }
+
+#endif // _WIN32
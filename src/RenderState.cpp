@@ -0,0 +1,184 @@
+#include "RenderState.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <cstring>
+
+namespace {
+
+/* how a uniform reaches the program */
+enum UniformType {
+	TYPE_FEATURE,/* selects permutation */
+	TYPE_VEC3,
+	TYPE_MAT3,
+	TYPE_MAT4
+};
+
+struct UniformDescription {
+	const char *name;/* in model shaders */
+	UniformType type;
+	unsigned int feature;/* ShaderFeature of TYPE_FEATURE */
+};
+
+const UniformDescription uniforms[UNIFORM_NUM] = {
+	{ "positionMatrix", TYPE_MAT4, 0 },
+	{ "normalMatrix", TYPE_MAT3, 0 },
+	{ "projection", TYPE_MAT4, 0 },
+	{ "useLight", TYPE_FEATURE, SHADER_LIGHT },
+	{ "haveTexture", TYPE_FEATURE, SHADER_TEXTURE },
+	{ "materialColor", TYPE_VEC3, 0 },
+	{ "compactVertex", TYPE_FEATURE, SHADER_COMPACT_VERTEX },
+	{ "boundsMin", TYPE_VEC3, 0 },
+	{ "boundsExtent", TYPE_VEC3, 0 },
+	{ "instanced", TYPE_FEATURE, SHADER_INSTANCED }
+};
+
+size_t valueSize(UniformType type) {
+	switch (type) {
+	case TYPE_VEC3: return 3 * sizeof(GLfloat);
+	case TYPE_MAT3: return 9 * sizeof(GLfloat);
+	case TYPE_MAT4: return 16 * sizeof(GLfloat);
+	default: return 0;
+	}
+}
+
+}
+
+RenderState::RenderState(ShaderLibrary &library) : _library(library) {
+	_profiler = nullptr;
+	_features = 0;
+	memset(_programs, 0, sizeof(_programs));
+	memset(_set, 0, sizeof(_set));
+	memset(&_counters, 0, sizeof(RenderCounters));
+	invalidate();
+}
+
+void RenderState::beginFrame() {
+	_VAO_ID = _texture = ~0u;
+	memset(&_counters, 0, sizeof(RenderCounters));
+}
+
+void RenderState::invalidate() {
+	_VAO_ID = _texture = ~0u;
+	_current = SHADER_PERMUTATION_NUM;
+	for (unsigned int i = 0; i < SHADER_PERMUTATION_NUM; i++)
+		memset(_programs[i].known, 0, sizeof(_programs[i].known));
+	/* values set before are sent again */
+	_dirty = ~0u;
+}
+
+void RenderState::update(Uniform uniform, const void *value, size_t size) {
+	++_counters.lookupCalls;
+	if (_set[uniform] && !memcmp(_values[uniform], value, size)) {
+		++_counters.redundantCalls;
+		return;
+	}
+	memcpy(_values[uniform], value, size);
+	_set[uniform] = true;
+	_dirty |= 1u << uniform;
+}
+
+bool RenderState::flush() {
+	if (_current != _features) {
+		Program &program = _programs[_features];
+		if (!program.id) {
+			/* library remembers a failed build, asking again is cheap */
+			program.id = _library.getProgram(_features);
+			if (!program.id)
+				return false;
+			for (int i = 0; i < UNIFORM_NUM; i++)
+				program.locations[i] = uniforms[i].type == TYPE_FEATURE ? -1 : glGetUniformLocation(program.id, uniforms[i].name);
+		}
+		glUseProgram(program.id);
+		_current = _features;
+		++_counters.programSwitches;
+		++_counters.stateCalls;
+		/* program may hold older values of any uniform */
+		_dirty = ~0u;
+	}
+	if (!_dirty)
+		return true;
+	Program &program = _programs[_current];
+	for (int i = 0; i < UNIFORM_NUM; i++) {
+		if (!(_dirty & (1u << i)) || !_set[i] || uniforms[i].type == TYPE_FEATURE)
+			continue;
+		size_t size = valueSize(uniforms[i].type);
+		if (program.known[i] && !memcmp(program.values[i], _values[i], size)) {
+			++_counters.redundantCalls;
+			continue;
+		}
+		memcpy(program.values[i], _values[i], size);
+		program.known[i] = true;
+		if (program.locations[i] < 0)
+			continue;
+		++_counters.stateCalls;
+		switch (uniforms[i].type) {
+		case TYPE_VEC3: glUniform3fv(program.locations[i], 1, _values[i]); break;
+		case TYPE_MAT3: glUniformMatrix3fv(program.locations[i], 1, GL_FALSE, _values[i]); break;
+		case TYPE_MAT4: glUniformMatrix4fv(program.locations[i], 1, GL_FALSE, _values[i]); break;
+		default: break;
+		}
+	}
+	_dirty = 0;
+	return true;
+}
+
+void RenderState::bindVertexArray(GLuint VAO) {
+	if (VAO == _VAO_ID) {
+		++_counters.redundantCalls;
+		return;
+	}
+	_VAO_ID = VAO;
+	glBindVertexArray(VAO);
+	++_counters.stateCalls;
+}
+
+void RenderState::bindTexture(GLuint texture) {
+	if (texture == _texture) {
+		++_counters.redundantCalls;
+		return;
+	}
+	_texture = texture;
+	glBindTexture(GL_TEXTURE_2D, texture);
+	++_counters.stateCalls;
+}
+
+void RenderState::setInt(Uniform uniform, GLint value) {
+	/* model shaders have no integer uniform left, each one is a feature */
+	unsigned int feature = uniforms[uniform].feature;
+	++_counters.lookupCalls;
+	if (!(_features & feature) == !value) {
+		++_counters.redundantCalls;
+		return;
+	}
+	_features = value ? _features | feature : _features & ~feature;
+}
+
+void RenderState::setVec3(Uniform uniform, const glm::vec3 &value) {
+	update(uniform, glm::value_ptr(value), sizeof(value));
+}
+
+void RenderState::setMat3(Uniform uniform, const glm::mat3 &value) {
+	update(uniform, glm::value_ptr(value), sizeof(value));
+}
+
+void RenderState::setMat4(Uniform uniform, const glm::mat4 &value) {
+	update(uniform, glm::value_ptr(value), sizeof(value));
+}
+
+void RenderState::countDraw(unsigned int triangles) {
+	++_counters.drawCalls;
+	_counters.trianglesDrawn += triangles;
+}
+
+void RenderState::countMeshes(unsigned int drawn, unsigned int culled, unsigned int occluded) {
+	_counters.meshesDrawn += drawn;
+	_counters.meshesCulled += culled;
+	_counters.meshesOccluded += occluded;
+}
+
+const RenderCounters & RenderState::getCounters() const { return _counters; }
+
+GLuint RenderState::getProgram() const { return _current < SHADER_PERMUTATION_NUM ? _programs[_current].id : 0; }
+
+void RenderState::setProfiler(FrameProfiler *profiler) { _profiler = profiler; }
+
+FrameProfiler * RenderState::getProfiler() const { return _profiler; }
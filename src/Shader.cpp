@@ -0,0 +1,152 @@
+#include "Shader.h"
+#include <iostream>
+
+const char *vertexShaderSource =
+"layout(location = 0) in vec3 position;\n"
+"layout(location = 2) in vec3 normal;\n"
+"layout(location = 3) in vec2 uv;\n"
+"#ifdef INSTANCED\n"
+"layout(location = 4) in mat4 instanceMatrix;\n"
+"#endif\n"
+"out Vertex {\n"
+"	vec3 position;\n"
+"	vec3 normal;\n"
+"	vec2 uv;\n"
+"} vertex;\n"
+"uniform mat4 positionMatrix;\n"
+"uniform mat4 projection;\n"
+"#ifdef COMPACT_VERTEX\n"
+"uniform vec3 boundsMin;\n"
+"uniform vec3 boundsExtent;\n"
+"vec3 decodeNormal(vec2 e) {\n"
+"	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+"	if(n.z < 0.0)\n"
+"		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n"
+"	return normalize(n);\n"
+"}\n"
+"#endif\n"
+"void main() {\n"
+"#ifdef COMPACT_VERTEX\n"
+"	vec3 objectPosition = boundsMin + position * boundsExtent;\n"
+"	vec3 objectNormal = decodeNormal(normal.xy);\n"
+"#else\n"
+"	vec3 objectPosition = position;\n"
+"	vec3 objectNormal = normal;\n"
+"#endif\n"
+"#ifdef INSTANCED\n"
+"	vec4 vertexPosition = positionMatrix * instanceMatrix * vec4(objectPosition, 1.0);\n"
+"	vertex.normal = mat3(instanceMatrix) * objectNormal;\n"
+"#else\n"
+"	vec4 vertexPosition = positionMatrix * vec4(objectPosition, 1.0);\n"
+"	vertex.normal = objectNormal;\n"
+"#endif\n"
+"	vertex.position = vertexPosition.xyz;\n"
+"	vertex.uv = uv;\n"
+"	gl_Position = projection * vertexPosition;\n"
+"}\n";
+
+const char *fragmentShaderSource =
+"in Vertex {\n"
+"	vec3 position;\n"
+"	vec3 normal;\n"
+"	vec2 uv;\n"
+"} vertex;\n"
+"out vec4 Color;\n"
+"uniform mat3 normalMatrix;\n"
+"uniform sampler2D sampler;\n"
+"uniform vec3 materialColor;\n"
+"void main() {\n"
+"#ifdef HAVE_TEXTURE\n"
+"	vec3 color = texture(sampler, vertex.uv).rgb;\n"
+"#else\n"
+"	vec3 color = materialColor;\n"
+"#endif\n"
+"#ifdef USE_LIGHT\n"
+"	vec3 lightPosition = vec3(0.0, 0.0, 2.0);\n"
+"	vec3 ambient = color * 0.05;\n"
+"	vec3 normal = normalize(normalMatrix * vertex.normal);\n"
+"	vec3 lightDirection = normalize(lightPosition - vertex.position);\n"
+"	vec3 diffuse = max(dot(lightDirection, normal), 0.0) * color;\n"
+"	Color = vec4(ambient + diffuse, 1.0);\n"
+"#else\n"
+"	Color = vec4(color, 1.0);\n"
+"#endif\n"
+"}\n";
+
+GLuint createProgram(const char *vertexSource, const char *fragmentSource, bool retrievable) {
+	GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
+	if (!vertexShaderId) {
+		std::cout << "Fail to create vertex_shader ." << std::endl;
+		return 0;
+	}
+	glShaderSource(vertexShaderId, 1, &vertexSource, NULL);
+	glCompileShader(vertexShaderId);
+	if (!check(vertexShaderId, GL_VERTEX_SHADER, GL_COMPILE_STATUS)) {
+		glDeleteShader(vertexShaderId);
+		return 0;
+	}
+
+	GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+	if (!fragmentShaderId) {
+		std::cout << "Fail to create fragment_shader ." << std::endl;
+		glDeleteShader(vertexShaderId);
+		return 0;
+	}
+	glShaderSource(fragmentShaderId, 1, &fragmentSource, NULL);
+	glCompileShader(fragmentShaderId);
+	if (!check(fragmentShaderId, GL_FRAGMENT_SHADER, GL_COMPILE_STATUS)) {
+		glDeleteShader(vertexShaderId);
+		glDeleteShader(fragmentShaderId);
+		return 0;
+	}
+
+	GLuint programId = glCreateProgram();
+	if (!programId) {
+		std::cout << "Fail to create program ." << std::endl;
+		glDeleteShader(vertexShaderId);
+		glDeleteShader(fragmentShaderId);
+		return 0;
+	}
+	glAttachShader(programId, vertexShaderId);
+	glAttachShader(programId, fragmentShaderId);
+	/* drivers may keep a binary only when told before linking */
+	if (retrievable)
+		glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(programId);
+	glDeleteShader(vertexShaderId);
+	glDeleteShader(fragmentShaderId);
+	if (!check(programId, 0, GL_LINK_STATUS)) {
+		glDeleteProgram(programId);
+		return 0;
+	}
+	return programId;
+}
+
+bool check(GLuint id, GLenum id_type, GLenum target_type) {
+	int success;
+	char infoLog[1024];
+	if (target_type == GL_COMPILE_STATUS) {/* check shaders compile */
+		glGetShaderiv(id, target_type, &success);
+		if (!success) {
+			std::cout << "Fail to compile ";
+			if (id_type == GL_VERTEX_SHADER)
+				std::cout << "vertex_shader :" << std::endl;
+			else if (id_type == GL_FRAGMENT_SHADER)
+				std::cout << "fragment_shader :" << std::endl;
+			else if (id_type == GL_GEOMETRY_SHADER)
+				std::cout << "geometry_shader :" << std::endl;
+			glGetShaderInfoLog(id, 1024, NULL, infoLog);
+			std::cout << infoLog << std::endl;
+			return false;
+		}
+	} else if (target_type == GL_LINK_STATUS) {/* check program link */
+		glGetProgramiv(id, target_type, &success);
+		if (!success) {
+			std::cout << "Fail to link program :" << std::endl;
+			glGetProgramInfoLog(id, 1024, NULL, infoLog);
+			std::cout << infoLog << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
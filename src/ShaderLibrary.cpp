@@ -0,0 +1,236 @@
+#include "ShaderLibrary.h"
+#include "Shader.h"
+#include <sys/stat.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const char MAGIC[4] = { 'M', 'V', 'P', 'B' };
+const char VERSION_LINE[] = "#version 330 core\n";
+/* define of each feature bit */
+const char *featureDefines[] = { "HAVE_TEXTURE", "USE_LIGHT", "COMPACT_VERTEX", "INSTANCED" };
+
+struct BinaryHeader {
+	char magic[4];
+	unsigned int version;
+	unsigned long long key;/* hash of driver and sources */
+	unsigned int format;/* binary format of driver */
+	unsigned int length;/* bytes of binary following header */
+};
+
+/* 64 bit FNV-1a */
+unsigned long long hashString(const std::string &text, unsigned long long hash) {
+	for (size_t i = 0; i < text.size(); i++)
+		hash = (hash ^ (unsigned char)text[i]) * 1099511628211ull;
+	return hash;
+}
+
+unsigned long long programKey(const std::string &driver, const std::string &vertexSource, const std::string &fragmentSource) {
+	/* separators keep "ab"+"c" and "a"+"bc" apart */
+	unsigned long long hash = hashString(driver, 14695981039346656037ull);
+	hash = hashString(vertexSource, (hash ^ 0xff) * 1099511628211ull);
+	return hashString(fragmentSource, (hash ^ 0xff) * 1099511628211ull);
+}
+
+const char * glString(GLenum name) {
+	const GLubyte *value = glGetString(name);
+	return value ? (const char *)value : "";
+}
+
+/* create directory and its missing parents */
+bool makeDirectories(const std::string &path) {
+	struct stat status;
+	if (!stat(path.c_str(), &status))
+		return (status.st_mode & S_IFDIR) != 0;
+	size_t pos = path.find_last_of("/\\");
+	if (pos != std::string::npos && pos && !makeDirectories(path.substr(0, pos)))
+		return false;
+#ifdef _WIN32
+	return !_mkdir(path.c_str()) || !stat(path.c_str(), &status);
+#else
+	return !mkdir(path.c_str(), 0755) || !stat(path.c_str(), &status);
+#endif
+}
+
+}
+
+ShaderLibrary::ShaderLibrary(const std::string &cacheDirectory) {
+	_exist = false;
+	memset(_programs, 0, sizeof(_programs));
+	memset(_failed, 0, sizeof(_failed));
+	memset(&_stats, 0, sizeof(Stats));
+	_driver = std::string(glString(GL_VENDOR)) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION);
+	/* a driver may support the extension but no format at all */
+	GLint formatNum = 0;
+	if (GLEW_ARB_get_program_binary)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatNum);
+	_binaries = formatNum > 0;
+	if (_binaries && !cacheDirectory.empty()) {
+		if (makeDirectories(cacheDirectory))
+			_cacheDirectory = cacheDirectory;
+		else
+			_errorInfo = "Fail to create shader cache directory " + cacheDirectory + " .";
+	}
+	/* base permutation proves that sources compile */
+	if (!getProgram(0)) {
+		_errorInfo = "Fail to build model program .";
+		return;
+	}
+	_exist = true;
+}
+
+ShaderLibrary::~ShaderLibrary() {
+	for (unsigned int i = 0; i < SHADER_PERMUTATION_NUM; i++)
+		if (_programs[i])
+			glDeleteProgram(_programs[i]);
+}
+
+void ShaderLibrary::sources(unsigned int features, std::string &vertexSource, std::string &fragmentSource) const {
+	std::string defines = VERSION_LINE;
+	for (unsigned int i = 0; i < sizeof(featureDefines) / sizeof(featureDefines[0]); i++)
+		if (features & (1u << i))
+			defines += std::string("#define ") + featureDefines[i] + "\n";
+	vertexSource = defines + vertexShaderSource;
+	fragmentSource = defines + fragmentShaderSource;
+}
+
+std::string ShaderLibrary::cachePath(unsigned long long key) const {
+	char name[32];
+	snprintf(name, sizeof(name), "program_%016llx.bin", key);
+	return _cacheDirectory + "/" + name;
+}
+
+GLuint ShaderLibrary::load(const std::string &path, unsigned long long key) const {
+	std::ifstream file(path.c_str(), std::ios::binary);
+	if (!file)
+		return 0;
+	BinaryHeader header;
+	if (!file.read((char *)&header, sizeof(BinaryHeader)) || memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION
+		|| header.key != key || !header.length)
+		return 0;
+	std::vector<char> binary(header.length);
+	if (!file.read(binary.data(), binary.size()))
+		return 0;
+	GLuint programId = glCreateProgram();
+	if (!programId)
+		return 0;
+	glProgramBinary(programId, header.format, binary.data(), (GLsizei)binary.size());
+	/* drivers refuse binaries of other versions by failing to link */
+	GLint linked = GL_FALSE;
+	glGetProgramiv(programId, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		glDeleteProgram(programId);
+		return 0;
+	}
+	return programId;
+}
+
+bool ShaderLibrary::save(GLuint programId, const std::string &path, unsigned long long key) const {
+	GLint length = 0;
+	glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return false;
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(programId, length, &length, &format, binary.data());
+	if (length <= 0)
+		return false;
+	BinaryHeader header;
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.key = key;
+	header.format = format;
+	header.length = (unsigned int)length;
+	/* write into temporary file so that another viewer never reads a partial binary */
+	std::ostringstream tempFile;
+	tempFile << path << "." << getpid() << "." << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+	std::ofstream file(tempFile.str().c_str(), std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+	file.write((const char *)&header, sizeof(BinaryHeader));
+	file.write(binary.data(), length);
+	file.close();
+	if (!file) {
+		std::remove(tempFile.str().c_str());
+		return false;
+	}
+	/* rename does not replace existing file on Windows */
+	std::remove(path.c_str());
+	if (std::rename(tempFile.str().c_str(), path.c_str())) {
+		std::remove(tempFile.str().c_str());
+		return false;
+	}
+	return true;
+}
+
+GLuint ShaderLibrary::build(unsigned int features) {
+	std::string vertexSource, fragmentSource;
+	sources(features, vertexSource, fragmentSource);
+	unsigned long long key = programKey(_driver, vertexSource, fragmentSource);
+	std::string path = _cacheDirectory.empty() ? "" : cachePath(key);
+	if (!path.empty()) {
+		GLuint programId = load(path, key);
+		if (programId) {
+			++_stats.loaded;
+			return programId;
+		}
+	}
+	GLuint programId = createProgram(vertexSource.c_str(), fragmentSource.c_str(), _binaries);
+	if (!programId)
+		return 0;
+	++_stats.compiled;
+	if (!path.empty() && !save(programId, path, key))
+		_errorInfo = "Fail to write shader cache " + path + " .";
+	return programId;
+}
+
+GLuint ShaderLibrary::getProgram(unsigned int features) {
+	features &= SHADER_PERMUTATION_NUM - 1;
+	if (_programs[features] || _failed[features])
+		return _programs[features];
+	Clock::time_point begin = Clock::now();
+	_programs[features] = build(features);
+	_failed[features] = !_programs[features];
+	/* failure is remembered, reported once */
+	if (_failed[features])
+		std::cout << "Fail to build shader permutation " << features << ", meshes needing it are not drawn ." << std::endl;
+	_stats.time += std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+	return _programs[features];
+}
+
+const ShaderLibrary::Stats & ShaderLibrary::getStats() const { return _stats; }
+
+const std::string & ShaderLibrary::getErrorInfo() const { return _errorInfo; }
+
+bool ShaderLibrary::empty() const { return !_exist; }
+
+std::string ShaderLibrary::defaultCacheDirectory() {
+#ifdef _WIN32
+	const char *base = getenv("LOCALAPPDATA");
+	return base && *base ? std::string(base) + "\\ModelViewer" : "";
+#else
+	const char *base = getenv("XDG_CACHE_HOME");
+	if (base && *base)
+		return std::string(base) + "/ModelViewer";
+	const char *home = getenv("HOME");
+	return home && *home ? std::string(home) + "/.cache/ModelViewer" : "";
+#endif
+}
@@ -0,0 +1,249 @@
+#include "Simplifier.h"
+#include <glm/glm.hpp>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+
+namespace {
+
+/* open borders weigh more than surface error so that holes do not grow */
+const double BORDER_WEIGHT = 10.0;
+
+/* symmetric 4x4 matrix of squared distances to planes */
+struct Quadric {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+	Quadric() { memset(this, 0, sizeof(Quadric)); }
+
+	Quadric(const glm::dvec3 &n, double d, double weight) {
+		a2 = weight * n.x * n.x; ab = weight * n.x * n.y; ac = weight * n.x * n.z; ad = weight * n.x * d;
+		b2 = weight * n.y * n.y; bc = weight * n.y * n.z; bd = weight * n.y * d;
+		c2 = weight * n.z * n.z; cd = weight * n.z * d;
+		d2 = weight * d * d;
+	}
+
+	Quadric & operator+=(const Quadric &q) {
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+		return *this;
+	}
+
+	double error(const glm::dvec3 &v) const {
+		return a2 * v.x * v.x + 2.0 * ab * v.x * v.y + 2.0 * ac * v.x * v.z + 2.0 * ad * v.x
+			+ b2 * v.y * v.y + 2.0 * bc * v.y * v.z + 2.0 * bd * v.y
+			+ c2 * v.z * v.z + 2.0 * cd * v.z + d2;
+	}
+};
+
+struct Collapse {
+	double cost;
+	GLuint from, to;
+	unsigned int fromStamp, toStamp;/* vertex stamps when pushed, entry is stale when they changed */
+
+	bool operator>(const Collapse &c) const { return cost > c.cost; }
+};
+
+/* exact position, vertices split by normals or texture coords share it */
+struct PositionKey {
+	unsigned int bits[3];
+
+	bool operator==(const PositionKey &k) const { return !memcmp(bits, k.bits, sizeof(bits)); }
+};
+
+struct PositionHash {
+	size_t operator()(const PositionKey &k) const { return k.bits[0] * 73856093u ^ k.bits[1] * 19349663u ^ k.bits[2] * 83492791u; }
+};
+
+unsigned long long edgeKey(GLuint a, GLuint b) {
+	return a < b ? (unsigned long long)a << 32 | b : (unsigned long long)b << 32 | a;
+}
+
+glm::dvec3 toVec(const aiVector3D &v) {
+	return glm::dvec3(v.x, v.y, v.z);
+}
+
+class Simplifier {
+private:
+	const aiVector3D *_positions;
+	std::vector<GLuint> _corners;/* vertex of each triangle corner */
+	std::vector<GLuint> _triangles;/* position representative of each corner */
+	std::vector<char> _removedTriangle, _removedVertex;
+	std::vector<std::vector<GLuint> > _adjacency;/* triangles around representative, may hold stale entries */
+	std::vector<Quadric> _quadrics;
+	std::vector<unsigned int> _stamps;
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse> > _queue;
+	size_t _triangleNum;/* triangles not removed */
+
+	bool contains(GLuint t, GLuint v) const {
+		return _triangles[3 * t] == v || _triangles[3 * t + 1] == v || _triangles[3 * t + 2] == v;
+	}
+
+	/* push cheaper direction of edge */
+	void push(GLuint a, GLuint b) {
+		Quadric q = _quadrics[a];
+		q += _quadrics[b];
+		double costAB = q.error(toVec(_positions[b])), costBA = q.error(toVec(_positions[a]));
+		Collapse c;
+		c.cost = costAB <= costBA ? costAB : costBA;
+		c.from = costAB <= costBA ? a : b;
+		c.to = costAB <= costBA ? b : a;
+		c.fromStamp = _stamps[c.from];
+		c.toStamp = _stamps[c.to];
+		_queue.push(c);
+	}
+
+	/* moving from onto to turns over a remaining triangle */
+	bool flips(GLuint from, GLuint to) const {
+		const std::vector<GLuint> &around = _adjacency[from];
+		for (size_t i = 0; i < around.size(); i++) {
+			GLuint t = around[i];
+			if (_removedTriangle[t] || !contains(t, from) || contains(t, to))
+				continue;
+			glm::dvec3 p[3], q[3];
+			for (int j = 0; j < 3; j++) {
+				GLuint v = _triangles[3 * t + j];
+				p[j] = toVec(_positions[v]);
+				q[j] = toVec(_positions[v == from ? to : v]);
+			}
+			glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]), after = glm::cross(q[1] - q[0], q[2] - q[0]);
+			if (glm::dot(before, after) <= 0.0)
+				return true;
+		}
+		return false;
+	}
+
+	void collapse(GLuint from, GLuint to) {
+		std::vector<GLuint> &around = _adjacency[from];
+		for (size_t i = 0; i < around.size(); i++) {
+			GLuint t = around[i];
+			if (_removedTriangle[t] || !contains(t, from))
+				continue;
+			if (contains(t, to)) {
+				_removedTriangle[t] = 1;
+				--_triangleNum;
+				continue;
+			}
+			/* corner takes attributes of representative, seams of moved vertices are lost */
+			for (int j = 0; j < 3; j++)
+				if (_triangles[3 * t + j] == from)
+					_triangles[3 * t + j] = _corners[3 * t + j] = to;
+			_adjacency[to].push_back(t);
+		}
+		std::vector<GLuint>().swap(around);
+		_removedVertex[from] = 1;
+		_quadrics[to] += _quadrics[from];
+		++_stamps[to];
+
+		/* drop stale entries and queue edges around merged vertex again */
+		std::vector<GLuint> &merged = _adjacency[to];
+		size_t n = 0;
+		for (size_t i = 0; i < merged.size(); i++) {
+			GLuint t = merged[i];
+			if (_removedTriangle[t] || !contains(t, to))
+				continue;
+			merged[n++] = t;
+			for (int j = 0; j < 3; j++)
+				if (_triangles[3 * t + j] != to)
+					push(to, _triangles[3 * t + j]);
+		}
+		merged.resize(n);
+	}
+
+public:
+	Simplifier(const aiVector3D *positions, unsigned int vertexNum, const std::vector<GLuint> &indices) {
+		_positions = positions;
+		_corners = indices;
+		_triangles.resize(indices.size());
+		_removedTriangle.assign(indices.size() / 3, 0);
+		_removedVertex.assign(vertexNum, 0);
+		_adjacency.resize(vertexNum);
+		_quadrics.resize(vertexNum);
+		_stamps.assign(vertexNum, 0);
+		_triangleNum = 0;
+
+		/* first vertex at a position represents all vertices there */
+		std::unordered_map<PositionKey, GLuint, PositionHash> representatives;
+		representatives.reserve(vertexNum);
+		std::vector<GLuint> representative(vertexNum);
+		for (unsigned int v = 0; v < vertexNum; v++) {
+			PositionKey key;
+			memcpy(key.bits, &positions[v], sizeof(key.bits));
+			representative[v] = representatives.insert(std::make_pair(key, v)).first->second;
+		}
+
+		std::unordered_map<unsigned long long, unsigned int> edges;
+		edges.reserve(indices.size());
+		for (size_t t = 0; t < indices.size() / 3; t++) {
+			GLuint *v = &_triangles[3 * t];
+			for (int j = 0; j < 3; j++)
+				v[j] = representative[indices[3 * t + j]];
+			glm::dvec3 p0 = toVec(positions[v[0]]), p1 = toVec(positions[v[1]]), p2 = toVec(positions[v[2]]);
+			glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+			double area = glm::length(normal);
+			if (v[0] == v[1] || v[1] == v[2] || v[0] == v[2] || area <= 0.0) {
+				_removedTriangle[t] = 1;
+				continue;
+			}
+			++_triangleNum;
+			normal /= area;
+			Quadric q(normal, -glm::dot(normal, p0), 0.5 * area);
+			for (int j = 0; j < 3; j++) {
+				_quadrics[v[j]] += q;
+				_adjacency[v[j]].push_back((GLuint)t);
+				++edges[edgeKey(v[j], v[(j + 1) % 3])];
+			}
+		}
+
+		/* plane through border edge, perpendicular to its triangle */
+		for (size_t t = 0; t < indices.size() / 3; t++) {
+			if (_removedTriangle[t])
+				continue;
+			const GLuint *v = &_triangles[3 * t];
+			glm::dvec3 normal = glm::normalize(glm::cross(toVec(positions[v[1]]) - toVec(positions[v[0]]), toVec(positions[v[2]]) - toVec(positions[v[0]])));
+			for (int j = 0; j < 3; j++) {
+				GLuint a = v[j], b = v[(j + 1) % 3];
+				if (edges[edgeKey(a, b)] != 1)
+					continue;
+				glm::dvec3 edge = toVec(positions[b]) - toVec(positions[a]);
+				glm::dvec3 side = glm::cross(edge, normal);
+				double length = glm::length(side);
+				if (length <= 0.0)
+					continue;
+				side /= length;
+				Quadric q(side, -glm::dot(side, toVec(positions[a])), BORDER_WEIGHT * glm::dot(edge, edge));
+				_quadrics[a] += q;
+				_quadrics[b] += q;
+			}
+		}
+
+		for (std::unordered_map<unsigned long long, unsigned int>::const_iterator it = edges.begin(); it != edges.end(); ++it)
+			push((GLuint)(it->first >> 32), (GLuint)(it->first & 0xffffffffu));
+	}
+
+	std::vector<GLuint> run(size_t targetTriangleNum) {
+		while (_triangleNum > targetTriangleNum && !_queue.empty()) {
+			Collapse c = _queue.top();
+			_queue.pop();
+			if (_removedVertex[c.from] || _removedVertex[c.to] || _stamps[c.from] != c.fromStamp || _stamps[c.to] != c.toStamp)
+				continue;
+			if (flips(c.from, c.to))
+				continue;
+			collapse(c.from, c.to);
+		}
+		std::vector<GLuint> indices;
+		indices.reserve(3 * _triangleNum);
+		for (size_t t = 0; t < _removedTriangle.size(); t++)
+			if (!_removedTriangle[t])
+				indices.insert(indices.end(), _corners.begin() + 3 * t, _corners.begin() + 3 * t + 3);
+		return indices;
+	}
+};
+
+}
+
+std::vector<GLuint> simplifyMesh(const aiVector3D *positions, unsigned int vertexNum, const std::vector<GLuint> &indices, size_t targetIndexNum) {
+	Simplifier simplifier(positions, vertexNum, indices);
+	return simplifier.run(targetIndexNum / 3);
+}
@@ -0,0 +1,438 @@
+#include "TextureCache.h"
+#include "FileWatcher.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+const unsigned char IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+const unsigned int ENDIANNESS = 0x04030201;
+/* key of value identifying source image and encoder */
+const char SOURCE_KEY[] = "MVsource";
+/* rows are stored top down, as images are decoded */
+const char ORIENTATION_KEY[] = "KTXorientation";
+const char ORIENTATION[] = "S=r,T=d";
+
+struct KtxHeader {
+	unsigned char identifier[12];
+	unsigned int endianness;
+	unsigned int glType, glTypeSize, glFormat;/* 0, 1, 0 for compressed data */
+	unsigned int glInternalFormat, glBaseInternalFormat;
+	unsigned int pixelWidth, pixelHeight, pixelDepth;
+	unsigned int numberOfArrayElements, numberOfFaces, numberOfMipmapLevels;
+	unsigned int bytesOfKeyValueData;
+};
+
+size_t align(size_t offset, size_t alignment) {
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+/* "version size time" of image file, time in ns, empty if it does not exist */
+std::string sourceValue(const std::string &imagePath) {
+	unsigned long long size;
+	long long time;
+	if (!FileWatcher::identity(imagePath, size, time))
+		return "";
+	std::ostringstream value;
+	value << TextureCache::VERSION << " " << size << " " << time;
+	return value.str();
+}
+
+/* bytes of one 4x4 block */
+size_t blockSize(GLenum format) {
+	return format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? 16 : 8;
+}
+
+size_t levelSize(GLenum format, unsigned int width, unsigned int height) {
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockSize(format);
+}
+
+/* quantize color to 5:6:5 */
+unsigned short pack565(const float *color) {
+	int r = std::min(31, std::max(0, (int)std::floor(color[0] * 31.f / 255.f + .5f)));
+	int g = std::min(63, std::max(0, (int)std::floor(color[1] * 63.f / 255.f + .5f)));
+	int b = std::min(31, std::max(0, (int)std::floor(color[2] * 31.f / 255.f + .5f)));
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+/* expand 5:6:5 color back to 8 bits as decoders do */
+void unpack565(unsigned short packed, int *color) {
+	int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+/* BC1 color block in 4 color mode, endpoints at extremes of block colors along their principal axis */
+void encodeColorBlock(const unsigned char pixels[16][4], unsigned char *out) {
+	float mean[3] = { 0.f, 0.f, 0.f };
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+			mean[c] += pixels[i][c] / 16.f;
+	float covariance[3][3] = { { 0.f } };
+	for (int i = 0; i < 16; i++) {
+		float d[3] = { pixels[i][0] - mean[0], pixels[i][1] - mean[1], pixels[i][2] - mean[2] };
+		for (int a = 0; a < 3; a++)
+			for (int b = 0; b < 3; b++)
+				covariance[a][b] += d[a] * d[b];
+	}
+	/* power iteration, starting from row of largest variance */
+	int largest = 0;
+	for (int c = 1; c < 3; c++)
+		if (covariance[c][c] > covariance[largest][largest])
+			largest = c;
+	float axis[3] = { covariance[largest][0], covariance[largest][1], covariance[largest][2] };
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float next[3];
+		for (int a = 0; a < 3; a++)
+			next[a] = covariance[a][0] * axis[0] + covariance[a][1] * axis[1] + covariance[a][2] * axis[2];
+		float length = std::max(std::fabs(next[0]), std::max(std::fabs(next[1]), std::fabs(next[2])));
+		if (length <= 0.f)
+			break;
+		for (int a = 0; a < 3; a++)
+			axis[a] = next[a] / length;
+	}
+	float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	float minT = 0.f, maxT = 0.f;
+	if (length > 0.f) {
+		for (int a = 0; a < 3; a++)
+			axis[a] /= length;
+		for (int i = 0; i < 16; i++) {
+			float t = (pixels[i][0] - mean[0]) * axis[0] + (pixels[i][1] - mean[1]) * axis[1] + (pixels[i][2] - mean[2]) * axis[2];
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+	}
+	float end0[3], end1[3];
+	for (int a = 0; a < 3; a++) {
+		end0[a] = mean[a] + axis[a] * maxT;
+		end1[a] = mean[a] + axis[a] * minT;
+	}
+	unsigned short color0 = pack565(end0), color1 = pack565(end1);
+	/* 4 color mode needs color0 > color1, equal endpoints use index 0 only */
+	if (color0 < color1)
+		std::swap(color0, color1);
+	int palette[4][3];
+	unpack565(color0, palette[0]);
+	unpack565(color1, palette[1]);
+	for (int c = 0; c < 3; c++) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+	unsigned int indices = 0;
+	if (color0 != color1)
+		for (int i = 0; i < 16; i++) {
+			int best = 0, bestDistance = 0x7fffffff;
+			for (int p = 0; p < 4; p++) {
+				int dr = pixels[i][0] - palette[p][0], dg = pixels[i][1] - palette[p][1], db = pixels[i][2] - palette[p][2];
+				int distance = dr * dr + dg * dg + db * db;
+				if (distance < bestDistance) {
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			indices |= (unsigned int)best << (2 * i);
+		}
+	out[0] = (unsigned char)(color0 & 0xff);
+	out[1] = (unsigned char)(color0 >> 8);
+	out[2] = (unsigned char)(color1 & 0xff);
+	out[3] = (unsigned char)(color1 >> 8);
+	for (int i = 0; i < 4; i++)
+		out[4 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+/* BC4 block, also alpha half of BC3, in 8 value mode between block min and max */
+void encodeValueBlock(const unsigned char values[16], unsigned char *out) {
+	int high = values[0], low = values[0];
+	for (int i = 1; i < 16; i++) {
+		high = std::max(high, (int)values[i]);
+		low = std::min(low, (int)values[i]);
+	}
+	int palette[8] = { high, low };
+	for (int p = 2; p < 8; p++)
+		palette[p] = ((8 - p) * high + (p - 1) * low) / 7;
+	unsigned long long indices = 0;
+	if (high != low)
+		for (int i = 0; i < 16; i++) {
+			int best = 0, bestDistance = 256;
+			for (int p = 0; p < 8; p++) {
+				int distance = std::abs(values[i] - palette[p]);
+				if (distance < bestDistance) {
+					bestDistance = distance;
+					best = p;
+				}
+			}
+			indices |= (unsigned long long)best << (3 * i);
+		}
+	out[0] = (unsigned char)high;
+	out[1] = (unsigned char)low;
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+/* compress RGBA level, blocks crossing the border repeat edge pixels */
+void encodeLevel(const std::vector<unsigned char> &rgba, unsigned int width, unsigned int height, GLenum format, unsigned char *out) {
+	for (unsigned int by = 0; by < height; by += 4)
+		for (unsigned int bx = 0; bx < width; bx += 4) {
+			unsigned char pixels[16][4], values[16];
+			for (unsigned int y = 0; y < 4; y++)
+				for (unsigned int x = 0; x < 4; x++) {
+					const unsigned char *pixel = &rgba[4 * ((size_t)std::min(by + y, height - 1) * width + std::min(bx + x, width - 1))];
+					memcpy(pixels[4 * y + x], pixel, 4);
+				}
+			if (format == GL_COMPRESSED_RED_RGTC1) {
+				for (int i = 0; i < 16; i++)
+					values[i] = pixels[i][0];
+				encodeValueBlock(values, out);
+			} else if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+				for (int i = 0; i < 16; i++)
+					values[i] = pixels[i][3];
+				encodeValueBlock(values, out);
+				encodeColorBlock(pixels, out + 8);
+			} else
+				encodeColorBlock(pixels, out);
+			out += blockSize(format);
+		}
+}
+
+/* next mip level by averaging 2x2 pixels, odd edges repeat their last pixel */
+void downsample(const std::vector<unsigned char> &rgba, unsigned int width, unsigned int height, std::vector<unsigned char> &next) {
+	unsigned int nextWidth = std::max(1u, width / 2), nextHeight = std::max(1u, height / 2);
+	next.resize((size_t)nextWidth * nextHeight * 4);
+	for (unsigned int y = 0; y < nextHeight; y++) {
+		size_t y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+		for (unsigned int x = 0; x < nextWidth; x++) {
+			size_t x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+			for (int c = 0; c < 4; c++) {
+				unsigned int sum = rgba[4 * (y0 * width + x0) + c] + rgba[4 * (y0 * width + x1) + c]
+					+ rgba[4 * (y1 * width + x0) + c] + rgba[4 * (y1 * width + x1) + c];
+				next[4 * ((size_t)y * nextWidth + x) + c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+void writeKeyValue(std::ofstream &file, const char *key, const std::string &value) {
+	static const char zeros[4] = { 0 };
+	unsigned int size = (unsigned int)(strlen(key) + 1 + value.size() + 1);
+	file.write((const char *)&size, sizeof(size));
+	file.write(key, strlen(key) + 1);
+	file.write(value.c_str(), value.size() + 1);
+	file.write(zeros, align(size, 4) - size);
+}
+
+}
+
+bool TextureCache::read(const std::string &imagePath) {
+	std::string source = sourceValue(imagePath);
+	if (source.empty())
+		return false;
+	std::ifstream file(cachePath(imagePath).c_str(), std::ios::binary);
+	if (!file)
+		return false;
+	KtxHeader header;
+	if (!file.read((char *)&header, sizeof(KtxHeader)))
+		return false;
+	if (memcmp(header.identifier, IDENTIFIER, sizeof(IDENTIFIER)) || header.endianness != ENDIANNESS)
+		return false;
+	if (header.glType || header.glFormat || header.pixelDepth || header.numberOfArrayElements || header.numberOfFaces != 1)
+		return false;
+	GLenum format = header.glInternalFormat;
+	if (format != GL_COMPRESSED_RED_RGTC1 && format != GL_COMPRESSED_RGB_S3TC_DXT1_EXT && format != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+		return false;
+	if (!header.pixelWidth || !header.pixelHeight || !header.numberOfMipmapLevels || header.numberOfMipmapLevels > 32)
+		return false;
+
+	/* cache is stale if image or encoder changed */
+	std::vector<char> keyValues(header.bytesOfKeyValueData);
+	if (!keyValues.empty() && !file.read(keyValues.data(), keyValues.size()))
+		return false;
+	bool fresh = false;
+	for (size_t offset = 0; offset + sizeof(unsigned int) <= keyValues.size();) {
+		unsigned int size;
+		memcpy(&size, &keyValues[offset], sizeof(size));
+		offset += sizeof(size);
+		if (offset + size > keyValues.size())
+			return false;
+		std::string pair(&keyValues[offset], size);
+		if (pair.compare(0, sizeof(SOURCE_KEY), SOURCE_KEY, sizeof(SOURCE_KEY)) == 0)
+			fresh = (pair.c_str() + sizeof(SOURCE_KEY) == source);
+		offset = align(offset + size, 4);
+	}
+	if (!fresh)
+		return false;
+
+	unsigned int width = header.pixelWidth, height = header.pixelHeight;
+	_levels.resize(header.numberOfMipmapLevels);
+	for (size_t i = 0; i < _levels.size(); i++) {
+		unsigned int size;
+		if (!file.read((char *)&size, sizeof(size)) || size != levelSize(format, width, height))
+			return false;
+		_levels[i].width = width;
+		_levels[i].height = height;
+		_levels[i].data.resize(size);
+		if (!file.read((char *)_levels[i].data.data(), size))
+			return false;
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+	_format = format;
+	_baseFormat = header.glBaseInternalFormat;
+	_width = header.pixelWidth;
+	_height = header.pixelHeight;
+	return true;
+}
+
+TextureCache::TextureCache(const std::string &imagePath) {
+	_exist = false;
+	_format = _baseFormat = 0;
+	_width = _height = 0;
+
+	if (!read(imagePath)) {
+		_levels.clear();
+		return;
+	}
+	_exist = true;
+}
+
+TextureCache::TextureCache(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int channels, size_t step) {
+	_exist = false;
+	_format = _baseFormat = 0;
+	_width = width;
+	_height = height;
+	if (!width || !height || (channels != 1 && channels != 3 && channels != 4))
+		return;
+
+	/* work on RGBA, single channel stays in red */
+	std::vector<unsigned char> rgba((size_t)width * height * 4);
+	bool opaque = true;
+	for (unsigned int y = 0; y < height; y++) {
+		const unsigned char *row = pixels + y * step;
+		unsigned char *out = &rgba[(size_t)y * width * 4];
+		for (unsigned int x = 0; x < width; x++, row += channels, out += 4) {
+			out[0] = row[0];
+			out[1] = channels >= 3 ? row[1] : 0;
+			out[2] = channels >= 3 ? row[2] : 0;
+			out[3] = channels == 4 ? row[3] : 255;
+			opaque = opaque && out[3] == 255;
+		}
+	}
+	if (channels == 1) {
+		_format = GL_COMPRESSED_RED_RGTC1;
+		_baseFormat = GL_RED;
+	} else if (opaque) {
+		/* alpha channel that is all opaque is dropped */
+		_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		_baseFormat = GL_RGB;
+	} else {
+		_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		_baseFormat = GL_RGBA;
+	}
+
+	std::vector<unsigned char> next;
+	while (true) {
+		_levels.push_back(Level());
+		Level &level = _levels.back();
+		level.width = width;
+		level.height = height;
+		level.data.resize(levelSize(_format, width, height));
+		encodeLevel(rgba, width, height, _format, level.data.data());
+		if (width == 1 && height == 1)
+			break;
+		downsample(rgba, width, height, next);
+		rgba.swap(next);
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+	_exist = true;
+}
+
+bool TextureCache::write(const std::string &imagePath) const {
+	std::string source = sourceValue(imagePath);
+	if (!_exist || source.empty())
+		return false;
+	KtxHeader header;
+	memcpy(header.identifier, IDENTIFIER, sizeof(IDENTIFIER));
+	header.endianness = ENDIANNESS;
+	header.glType = 0;
+	header.glTypeSize = 1;
+	header.glFormat = 0;
+	header.glInternalFormat = _format;
+	header.glBaseInternalFormat = _baseFormat;
+	header.pixelWidth = _width;
+	header.pixelHeight = _height;
+	header.pixelDepth = 0;
+	header.numberOfArrayElements = 0;
+	header.numberOfFaces = 1;
+	header.numberOfMipmapLevels = (unsigned int)_levels.size();
+	header.bytesOfKeyValueData = (unsigned int)(align(sizeof(unsigned int) + sizeof(ORIENTATION_KEY) + sizeof(ORIENTATION), 4)
+		+ align(sizeof(unsigned int) + sizeof(SOURCE_KEY) + source.size() + 1, 4));
+
+	/* write into temporary file so that a partial cache is never read, images shared
+	   by several materials may be written by two workers or processes at once */
+	std::ostringstream tempFile;
+	tempFile << cachePath(imagePath) << "." << getpid() << "." << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+	std::ofstream file(tempFile.str().c_str(), std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+	file.write((const char *)&header, sizeof(KtxHeader));
+	writeKeyValue(file, ORIENTATION_KEY, ORIENTATION);
+	writeKeyValue(file, SOURCE_KEY, source);
+	/* block sizes keep levels 4 bytes aligned, no mip padding needed */
+	for (size_t i = 0; i < _levels.size(); i++) {
+		unsigned int size = (unsigned int)_levels[i].data.size();
+		file.write((const char *)&size, sizeof(size));
+		file.write((const char *)_levels[i].data.data(), size);
+	}
+	file.close();
+	if (!file) {
+		std::remove(tempFile.str().c_str());
+		return false;
+	}
+	std::remove(cachePath(imagePath).c_str());
+	if (std::rename(tempFile.str().c_str(), cachePath(imagePath).c_str())) {
+		std::remove(tempFile.str().c_str());
+		return false;
+	}
+	return true;
+}
+
+bool TextureCache::empty() const { return !_exist; }
+
+GLenum TextureCache::getFormat() const { return _format; }
+
+unsigned int TextureCache::getWidth() const { return _width; }
+
+unsigned int TextureCache::getHeight() const { return _height; }
+
+unsigned int TextureCache::getLevelNum() const { return (unsigned int)_levels.size(); }
+
+const TextureCache::Level & TextureCache::getLevel(unsigned int i) const { return _levels[i]; }
+
+size_t TextureCache::getSize() const {
+	size_t size = 0;
+	for (size_t i = 0; i < _levels.size(); i++)
+		size += _levels[i].data.size();
+	return size;
+}
+
+std::string TextureCache::cachePath(const std::string &imagePath) {
+	return imagePath + ".ktx";
+}
+
+bool TextureCache::supported() {
+	/* RGTC is core since GL 3.0, S3TC is an extension nearly every desktop driver has */
+	return GLEW_EXT_texture_compression_s3tc != 0;
+}
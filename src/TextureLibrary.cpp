@@ -0,0 +1,116 @@
+#include "TextureLibrary.h"
+#include "FileWatcher.h"
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+TextureLibrary::TextureLibrary() {
+	memset(&_stats, 0, sizeof(TextureLibraryStats));
+}
+
+GLuint TextureLibrary::acquire(const std::string &key) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::map<std::string, Entry>::iterator it = _entries.find(key);
+	if (it == _entries.end())
+		return 0;
+	++it->second.references;
+	++_stats.hits;
+	_stats.bytesSaved += it->second.bytes;
+	return it->second.texture;
+}
+
+GLuint TextureLibrary::insert(const std::string &key, GLuint texture, size_t bytes) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::map<std::string, Entry>::iterator it = _entries.find(key);
+	if (it != _entries.end()) {
+		/* another model uploaded the same image while this one decoded it, counted as acquire() would */
+		glDeleteTextures(1, &texture);
+		++it->second.references;
+		++_stats.hits;
+		_stats.bytesSaved += bytes;
+		return it->second.texture;
+	}
+	++_stats.misses;
+	Entry entry;
+	entry.texture = texture;
+	entry.references = 1;
+	entry.bytes = bytes;
+	_entries[key] = entry;
+	_keys[texture] = key;
+	++_stats.textureNum;
+	_stats.bytes += bytes;
+	return texture;
+}
+
+void TextureLibrary::release(GLuint texture) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::map<GLuint, std::string>::iterator key = _keys.find(texture);
+	if (key == _keys.end()) {
+		/* not handed out by library */
+		glDeleteTextures(1, &texture);
+		return;
+	}
+	std::map<std::string, Entry>::iterator it = _entries.find(key->second);
+	if (--it->second.references)
+		return;
+	glDeleteTextures(1, &texture);
+	--_stats.textureNum;
+	_stats.bytes -= it->second.bytes;
+	_entries.erase(it);
+	_keys.erase(key);
+}
+
+void TextureLibrary::replace(GLuint texture, const std::string &key, size_t bytes) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::map<GLuint, std::string>::iterator oldKey = _keys.find(texture);
+	if (oldKey == _keys.end())
+		return;
+	std::map<std::string, Entry>::iterator it = _entries.find(oldKey->second);
+	_stats.bytes = _stats.bytes - it->second.bytes + bytes;
+	it->second.bytes = bytes;
+	/* stays under old key if new image is known as another texture already */
+	if (_entries.count(key))
+		return;
+	Entry entry = it->second;
+	_entries.erase(it);
+	_entries[key] = entry;
+	oldKey->second = key;
+}
+
+size_t TextureLibrary::getBytes(GLuint texture) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::map<GLuint, std::string>::const_iterator key = _keys.find(texture);
+	return key == _keys.end() ? 0 : _entries[key->second].bytes;
+}
+
+TextureLibraryStats TextureLibrary::getStats() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _stats;
+}
+
+std::string TextureLibrary::key(const std::string &path) {
+	/* "a/../b.png" and "b.png" are one image */
+	std::string resolved = path;
+#ifdef _WIN32
+	char buffer[_MAX_PATH];
+	if (_fullpath(buffer, path.c_str(), _MAX_PATH))
+		resolved = buffer;
+#else
+	char buffer[PATH_MAX];
+	if (realpath(path.c_str(), buffer))
+		resolved = buffer;
+#endif
+	unsigned long long size;
+	long long time;
+	if (!FileWatcher::identity(path, size, time))
+		return resolved;
+	std::ostringstream key;
+	key << resolved << "|" << size << "|" << time;
+	return key.str();
+}
+
+TextureLibrary & TextureLibrary::shared() {
+	static TextureLibrary library;
+	return library;
+}
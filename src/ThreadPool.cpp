@@ -0,0 +1,87 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+void ThreadPool::work() {
+	for (;;) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_condition.wait(lock, [this] { return _stop || !_tasks.empty(); });
+			if (_stop && _tasks.empty())
+				return;
+			task = _tasks.front();
+			_tasks.pop();
+		}
+		task();
+	}
+}
+
+ThreadPool::ThreadPool(unsigned int threadNum) {
+	_stop = false;
+	if (!threadNum)
+		threadNum = std::thread::hardware_concurrency();
+	if (!threadNum)
+		threadNum = 1;
+	for (unsigned int i = 0; i < threadNum; i++)
+		_workers.push_back(std::thread(&ThreadPool::work, this));
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_condition.notify_all();
+	for (size_t i = 0; i < _workers.size(); i++)
+		_workers[i].join();
+}
+
+void ThreadPool::push(const std::function<void()> &task) {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_tasks.push(task);
+	}
+	_condition.notify_one();
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)> &task) {
+	if (!count)
+		return;
+	/* helpers starting after everything is done only find no index left, job outlives call for them */
+	struct Job {
+		std::function<void(size_t)> task;
+		size_t count;
+		std::atomic<size_t> next, done;
+		std::mutex mutex;
+		std::condition_variable condition;
+	};
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->task = task;
+	job->count = count;
+	job->next = 0;
+	job->done = 0;
+	std::function<void()> run = [job] {
+		for (size_t i; (i = job->next++) < job->count;) {
+			job->task(i);
+			if (++job->done == job->count) {
+				std::lock_guard<std::mutex> lock(job->mutex);
+				job->condition.notify_all();
+			}
+		}
+	};
+	size_t helpers = std::min((size_t)size(), count - 1);
+	for (size_t i = 0; i < helpers; i++)
+		push(run);
+	run();
+	std::unique_lock<std::mutex> lock(job->mutex);
+	job->condition.wait(lock, [&job] { return job->done == job->count; });
+}
+
+unsigned int ThreadPool::size() const {
+	return (unsigned int)_workers.size();
+}
+
+ThreadPool & ThreadPool::shared() {
+	static ThreadPool pool;
+	return pool;
+}
@@ -0,0 +1,218 @@
+#include "Model.h"
+#include "OffscreenContext.h"
+#include "ShaderLibrary.h"
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+/* model pose of a camera preset, same conventions as the viewer */
+struct CameraPreset {
+	const char *name;
+	GLint angleX, angleY, angleZ;
+};
+
+const CameraPreset presets[] = {
+	{ "front", 0, 0, 0 },
+	{ "back", 0, 180, 0 },
+	{ "left", 0, 90, 0 },
+	{ "right", 0, -90, 0 },
+	{ "top", 90, 0, 0 },
+	{ "bottom", -90, 0, 0 },
+	{ "iso", 30, -45, 0 }
+};
+
+ShaderLibrary * library_ptr = nullptr;
+RenderState * state_ptr = nullptr;
+GLuint framebuffer = 0, colorBuffer = 0, depthBuffer = 0;/* render target, multisampled if asked */
+GLuint resolveFramebuffer = 0, resolveBuffer = 0;/* single sample copy for read back */
+
+bool createFramebuffer(int size, int samples);
+bool render(const std::string &path, const std::string &output, int size, int samples, const CameraPreset &preset, bool useLight);
+void clear();
+
+void usage() {
+	std::cout << "Usage : command [-s size] [-v view] [-m samples] [-o output_dir] [-i list_file] [-n] model_filename ..." << std::endl;
+	std::cout << "  -s : thumbnail width and height, default 256" << std::endl;
+	std::cout << "  -v : camera preset front, back, left, right, top, bottom or iso, default iso" << std::endl;
+	std::cout << "  -m : multisample count, default 0" << std::endl;
+	std::cout << "  -o : output directory, default current directory" << std::endl;
+	std::cout << "  -i : file listing one model filename per line" << std::endl;
+	std::cout << "  -n : turn off the light" << std::endl;
+}
+
+int main(int argc, char **argv) {
+	int size = 256, samples = 0;
+	std::string outputDir = ".";
+	const CameraPreset *preset = &presets[6];
+	bool useLight = true;
+	std::vector<std::string> paths;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-n")
+			useLight = false;
+		else if (arg[0] == '-' && arg.size() == 2 && i + 1 < argc) {
+			std::string value = argv[++i];
+			if (arg == "-s")
+				size = atoi(value.c_str());
+			else if (arg == "-m")
+				samples = atoi(value.c_str());
+			else if (arg == "-o")
+				outputDir = value;
+			else if (arg == "-v") {
+				preset = nullptr;
+				for (size_t j = 0; j < sizeof(presets) / sizeof(presets[0]); j++)
+					if (value == presets[j].name)
+						preset = &presets[j];
+			} else if (arg == "-i") {
+				std::ifstream list(value.c_str());
+				std::string line;
+				while (std::getline(list, line))
+					if (!line.empty() && line[0] != '#')
+						paths.push_back(line);
+			} else
+				preset = nullptr;
+		} else if (arg[0] != '-')
+			paths.push_back(arg);
+		else
+			preset = nullptr;
+	}
+	if (!preset || size <= 0 || samples < 0 || paths.empty()) {
+		usage();
+		return 0;
+	}
+
+	OffscreenContext context;
+	if (context.empty()) {
+		std::cout << context.getErrorInfo() << std::endl;
+		return 1;
+	}
+	std::cout << "renderer : " << glGetString(GL_RENDERER) << std::endl;
+
+	/* one set of programs and render target for all models, programs cached by viewer are shared */
+	library_ptr = new ShaderLibrary();
+	if (library_ptr->empty() || !createFramebuffer(size, samples)) {
+		std::cout << "Fail to initialize OpenGL context ." << std::endl;
+		clear();
+		return 1;
+	}
+	RenderState state(*library_ptr);
+	state_ptr = &state;
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+	glViewport(0, 0, size, size);
+
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	size_t rendered = 0;
+	for (size_t i = 0; i < paths.size(); i++) {
+		std::string name = paths[i];
+		size_t pos = name.find_last_of("/\\");
+		if (pos != std::string::npos)
+			name = name.substr(pos + 1);
+		pos = name.find_last_of('.');
+		if (pos != std::string::npos && pos)
+			name = name.substr(0, pos);
+		std::string output = outputDir + "/" + name + ".png";
+		if (render(paths[i], output, size, samples, *preset, useLight)) {
+			std::cout << paths[i] << " -> " << output << std::endl;
+			++rendered;
+		}
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+	std::cout << rendered << " of " << paths.size() << " thumbnails in " << elapsed.count() << " s";
+	if (elapsed.count() > 0.0)
+		std::cout << " (" << (int)(rendered * 3600.0 / elapsed.count()) << " per hour)";
+	std::cout << " ." << std::endl;
+
+	clear();
+	return rendered == paths.size() ? 0 : 1;
+}
+
+bool createFramebuffer(int size, int samples) {
+	glGenFramebuffers(1, &framebuffer);
+	glGenRenderbuffers(1, &colorBuffer);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, size, size);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, size, size);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		return false;
+
+	if (samples) {
+		glGenFramebuffers(1, &resolveFramebuffer);
+		glGenRenderbuffers(1, &resolveBuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, resolveFramebuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, resolveBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size, size);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, resolveBuffer);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			return false;
+	}
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	return true;
+}
+
+bool render(const std::string &path, const std::string &output, int size, int samples, const CameraPreset &preset, bool useLight) {
+	Model model(path);
+	if (model.empty()) {
+		std::cout << path << " : " << model.getErrorInfo() << std::endl;
+		return false;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	glm::mat4 view = glm::translate(glm::mat4(1.f), glm::vec3(0.f, 0.f, -2.f));
+	glm::mat4 modelMatrix = glm::mat4(1.f);
+	modelMatrix = glm::rotate(modelMatrix, glm::radians(1.f*preset.angleX), glm::vec3(1.f, 0.f, 0.f));
+	modelMatrix = glm::rotate(modelMatrix, glm::radians(1.f*preset.angleY), glm::vec3(0.f, 1.f, 0.f));
+	modelMatrix = glm::rotate(modelMatrix, glm::radians(1.f*preset.angleZ), glm::vec3(0.f, 0.f, 1.f));
+
+	/* textures and arrays of previous model are deleted, uniforms of program are kept */
+	state_ptr->beginFrame();
+	state_ptr->setMat4(UNIFORM_POSITION_MATRIX, view*modelMatrix);
+	state_ptr->setMat3(UNIFORM_NORMAL_MATRIX, glm::mat3(glm::transpose(glm::inverse(modelMatrix))));
+	state_ptr->setMat4(UNIFORM_PROJECTION, glm::perspective(glm::radians(45.f), 1.f, .1f, 1000000.f));
+	state_ptr->setInt(UNIFORM_USE_LIGHT, (int)useLight);
+
+	model.draw(*state_ptr);
+
+	/* resolve multisampled image before read back */
+	if (samples) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFramebuffer);
+		glBlitFramebuffer(0, 0, size, size, 0, 0, size, size, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, resolveFramebuffer);
+	} else
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+
+	cv::Mat image(size, size, CV_8UC4);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, size, size, GL_BGRA, GL_UNSIGNED_BYTE, image.data);
+	cv::flip(image, image, 0);
+	if (!cv::imwrite(output, image)) {
+		std::cout << "Fail to write " << output << " ." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void clear() {
+	delete library_ptr;
+	library_ptr = nullptr;
+	if (framebuffer)
+		glDeleteFramebuffers(1, &framebuffer);
+	if (resolveFramebuffer)
+		glDeleteFramebuffers(1, &resolveFramebuffer);
+	GLuint renderbuffers[] = { colorBuffer, depthBuffer, resolveBuffer };
+	for (int i = 0; i < 3; i++)
+		if (renderbuffers[i])
+			glDeleteRenderbuffers(1, renderbuffers + i);
+}